@@ -1,11 +1,16 @@
 #define HL_NAME(n) fmt_##n
 #include <png.h>
 #include <hl.h>
+#include <math.h>
+#include <setjmp.h>
 
 #if defined(HL_CONSOLE) && !defined(HL_XBO)
 extern bool sys_jpg_decode( vbyte *data, int dataLen, vbyte *out, int width, int height, int stride, int format, int flags );
 #else
+#	include <stdio.h>
 #	include <turbojpeg.h>
+#	include <jpeglib.h>
+#	define HL_JPEG_STREAM
 #endif
 
 #include <zlib.h>
@@ -104,20 +109,353 @@ HL_PRIM bool HL_NAME(png_decode)( vbyte *data, int dataLen, vbyte *out, int widt
 	return true;
 }
 
-HL_PRIM void HL_NAME(img_scale)( vbyte *out, int outPos, int outStride, int outWidth, int outHeight, vbyte *in, int inPos, int inStride, int inWidth, int inHeight, int flags ) {
+/*
+	img_scale flags :
+		bit 0 : bilinear sampling, nearest otherwise (only when no filter is set)
+		bits 1-3 : separable resampling filter (IMG_FILTER_*)
+		bit 4 : don't split the work on worker threads
+*/
+#define IMG_BILINEAR		1
+#define IMG_FILTER_SHIFT	1
+#define IMG_FILTER_MASK		7
+#define IMG_NO_THREADS		16
+
+typedef enum {
+	IMG_FILTER_NONE,
+	IMG_FILTER_BILINEAR,
+	IMG_FILTER_BICUBIC,
+	IMG_FILTER_LANCZOS3,
+	IMG_FILTER_AREA,
+} img_filter;
+
+// minimum number of pixels per worker thread
+#define IMG_THREAD_WORK	(1 << 18)
+
+#if defined(__x86_64__) || defined(_M_X64)
+#	include <immintrin.h>
+#	define HL_IMG_SIMD
+#	ifdef HL_VCC
+#		include <intrin.h>
+#		define IMG_SSSE3_FUN
+#		define IMG_AVX2_FUN
+#	else
+#		define IMG_SSSE3_FUN __attribute__((target("ssse3")))
+#		define IMG_AVX2_FUN __attribute__((target("avx2")))
+#	endif
+#endif
+
+// filter weights for every output pixel of one axis, in fixed point
+typedef struct {
+	int *bounds; // first input pixel and count
+	short *coefs;
+	int ksize;
+	int prec;
+} img_coefs;
+
+typedef struct {
+	vbyte *out;
+	vbyte *in;
+	int outStride;
+	int outWidth;
+	int outHeight;
+	int inStride;
+	int inWidth;
+	int inHeight;
+	int flags;
+	img_filter filter;
+	img_coefs h;
+	img_coefs v;
+	bool error;
+} img_resample;
+
+static int img_simd = -1;
+
+static void img_simd_init() {
+#	if defined(HL_IMG_SIMD) && defined(HL_VCC)
+	int info[4];
+	bool ssse3, avx;
+	__cpuid(info,1);
+	ssse3 = (info[2] & (1 << 9)) != 0;
+	avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info,7,0);
+	img_simd = ssse3 ? (avx && (info[1] & (1 << 5)) ? 2 : 1) : 0;
+#	elif defined(HL_IMG_SIMD)
+	__builtin_cpu_init();
+	img_simd = __builtin_cpu_supports("ssse3") ? (__builtin_cpu_supports("avx2") ? 2 : 1) : 0;
+#	else
+	img_simd = 0;
+#	endif
+}
+
+static double img_sinc( double x ) {
+	if( x == 0.0 )
+		return 1.0;
+	x *= 3.14159265358979323846;
+	return sin(x) / x;
+}
+
+static double img_filter_weight( img_filter f, double x ) {
+	// half open box : a sample on a pixel edge belongs to one pixel, the one img_coefs_init keeps
+	if( f == IMG_FILTER_AREA )
+		return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+	if( x < 0.0 ) x = -x;
+	switch( f ) {
+	case IMG_FILTER_BILINEAR:
+		return x < 1.0 ? 1.0 - x : 0.0;
+	case IMG_FILTER_BICUBIC:
+		// Catmull-Rom (a = -0.5)
+		if( x < 1.0 )
+			return ((1.5 * x - 2.5) * x) * x + 1.0;
+		if( x < 2.0 )
+			return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+		return 0.0;
+	case IMG_FILTER_LANCZOS3:
+		return x < 3.0 ? img_sinc(x) * img_sinc(x / 3.0) : 0.0;
+	default:
+		return 0.0;
+	}
+}
+
+static double img_filter_support( img_filter f ) {
+	switch( f ) {
+	case IMG_FILTER_BILINEAR: return 1.0;
+	case IMG_FILTER_BICUBIC: return 2.0;
+	case IMG_FILTER_LANCZOS3: return 3.0;
+	default: return 0.5;
+	}
+}
+
+/*
+	Weights are stretched by the scale factor when downscaling so every input
+	pixel contributes, then stored as 16 bits integers with the highest precision
+	that keeps the biggest weight in range.
+*/
+static bool img_coefs_init( img_coefs *c, img_filter f, int inSize, int outSize ) {
+	double scale = (double)inSize / outSize;
+	double fscale = scale < 1.0 ? 1.0 : scale;
+	double support = img_filter_support(f) * fscale;
+	double maxk = 0.0;
+	double *k;
+	int x, i;
+	c->ksize = (int)ceil(support) * 2 + 1;
+	c->bounds = (int*)malloc(sizeof(int) * 2 * outSize);
+	c->coefs = (short*)malloc(sizeof(short) * c->ksize * outSize);
+	k = (double*)malloc(sizeof(double) * c->ksize * outSize);
+	if( !c->bounds || !c->coefs || !k ) {
+		free(k);
+		return false;
+	}
+	for(x=0;x<outSize;x++) {
+		double center = (x + 0.5) * scale;
+		double total = 0.0;
+		double *kx = k + x * c->ksize;
+		double nearest = 1e9;
+		int inearest = 0;
+		int xmin = (int)(center - support + 0.5);
+		int xmax = (int)(center + support + 0.5);
+		if( xmin < 0 ) xmin = 0;
+		if( xmax > inSize ) xmax = inSize;
+		xmax -= xmin;
+		for(i=0;i<xmax;i++) {
+			double d = (i + xmin - center + 0.5) / fscale;
+			double w = img_filter_weight(f,d);
+			kx[i] = w;
+			total += w;
+			if( fabs(d) < nearest ) {
+				nearest = fabs(d);
+				inearest = i;
+			}
+		}
+		// no tap in the filter support : use the nearest pixel rather than black
+		if( total == 0.0 && xmax > 0 ) {
+			kx[inearest] = 1.0;
+			total = 1.0;
+		}
+		for(i=0;i<xmax;i++) {
+			if( total != 0.0 ) kx[i] /= total;
+			if( kx[i] > maxk ) maxk = kx[i];
+		}
+		for(;i<c->ksize;i++)
+			kx[i] = 0.0;
+		c->bounds[x * 2] = xmin;
+		c->bounds[x * 2 + 1] = xmax;
+	}
+	for(c->prec=0;c->prec<22;c->prec++)
+		if( (int)(0.5 + maxk * (1 << (c->prec + 1))) >= (1 << 15) )
+			break;
+	for(i=0;i<c->ksize*outSize;i++) {
+		double w = k[i] * (1 << c->prec);
+		c->coefs[i] = (short)(w < 0 ? w - 0.5 : w + 0.5);
+	}
+	free(k);
+	return true;
+}
+
+static void img_coefs_free( img_coefs *c ) {
+	free(c->bounds);
+	free(c->coefs);
+	c->bounds = NULL;
+	c->coefs = NULL;
+}
+
+static inline unsigned char img_clip( int v ) {
+	return v < 0 ? 0 : (v > 255 ? 255 : (unsigned char)v);
+}
+
+static void img_hpass_c( unsigned char *out, const unsigned char *in, int width, const img_coefs *c ) {
+	int x, i;
+	int round = 1 << (c->prec - 1);
+	for(x=0;x<width;x++) {
+		const unsigned char *p = in + (c->bounds[x * 2] << 2);
+		const short *k = c->coefs + x * c->ksize;
+		int n = c->bounds[x * 2 + 1];
+		int s0 = round, s1 = round, s2 = round, s3 = round;
+		for(i=0;i<n;i++) {
+			s0 += p[0] * k[i];
+			s1 += p[1] * k[i];
+			s2 += p[2] * k[i];
+			s3 += p[3] * k[i];
+			p += 4;
+		}
+		*out++ = img_clip(s0 >> c->prec);
+		*out++ = img_clip(s1 >> c->prec);
+		*out++ = img_clip(s2 >> c->prec);
+		*out++ = img_clip(s3 >> c->prec);
+	}
+}
+
+static void img_vpass_c( unsigned char *out, const unsigned char *in, int stride, int bytes, const short *k, int n, int prec ) {
+	int x, i;
+	for(x=0;x<bytes;x++) {
+		int s = 1 << (prec - 1);
+		for(i=0;i<n;i++)
+			s += in[i * stride + x] * k[i];
+		out[x] = img_clip(s >> prec);
+	}
+}
+
+#ifdef HL_IMG_SIMD
+
+#define IMG_COEF_PAIR(k0,k1)	_mm_set1_epi32((int)(((unsigned)(unsigned short)(k1) << 16) | (unsigned short)(k0)))
+
+// two pixels (taps) per madd : channel c of both pixels is paired in one 32 bits lane
+IMG_SSSE3_FUN static void img_hpass_ssse3( unsigned char *out, const unsigned char *in, int width, const img_coefs *c ) {
+	const __m128i lo = _mm_setr_epi8(0,-1,4,-1,1,-1,5,-1,2,-1,6,-1,3,-1,7,-1);
+	const __m128i hi = _mm_setr_epi8(8,-1,12,-1,9,-1,13,-1,10,-1,14,-1,11,-1,15,-1);
+	const __m128i round = _mm_set1_epi32(1 << (c->prec - 1));
+	int x, i;
+	for(x=0;x<width;x++) {
+		const unsigned char *p = in + (c->bounds[x * 2] << 2);
+		const short *k = c->coefs + x * c->ksize;
+		int n = c->bounds[x * 2 + 1];
+		__m128i s = round;
+		for(i=0;i+3<n;i+=4) {
+			__m128i v = _mm_loadu_si128((__m128i*)(p + (i << 2)));
+			s = _mm_add_epi32(s,_mm_madd_epi16(_mm_shuffle_epi8(v,lo),IMG_COEF_PAIR(k[i],k[i+1])));
+			s = _mm_add_epi32(s,_mm_madd_epi16(_mm_shuffle_epi8(v,hi),IMG_COEF_PAIR(k[i+2],k[i+3])));
+		}
+		if( i + 1 < n ) {
+			__m128i v = _mm_loadl_epi64((__m128i*)(p + (i << 2)));
+			s = _mm_add_epi32(s,_mm_madd_epi16(_mm_shuffle_epi8(v,lo),IMG_COEF_PAIR(k[i],k[i+1])));
+			i += 2;
+		}
+		if( i < n ) {
+			__m128i v = _mm_cvtsi32_si128(*(int*)(p + (i << 2)));
+			s = _mm_add_epi32(s,_mm_madd_epi16(_mm_shuffle_epi8(v,lo),IMG_COEF_PAIR(k[i],0)));
+		}
+		s = _mm_srai_epi32(s,c->prec);
+		s = _mm_packs_epi32(s,s);
+		*(int*)out = _mm_cvtsi128_si32(_mm_packus_epi16(s,s));
+		out += 4;
+	}
+}
+
+// bytes of two rows are interleaved so each madd handles two taps
+static int img_vpass_sse2( unsigned char *out, const unsigned char *in, int stride, int bytes, const short *k, int n, int prec ) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (prec - 1));
+	int x, i;
+	for(x=0;x+15<bytes;x+=16) {
+		__m128i s0 = round, s1 = round, s2 = round, s3 = round;
+		for(i=0;i<n;i+=2) {
+			__m128i r0 = _mm_loadu_si128((__m128i*)(in + i * stride + x));
+			__m128i r1 = i + 1 < n ? _mm_loadu_si128((__m128i*)(in + (i + 1) * stride + x)) : zero;
+			__m128i kk = IMG_COEF_PAIR(k[i],i + 1 < n ? k[i+1] : 0);
+			__m128i l = _mm_unpacklo_epi8(r0,r1);
+			__m128i h = _mm_unpackhi_epi8(r0,r1);
+			s0 = _mm_add_epi32(s0,_mm_madd_epi16(_mm_unpacklo_epi8(l,zero),kk));
+			s1 = _mm_add_epi32(s1,_mm_madd_epi16(_mm_unpackhi_epi8(l,zero),kk));
+			s2 = _mm_add_epi32(s2,_mm_madd_epi16(_mm_unpacklo_epi8(h,zero),kk));
+			s3 = _mm_add_epi32(s3,_mm_madd_epi16(_mm_unpackhi_epi8(h,zero),kk));
+		}
+		s0 = _mm_packs_epi32(_mm_srai_epi32(s0,prec),_mm_srai_epi32(s1,prec));
+		s2 = _mm_packs_epi32(_mm_srai_epi32(s2,prec),_mm_srai_epi32(s3,prec));
+		_mm_storeu_si128((__m128i*)(out + x),_mm_packus_epi16(s0,s2));
+	}
+	return x;
+}
+
+// same as SSE2 : unpack and pack both work per 128 bits lane so the order is kept
+IMG_AVX2_FUN static int img_vpass_avx2( unsigned char *out, const unsigned char *in, int stride, int bytes, const short *k, int n, int prec ) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi32(1 << (prec - 1));
+	int x, i;
+	for(x=0;x+31<bytes;x+=32) {
+		__m256i s0 = round, s1 = round, s2 = round, s3 = round;
+		for(i=0;i<n;i+=2) {
+			__m256i r0 = _mm256_loadu_si256((__m256i*)(in + i * stride + x));
+			__m256i r1 = i + 1 < n ? _mm256_loadu_si256((__m256i*)(in + (i + 1) * stride + x)) : zero;
+			__m256i kk = _mm256_broadcastsi128_si256(IMG_COEF_PAIR(k[i],i + 1 < n ? k[i+1] : 0));
+			__m256i l = _mm256_unpacklo_epi8(r0,r1);
+			__m256i h = _mm256_unpackhi_epi8(r0,r1);
+			s0 = _mm256_add_epi32(s0,_mm256_madd_epi16(_mm256_unpacklo_epi8(l,zero),kk));
+			s1 = _mm256_add_epi32(s1,_mm256_madd_epi16(_mm256_unpackhi_epi8(l,zero),kk));
+			s2 = _mm256_add_epi32(s2,_mm256_madd_epi16(_mm256_unpacklo_epi8(h,zero),kk));
+			s3 = _mm256_add_epi32(s3,_mm256_madd_epi16(_mm256_unpackhi_epi8(h,zero),kk));
+		}
+		s0 = _mm256_packs_epi32(_mm256_srai_epi32(s0,prec),_mm256_srai_epi32(s1,prec));
+		s2 = _mm256_packs_epi32(_mm256_srai_epi32(s2,prec),_mm256_srai_epi32(s3,prec));
+		_mm256_storeu_si256((__m256i*)(out + x),_mm256_packus_epi16(s0,s2));
+	}
+	return x;
+}
+
+#endif
+
+static void img_hpass( unsigned char *out, const unsigned char *in, int width, const img_coefs *c ) {
+#	ifdef HL_IMG_SIMD
+	if( img_simd > 0 ) {
+		img_hpass_ssse3(out,in,width,c);
+		return;
+	}
+#	endif
+	img_hpass_c(out,in,width,c);
+}
+
+static void img_vpass( unsigned char *out, const unsigned char *in, int stride, int bytes, const short *k, int n, int prec ) {
+	int x = 0;
+#	ifdef HL_IMG_SIMD
+	if( img_simd > 1 )
+		x = img_vpass_avx2(out,in,stride,bytes,k,n,prec);
+	x += img_vpass_sse2(out + x,in + x,stride,bytes - x,k,n,prec);
+#	endif
+	img_vpass_c(out + x,in + x,stride,bytes - x,k,n,prec);
+}
+
+static void img_scale_legacy( img_resample *r, int y0, int y1 ) {
 	int x, y;
-	float scaleX = outWidth <= 1 ? 0.0f : (float)((inWidth - 1.001f) / (outWidth - 1));
-	float scaleY = outHeight <= 1 ? 0.0f : (float)((inHeight - 1.001f) / (outHeight - 1));
-	out += outPos;
-	in += inPos;
-	hl_blocking(true);
-	for(y=0;y<outHeight;y++) {
-		for(x=0;x<outWidth;x++) {
+	float scaleX = r->outWidth <= 1 ? 0.0f : (float)((r->inWidth - 1.001f) / (r->outWidth - 1));
+	float scaleY = r->outHeight <= 1 ? 0.0f : (float)((r->inHeight - 1.001f) / (r->outHeight - 1));
+	vbyte *in = r->in;
+	int inStride = r->inStride;
+	for(y=y0;y<y1;y++) {
+		vbyte *out = r->out + y * r->outStride;
+		for(x=0;x<r->outWidth;x++) {
 			float fx = x * scaleX;
 			float fy = y * scaleY;
 			int ix = (int)fx;
 			int iy = (int)fy;
-			if( (flags & 1) == 0 ) {
+			if( (r->flags & IMG_BILINEAR) == 0 ) {
 				// nearest
 				vbyte *rin = in + iy * inStride;
 				*(pixel*)out = *(pixel*)(rin + (ix<<2));
@@ -143,9 +481,523 @@ HL_PRIM void HL_NAME(img_scale)( vbyte *out, int outPos, int outStride, int outW
 				*out++ = (unsigned char)((p1.b * w1 + p2.b * w2 + p3.b * w3 + p4.b * w4 + 128)>>8);
 			}
 		}
-		out += outStride - (outWidth << 2);
 	}
+}
+
+/*
+	Resample output rows [y0,y1[ : the input rows they need are first scaled
+	horizontally into a temporary buffer, then combined vertically. An axis
+	keeping its size is not resampled.
+*/
+static void img_scale_band( img_resample *r, int y0, int y1 ) {
+	bool hpass = r->inWidth != r->outWidth;
+	bool vpass = r->inHeight != r->outHeight;
+	int ymin = y0, ymax = y1, y;
+	unsigned char *src = r->in;
+	int srcStride = r->inStride;
+	int bytes = r->outWidth << 2;
+	if( r->filter == IMG_FILTER_NONE ) {
+		img_scale_legacy(r,y0,y1);
+		return;
+	}
+	if( vpass ) {
+		ymin = r->v.bounds[y0 * 2];
+		ymax = r->v.bounds[(y1 - 1) * 2] + r->v.bounds[(y1 - 1) * 2 + 1];
+	}
+	if( hpass && vpass ) {
+		src = (unsigned char*)malloc((size_t)bytes * (ymax - ymin));
+		if( src == NULL ) {
+			r->error = true;
+			return;
+		}
+		for(y=ymin;y<ymax;y++)
+			img_hpass(src + (size_t)(y - ymin) * bytes,r->in + (size_t)y * r->inStride,r->outWidth,&r->h);
+		srcStride = bytes;
+	} else if( hpass ) {
+		for(y=y0;y<y1;y++)
+			img_hpass(r->out + (size_t)y * r->outStride,r->in + (size_t)y * r->inStride,r->outWidth,&r->h);
+		return;
+	} else
+		src += (size_t)ymin * srcStride;
+	for(y=y0;y<y1;y++) {
+		unsigned char *out = r->out + (size_t)y * r->outStride;
+		if( vpass ) {
+			int first = r->v.bounds[y * 2];
+			img_vpass(out,src + (size_t)(first - ymin) * srcStride,srcStride,bytes,r->v.coefs + y * r->v.ksize,r->v.bounds[y * 2 + 1],r->v.prec);
+		} else
+			memcpy(out,src + (size_t)(y - ymin) * srcStride,bytes);
+	}
+	if( hpass )
+		free(src);
+}
+
+typedef struct {
+	img_resample *r;
+	hl_condition *cond;
+	int bands;
+	int next;
+	int running;
+} img_workers;
+
+static void img_worker( img_workers *w ) {
+	while( true ) {
+		int b;
+		hl_condition_acquire(w->cond);
+		b = w->next++;
+		if( b >= w->bands ) {
+			w->running--;
+			hl_condition_signal(w->cond);
+			hl_condition_release(w->cond);
+			break;
+		}
+		hl_condition_release(w->cond);
+		img_scale_band(w->r,(int)((int_val)b * w->r->outHeight / w->bands),(int)((int_val)(b + 1) * w->r->outHeight / w->bands));
+	}
+}
+
+static void img_scale_run( img_resample *r ) {
+	img_workers w;
+	int i, threads = 1;
+	if( (r->flags & IMG_NO_THREADS) == 0 ) {
+		int_val work = (int_val)r->outWidth * r->outHeight;
+		if( r->filter != IMG_FILTER_NONE )
+			work += (int_val)r->inWidth * r->inHeight;
+		threads = hl_thread_cpu_count();
+		if( threads > 1 + work / IMG_THREAD_WORK ) threads = (int)(1 + work / IMG_THREAD_WORK);
+		if( threads > r->outHeight ) threads = r->outHeight;
+	}
+	if( threads <= 1 ) {
+		img_scale_band(r,0,r->outHeight);
+		return;
+	}
+	w.r = r;
+	w.cond = hl_condition_alloc();
+	w.bands = threads;
+	w.next = 0;
+	w.running = 1;
+	for(i=1;i<threads;i++) {
+		hl_condition_acquire(w.cond);
+		w.running++;
+		hl_condition_release(w.cond);
+		if( hl_thread_start(img_worker,&w,false) == NULL ) {
+			hl_condition_acquire(w.cond);
+			w.running--;
+			hl_condition_release(w.cond);
+			break;
+		}
+	}
+	// the calling thread takes its share of bands, then waits for the others
+	img_worker(&w);
+	hl_condition_acquire(w.cond);
+	while( w.running > 0 )
+		hl_condition_wait(w.cond);
+	hl_condition_release(w.cond);
+	hl_condition_free(w.cond);
+}
+
+HL_PRIM void HL_NAME(img_scale)( vbyte *out, int outPos, int outStride, int outWidth, int outHeight, vbyte *in, int inPos, int inStride, int inWidth, int inHeight, int flags ) {
+	img_resample r;
+	if( outWidth <= 0 || outHeight <= 0 || inWidth <= 0 || inHeight <= 0 )
+		return;
+	memset(&r,0,sizeof(r));
+	r.out = out + outPos;
+	r.in = in + inPos;
+	r.outStride = outStride;
+	r.outWidth = outWidth;
+	r.outHeight = outHeight;
+	r.inStride = inStride;
+	r.inWidth = inWidth;
+	r.inHeight = inHeight;
+	r.flags = flags;
+	r.filter = (img_filter)((flags >> IMG_FILTER_SHIFT) & IMG_FILTER_MASK);
+	if( r.filter > IMG_FILTER_AREA )
+		hl_error("Invalid filter %d",(int)r.filter);
+	if( img_simd < 0 )
+		img_simd_init();
+	hl_blocking(true);
+	if( r.filter != IMG_FILTER_NONE ) {
+		bool ok = true;
+		if( inWidth != outWidth ) ok = img_coefs_init(&r.h,r.filter,inWidth,outWidth);
+		if( ok && inHeight != outHeight ) ok = img_coefs_init(&r.v,r.filter,inHeight,outHeight);
+		r.error = !ok;
+	}
+	if( !r.error )
+		img_scale_run(&r);
+	img_coefs_free(&r.h);
+	img_coefs_free(&r.v);
+	hl_blocking(false);
+	if( r.error )
+		hl_error("Out of memory");
+}
+
+/*
+	jpg_decode uses the IDCT scaling when given a smaller size than the image :
+	jpg_size returns the size of the image divided by scale (1, 2, 4 or 8).
+*/
+HL_PRIM bool HL_NAME(jpg_size)( vbyte *data, int dataLen, int scale, int *width, int *height ) {
+#	ifdef HL_JPEG_STREAM
+	tjscalingfactor sf;
+	tjhandle h;
+	int w, hh, sub, cs;
+	bool ok;
+	if( scale != 1 && scale != 2 && scale != 4 && scale != 8 )
+		hl_error("Invalid scale %d",scale);
+	h = tjInitDecompress();
+	ok = tjDecompressHeader3(h,data,dataLen,&w,&hh,&sub,&cs) == 0;
+	tjDestroy(h);
+	if( !ok )
+		return false;
+	sf.num = 1;
+	sf.denom = scale;
+	*width = TJSCALED(w,sf);
+	*height = TJSCALED(hh,sf);
+	return true;
+#	else
+	return false;
+#	endif
+}
+
+/*
+	Streaming decode : rows are written by strips into a caller buffer, so the full
+	image is never held in memory (except for interlaced PNG). The image size is
+	divided by scale (1, 2, 4 or 8), using the IDCT scaling for JPEG and a box
+	filter for PNG.
+*/
+
+typedef struct _fmt_img_stream fmt_img_stream;
+
+#ifdef HL_JPEG_STREAM
+typedef struct {
+	struct jpeg_error_mgr mgr;
+	jmp_buf jmp;
+} img_jpg_error;
+#endif
+
+struct _fmt_img_stream {
+	void (*finalize)( fmt_img_stream * );
+	unsigned char *data;
+	int dataLen;
+	int dataPos;
+	int width;
+	int height;
+	int row;
+	int bpp;
+	int scale;
+#	ifdef HL_JPEG_STREAM
+	struct jpeg_decompress_struct *jpg;
+	img_jpg_error *jerr;
+#	endif
+	png_structp png;
+	png_infop info;
+	int srcWidth;
+	int srcHeight;
+	unsigned char *line; // one source row, or the whole image when interlaced
+	unsigned int *acc; // box filter sums
+	bool interlaced;
+	bool failed;
+};
+
+static void img_stream_free( fmt_img_stream *s ) {
+#	ifdef HL_JPEG_STREAM
+	if( s->jpg ) {
+		jpeg_destroy_decompress(s->jpg);
+		free(s->jpg);
+		free(s->jerr);
+		s->jpg = NULL;
+		s->jerr = NULL;
+	}
+#	endif
+	if( s->png ) {
+		png_destroy_read_struct(&s->png,s->info ? &s->info : NULL,NULL);
+		s->png = NULL;
+		s->info = NULL;
+	}
+	free(s->data);
+	free(s->line);
+	free(s->acc);
+	s->data = NULL;
+	s->line = NULL;
+	s->acc = NULL;
+	s->finalize = NULL;
+}
+
+static fmt_img_stream *img_stream_alloc( vbyte *data, int dataLen, int scale ) {
+	fmt_img_stream *s;
+	if( scale != 1 && scale != 2 && scale != 4 && scale != 8 )
+		hl_error("Invalid scale %d",scale);
+	if( dataLen < 0 )
+		hl_error("Out of range");
+	s = (fmt_img_stream*)hl_gc_alloc_finalizer(sizeof(fmt_img_stream));
+	memset(s,0,sizeof(fmt_img_stream));
+	s->finalize = img_stream_free;
+	s->scale = scale;
+	// the bytes might be collected while we still read from them
+	s->data = (unsigned char*)malloc(dataLen ? dataLen : 1);
+	if( s->data == NULL )
+		hl_error("Out of memory");
+	memcpy(s->data,data,dataLen);
+	s->dataLen = dataLen;
+	return s;
+}
+
+#ifdef HL_JPEG_STREAM
+static void img_jpg_error_exit( j_common_ptr cinfo ) {
+	longjmp(((img_jpg_error*)cinfo->err)->jmp,1);
+}
+
+static void img_jpg_message( j_common_ptr cinfo ) {
+}
+#endif
+
+HL_PRIM fmt_img_stream *HL_NAME(jpg_stream_open)( vbyte *data, int dataLen, int format, int scale, int *width, int *height ) {
+#	ifdef HL_JPEG_STREAM
+	static const J_COLOR_SPACE spaces[] = {
+		JCS_EXT_RGB, JCS_EXT_BGR, JCS_EXT_RGBX, JCS_EXT_BGRX, JCS_EXT_XBGR, JCS_EXT_XRGB,
+		JCS_GRAYSCALE, JCS_EXT_RGBA, JCS_EXT_BGRA, JCS_EXT_ABGR, JCS_EXT_ARGB, JCS_CMYK,
+	};
+	fmt_img_stream *s;
+	if( format < 0 || format >= (int)(sizeof(spaces) / sizeof(J_COLOR_SPACE)) )
+		hl_error("Unsupported format");
+	s = img_stream_alloc(data,dataLen,scale);
+	s->jpg = (struct jpeg_decompress_struct*)calloc(1,sizeof(struct jpeg_decompress_struct));
+	s->jerr = (img_jpg_error*)calloc(1,sizeof(img_jpg_error));
+	s->jpg->err = jpeg_std_error(&s->jerr->mgr);
+	s->jerr->mgr.error_exit = img_jpg_error_exit;
+	s->jerr->mgr.output_message = img_jpg_message;
+	hl_blocking(true);
+	if( setjmp(s->jerr->jmp) ) {
+		hl_blocking(false);
+		img_stream_free(s);
+		return NULL;
+	}
+	jpeg_create_decompress(s->jpg);
+	jpeg_mem_src(s->jpg,s->data,s->dataLen);
+	jpeg_read_header(s->jpg,TRUE);
+	s->jpg->out_color_space = spaces[format];
+	s->jpg->scale_num = 1;
+	s->jpg->scale_denom = scale;
+	jpeg_start_decompress(s->jpg);
+	hl_blocking(false);
+	s->width = s->jpg->output_width;
+	s->height = s->jpg->output_height;
+	s->bpp = s->jpg->output_components;
+	*width = s->width;
+	*height = s->height;
+	return s;
+#	else
+	hl_error("JPEG streaming is not supported on this platform");
+	return NULL;
+#	endif
+}
+
+static void img_png_read( png_structp png, png_bytep out, png_size_t size ) {
+	fmt_img_stream *s = (fmt_img_stream*)png_get_io_ptr(png);
+	if( size > (png_size_t)(s->dataLen - s->dataPos) )
+		png_error(png,"Unexpected end of data");
+	memcpy(out,s->data + s->dataPos,size);
+	s->dataPos += (int)size;
+}
+
+static void img_png_error( png_structp png, png_const_charp msg ) {
+	png_longjmp(png,1);
+}
+
+static void img_png_warning( png_structp png, png_const_charp msg ) {
+}
+
+HL_PRIM fmt_img_stream *HL_NAME(png_stream_open)( vbyte *data, int dataLen, int format, int scale, int *width, int *height ) {
+	fmt_img_stream *s;
+	bool bgr = false, alpha = false, alphaFirst = false;
+	int color, rowBytes;
+	switch( format ) {
+	case 0:
+		break;
+	case 1:
+		bgr = true;
+		break;
+	case 7:
+		alpha = true;
+		break;
+	case 8:
+		alpha = bgr = true;
+		break;
+	case 9:
+		alpha = bgr = alphaFirst = true;
+		break;
+	case 10:
+		alpha = alphaFirst = true;
+		break;
+	default:
+		hl_error("Unsupported format");
+		break;
+	}
+	s = img_stream_alloc(data,dataLen,scale);
+	s->bpp = alpha ? 4 : 3;
+	s->png = png_create_read_struct(PNG_LIBPNG_VER_STRING,NULL,img_png_error,img_png_warning);
+	if( s->png )
+		s->info = png_create_info_struct(s->png);
+	if( !s->png || !s->info ) {
+		img_stream_free(s);
+		hl_error("Out of memory");
+	}
+	hl_blocking(true);
+	if( setjmp(png_jmpbuf(s->png)) ) {
+		hl_blocking(false);
+		img_stream_free(s);
+		return NULL;
+	}
+	png_set_read_fn(s->png,s,img_png_read);
+	png_read_info(s->png,s->info);
+	color = png_get_color_type(s->png,s->info);
+	png_set_expand(s->png);
+	png_set_strip_16(s->png);
+	if( (color & PNG_COLOR_MASK_COLOR) == 0 )
+		png_set_gray_to_rgb(s->png);
+	if( !alpha )
+		png_set_strip_alpha(s->png);
+	else if( (color & PNG_COLOR_MASK_ALPHA) || png_get_valid(s->png,s->info,PNG_INFO_tRNS) ) {
+		if( alphaFirst ) png_set_swap_alpha(s->png);
+	} else
+		png_set_add_alpha(s->png,0xFF,alphaFirst ? PNG_FILLER_BEFORE : PNG_FILLER_AFTER);
+	if( bgr )
+		png_set_bgr(s->png);
+	s->interlaced = png_get_interlace_type(s->png,s->info) != PNG_INTERLACE_NONE;
+	if( s->interlaced )
+		png_set_interlace_handling(s->png);
+	png_read_update_info(s->png,s->info);
+	hl_blocking(false);
+	s->srcWidth = png_get_image_width(s->png,s->info);
+	s->srcHeight = png_get_image_height(s->png,s->info);
+	rowBytes = (int)png_get_rowbytes(s->png,s->info);
+	if( rowBytes != s->srcWidth * s->bpp ) {
+		img_stream_free(s);
+		return NULL;
+	}
+	s->width = (s->srcWidth + scale - 1) / scale;
+	s->height = (s->srcHeight + scale - 1) / scale;
+	if( s->interlaced )
+		s->line = (unsigned char*)malloc((size_t)rowBytes * s->srcHeight);
+	else if( scale > 1 )
+		s->line = (unsigned char*)malloc(rowBytes);
+	if( scale > 1 )
+		s->acc = (unsigned int*)malloc(sizeof(unsigned int) * s->width * s->bpp);
+	if( (s->interlaced || scale > 1) && (!s->line || (scale > 1 && !s->acc)) ) {
+		img_stream_free(s);
+		hl_error("Out of memory");
+	}
+	*width = s->width;
+	*height = s->height;
+	return s;
+}
+
+static void img_png_rows( fmt_img_stream *s, vbyte *out, int stride, int rows ) {
+	int rowBytes = s->srcWidth * s->bpp;
+	int n;
+	if( s->interlaced && s->row == 0 ) {
+		// all passes are needed before any row is complete
+		png_bytep *lines = (png_bytep*)malloc(sizeof(png_bytep) * s->srcHeight);
+		int y;
+		if( lines == NULL )
+			png_error(s->png,"Out of memory");
+		for(y=0;y<s->srcHeight;y++)
+			lines[y] = s->line + (size_t)y * rowBytes;
+		png_read_image(s->png,lines);
+		free(lines);
+	}
+	for(n=0;n<rows;n++) {
+		unsigned char *o = out + (size_t)n * stride;
+		int scale = s->scale;
+		int bpp = s->bpp;
+		int y, ys, ye, x, k;
+		if( scale == 1 ) {
+			if( s->interlaced )
+				memcpy(o,s->line + (size_t)s->row * rowBytes,rowBytes);
+			else
+				png_read_row(s->png,o,NULL);
+			s->row++;
+			continue;
+		}
+		ys = s->row * scale;
+		ye = ys + scale > s->srcHeight ? s->srcHeight : ys + scale;
+		memset(s->acc,0,sizeof(unsigned int) * s->width * bpp);
+		for(y=ys;y<ye;y++) {
+			unsigned char *p;
+			unsigned int *a = s->acc;
+			if( s->interlaced )
+				p = s->line + (size_t)y * rowBytes;
+			else {
+				png_read_row(s->png,s->line,NULL);
+				p = s->line;
+			}
+			for(x=0;x<s->srcWidth;x++) {
+				for(k=0;k<bpp;k++)
+					a[k] += *p++;
+				if( (x % scale) == scale - 1 )
+					a += bpp;
+			}
+		}
+		for(x=0;x<s->width;x++) {
+			int cols = s->srcWidth - x * scale;
+			unsigned int div;
+			if( cols > scale ) cols = scale;
+			div = cols * (ye - ys);
+			for(k=0;k<bpp;k++)
+				o[x * bpp + k] = (unsigned char)((s->acc[x * bpp + k] + (div >> 1)) / div);
+		}
+		s->row++;
+	}
+}
+
+/*
+	Decode the next rows (at most the given count) into out, one row every stride
+	bytes. Returns the number of rows written, 0 at the end of the image.
+*/
+HL_PRIM int HL_NAME(img_stream_read)( fmt_img_stream *s, vbyte *out, int outPos, int stride, int rows ) {
+	int n = 0;
+	if( !s->data )
+		hl_error("Stream is closed");
+	if( s->failed )
+		hl_error("Invalid image data");
+	if( rows > s->height - s->row )
+		rows = s->height - s->row;
+	if( rows <= 0 )
+		return 0;
+	if( outPos < 0 || stride < s->width * s->bpp )
+		hl_error("Out of range");
+	out += outPos;
+	hl_blocking(true);
+#	ifdef HL_JPEG_STREAM
+	if( s->jpg ) {
+		if( setjmp(s->jerr->jmp) ) {
+			hl_blocking(false);
+			s->failed = true;
+			hl_error("Invalid image data");
+		}
+		while( n < rows ) {
+			JSAMPROW lines[8];
+			int k, count = rows - n;
+			if( count > 8 ) count = 8;
+			for(k=0;k<count;k++)
+				lines[k] = out + (size_t)(n + k) * stride;
+			n += jpeg_read_scanlines(s->jpg,lines,count);
+		}
+		s->row += n;
+		hl_blocking(false);
+		return n;
+	}
+#	endif
+	if( setjmp(png_jmpbuf(s->png)) ) {
+		hl_blocking(false);
+		s->failed = true;
+		hl_error("Invalid image data");
+	}
+	img_png_rows(s,out,stride,rows);
 	hl_blocking(false);
+	return rows;
+}
+
+HL_PRIM void HL_NAME(img_stream_close)( fmt_img_stream *s ) {
+	img_stream_free(s);
 }
 
 
@@ -153,6 +1005,14 @@ DEFINE_PRIM(_BOOL, jpg_decode, _BYTES _I32 _BYTES _I32 _I32 _I32 _I32 _I32);
 DEFINE_PRIM(_BOOL, png_decode, _BYTES _I32 _BYTES _I32 _I32 _I32 _I32 _I32);
 DEFINE_PRIM(_VOID, img_scale, _BYTES _I32 _I32 _I32 _I32 _BYTES _I32 _I32 _I32 _I32 _I32);
 
+#define _IMG_STREAM _ABSTRACT(fmt_img_stream)
+
+DEFINE_PRIM(_BOOL, jpg_size, _BYTES _I32 _I32 _REF(_I32) _REF(_I32));
+DEFINE_PRIM(_IMG_STREAM, jpg_stream_open, _BYTES _I32 _I32 _I32 _REF(_I32) _REF(_I32));
+DEFINE_PRIM(_IMG_STREAM, png_stream_open, _BYTES _I32 _I32 _I32 _REF(_I32) _REF(_I32));
+DEFINE_PRIM(_I32, img_stream_read, _IMG_STREAM _BYTES _I32 _I32 _I32);
+DEFINE_PRIM(_VOID, img_stream_close, _IMG_STREAM);
+
 
 /* ------------------------------------------------- ZLIB --------------------------------------------------- */
 
@@ -319,6 +1179,669 @@ DEFINE_PRIM(_VOID, zip_flush_mode, _ZIP _I32);
 DEFINE_PRIM(_BOOL, inflate_buffer, _ZIP _BYTES _I32 _I32 _BYTES _I32 _I32 _REF(_I32) _REF(_I32));
 DEFINE_PRIM(_BOOL, deflate_buffer, _ZIP _BYTES _I32 _I32 _BYTES _I32 _I32 _REF(_I32) _REF(_I32));
 
+/* -------------------------------------------- PARALLEL DEFLATE -------------------------------------------- */
+
+/*
+	pigz-style gzip compression : the input is cut into blocks which are deflated
+	on worker threads. Each block is primed with the last 32KB of the previous one
+	so the ratio stays close to a single stream, and ends with a sync flush so the
+	raw outputs can be concatenated. Block CRCs are merged with crc32_combine.
+*/
+
+#define PZ_DICT			32768
+#define PZ_BLOCK_SIZE	(128 << 10)
+#define PZ_MAX_BLOCK	(64 << 20)
+#define PZ_MAX_THREADS	256
+
+typedef struct _fmt_pzip fmt_pzip;
+
+typedef enum {
+	PZ_FREE,
+	PZ_QUEUED,
+	PZ_BUSY,
+	PZ_DONE,
+} pz_state;
+
+typedef struct {
+	unsigned char *in; // dictionary followed by block data
+	unsigned char *out;
+	int dict_len;
+	int in_len;
+	int out_len;
+	int out_pos;
+	uLong crc;
+	bool last;
+	pz_state state;
+} pz_block;
+
+struct _fmt_pzip {
+	void (*finalize)( fmt_pzip * );
+	pz_block *blocks;
+	hl_condition *cond;
+	z_stream *z; // used when no worker thread could be started
+	int nblocks;
+	int block_size;
+	int out_size;
+	int level;
+	int fill;
+	int next;
+	int count;
+	int workers;
+	int error;
+	bool started;
+	bool finish;
+	bool queued_last;
+	bool ended;
+	bool stop;
+	uLong crc;
+	uLong total;
+	unsigned char extra[10]; // gzip header or trailer
+	int xpos;
+	int xlen;
+};
+
+static int pz_compress( fmt_pzip *p, z_stream *z, pz_block *b ) {
+	int err;
+	deflateReset(z);
+	if( b->dict_len )
+		deflateSetDictionary(z,b->in,b->dict_len);
+	z->next_in = b->in + b->dict_len;
+	z->avail_in = b->in_len;
+	z->next_out = b->out;
+	z->avail_out = p->out_size;
+	err = deflate(z,b->last ? Z_FINISH : Z_SYNC_FLUSH);
+	b->out_len = p->out_size - z->avail_out;
+	b->crc = crc32(0L,b->in + b->dict_len,b->in_len);
+	if( err == Z_STREAM_END || (err == Z_OK && !b->last && z->avail_in == 0) )
+		return Z_OK;
+	return err < 0 ? err : Z_BUF_ERROR;
+}
+
+static void pz_worker( fmt_pzip *p ) {
+	z_stream z;
+	int err;
+	memset(&z,0,sizeof(z_stream));
+	err = deflateInit2(&z,p->level,Z_DEFLATED,-MAX_WBITS,8,Z_DEFAULT_STRATEGY);
+	hl_condition_acquire(p->cond);
+	if( err != Z_OK )
+		p->error = err;
+	while( !p->stop && err == Z_OK ) {
+		pz_block *b = NULL;
+		int i;
+		for(i=0;i<p->nblocks;i++) {
+			pz_block *c = p->blocks + (p->next + i) % p->nblocks;
+			if( c->state == PZ_QUEUED ) {
+				b = c;
+				break;
+			}
+		}
+		if( b == NULL ) {
+			hl_condition_wait(p->cond);
+			continue;
+		}
+		b->state = PZ_BUSY;
+		hl_condition_release(p->cond);
+		err = pz_compress(p,&z,b);
+		hl_condition_acquire(p->cond);
+		if( err != Z_OK )
+			p->error = err;
+		b->state = PZ_DONE;
+		hl_condition_broadcast(p->cond);
+	}
+	deflateEnd(&z);
+	p->workers--;
+	hl_condition_broadcast(p->cond);
+	hl_condition_release(p->cond);
+}
+
+static void pz_free( fmt_pzip *p ) {
+	int i;
+	if( !p->blocks )
+		return;
+	hl_condition_acquire(p->cond);
+	p->stop = true;
+	hl_condition_broadcast(p->cond);
+	while( p->workers > 0 )
+		hl_condition_wait(p->cond);
+	hl_condition_release(p->cond);
+	hl_condition_free(p->cond);
+	for(i=0;i<p->nblocks;i++) {
+		free(p->blocks[i].in);
+		free(p->blocks[i].out);
+	}
+	free(p->blocks);
+	if( p->z ) {
+		deflateEnd(p->z);
+		free(p->z);
+	}
+	p->blocks = NULL;
+	p->finalize = NULL;
+}
+
+HL_PRIM fmt_pzip *HL_NAME(pdeflate_init)( int level, int threads, int blockSize ) {
+	fmt_pzip *p;
+	int i;
+	if( level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION )
+		hl_error("Invalid level %d",level);
+	if( threads <= 0 )
+		threads = hl_thread_cpu_count();
+	if( threads > PZ_MAX_THREADS )
+		threads = PZ_MAX_THREADS;
+	if( blockSize <= 0 )
+		blockSize = PZ_BLOCK_SIZE;
+	if( blockSize < PZ_DICT )
+		blockSize = PZ_DICT;
+	if( blockSize > PZ_MAX_BLOCK )
+		blockSize = PZ_MAX_BLOCK;
+	p = (fmt_pzip*)hl_gc_alloc_finalizer(sizeof(fmt_pzip));
+	memset(p,0,sizeof(fmt_pzip));
+	p->finalize = pz_free;
+	p->level = level;
+	p->block_size = blockSize;
+	// room for a stored copy of the block plus the sync flush marker
+	p->out_size = compressBound(blockSize) + 16;
+	// each worker can have one block compressing and one waiting to be written
+	p->nblocks = threads * 2 + 1;
+	p->cond = hl_condition_alloc();
+	p->blocks = (pz_block*)malloc(sizeof(pz_block) * p->nblocks);
+	if( p->blocks == NULL ) {
+		hl_condition_free(p->cond);
+		p->finalize = NULL;
+		hl_error("Out of memory");
+	}
+	memset(p->blocks,0,sizeof(pz_block) * p->nblocks);
+	for(i=0;i<p->nblocks;i++) {
+		p->blocks[i].in = (unsigned char*)malloc(PZ_DICT + blockSize);
+		p->blocks[i].out = (unsigned char*)malloc(p->out_size);
+		if( p->blocks[i].in == NULL || p->blocks[i].out == NULL ) {
+			pz_free(p);
+			hl_error("Out of memory");
+		}
+	}
+	// gzip header : no name, no mtime, unknown OS
+	memcpy(p->extra,"\x1F\x8B\x08\x00\x00\x00\x00\x00\x00\xFF",10);
+	p->xlen = 10;
+	hl_condition_acquire(p->cond);
+	for(i=0;i<threads;i++) {
+		if( hl_thread_start(pz_worker,p,false) == NULL )
+			break;
+		p->workers++;
+	}
+	hl_condition_release(p->cond);
+	if( p->workers == 0 ) {
+		int err;
+		p->z = (z_stream*)malloc(sizeof(z_stream));
+		if( p->z == NULL ) {
+			pz_free(p);
+			hl_error("Out of memory");
+		}
+		memset(p->z,0,sizeof(z_stream));
+		if( (err = deflateInit2(p->z,level,Z_DEFLATED,-MAX_WBITS,8,Z_DEFAULT_STRATEGY)) != Z_OK ) {
+			free(p->z);
+			p->z = NULL;
+			pz_free(p);
+			zlib_error(NULL,err);
+		}
+	}
+	return p;
+}
+
+static void pz_start_block( fmt_pzip *p ) {
+	pz_block *b = p->blocks + p->fill;
+	b->dict_len = 0;
+	b->in_len = 0;
+	if( p->count > 0 ) {
+		// the previous block is not reused before this one is queued
+		pz_block *prev = p->blocks + (p->fill + p->nblocks - 1) % p->nblocks;
+		int d = prev->in_len < PZ_DICT ? prev->in_len : PZ_DICT;
+		memcpy(b->in,prev->in + prev->dict_len + prev->in_len - d,d);
+		b->dict_len = d;
+	}
+	p->started = true;
+}
+
+static void pz_queue_block( fmt_pzip *p, bool last ) {
+	pz_block *b = p->blocks + p->fill;
+	b->last = last;
+	b->out_pos = 0;
+	b->state = PZ_QUEUED;
+	p->count++;
+	p->fill = (p->fill + 1) % p->nblocks;
+	p->started = false;
+	if( last )
+		p->queued_last = true;
+	hl_condition_broadcast(p->cond);
+}
+
+static void pz_write_le( unsigned char *out, uLong v ) {
+	out[0] = (unsigned char)v;
+	out[1] = (unsigned char)(v >> 8);
+	out[2] = (unsigned char)(v >> 16);
+	out[3] = (unsigned char)(v >> 24);
+}
+
+HL_PRIM void HL_NAME(pdeflate_finish)( fmt_pzip *p ) {
+	p->finish = true;
+}
+
+HL_PRIM bool HL_NAME(pdeflate_buffer)( fmt_pzip *p, vbyte *src, int srcpos, int srclen, vbyte *dst, int dstpos, int dstlen, int *read, int *write ) {
+	int slen, dlen, rpos = 0, wpos = 0, err = Z_OK;
+	bool done = false;
+	slen = srclen - srcpos;
+	dlen = dstlen - dstpos;
+	if( srcpos < 0 || dstpos < 0 || slen < 0 || dlen < 0 )
+		hl_error("Out of range");
+	if( !p->blocks )
+		hl_error("Stream is closed");
+	hl_blocking(true);
+	hl_condition_acquire(p->cond);
+	while( true ) {
+		pz_block *b;
+		bool progress = false;
+		if( p->error ) {
+			err = p->error;
+			break;
+		}
+		// pending gzip header or trailer
+		if( p->xpos < p->xlen && wpos < dlen ) {
+			int n = p->xlen - p->xpos;
+			if( n > dlen - wpos ) n = dlen - wpos;
+			memcpy(dst + dstpos + wpos,p->extra + p->xpos,n);
+			p->xpos += n;
+			wpos += n;
+			progress = true;
+		}
+		// blocks are written in order
+		b = p->blocks + p->next;
+		if( p->xpos == p->xlen && b->state == PZ_DONE && wpos < dlen ) {
+			int n = b->out_len - b->out_pos;
+			if( n > dlen - wpos ) n = dlen - wpos;
+			memcpy(dst + dstpos + wpos,b->out + b->out_pos,n);
+			b->out_pos += n;
+			wpos += n;
+			if( b->out_pos == b->out_len ) {
+				p->crc = crc32_combine(p->crc,b->crc,b->in_len);
+				p->total += b->in_len;
+				b->state = PZ_FREE;
+				p->next = (p->next + 1) % p->nblocks;
+				if( b->last ) {
+					pz_write_le(p->extra,p->crc);
+					pz_write_le(p->extra + 4,p->total);
+					p->xpos = 0;
+					p->xlen = 8;
+					p->ended = true;
+				}
+			}
+			progress = true;
+		}
+		// copy input into the block being filled
+		b = p->blocks + p->fill;
+		if( !p->queued_last && b->state == PZ_FREE && (rpos < slen || p->finish) ) {
+			int n = slen - rpos;
+			if( !p->started )
+				pz_start_block(p);
+			if( n > p->block_size - b->in_len ) n = p->block_size - b->in_len;
+			memcpy(b->in + b->dict_len + b->in_len,src + srcpos + rpos,n);
+			b->in_len += n;
+			rpos += n;
+			if( b->in_len == p->block_size )
+				pz_queue_block(p,false);
+			else if( p->finish && rpos == slen )
+				pz_queue_block(p,true);
+			progress = true;
+		}
+		if( progress )
+			continue;
+		if( p->ended && p->xpos == p->xlen ) {
+			done = true;
+			break;
+		}
+		// nothing more to do until more input or output room is given
+		if( wpos == dlen || (rpos == slen && !p->finish) )
+			break;
+		// wait for the next block to be compressed
+		b = p->blocks + p->next;
+		if( p->workers == 0 && b->state == PZ_QUEUED ) {
+			b->state = PZ_DONE;
+			p->error = pz_compress(p,p->z,b);
+		} else
+			hl_condition_wait(p->cond);
+	}
+	hl_condition_release(p->cond);
+	hl_blocking(false);
+	if( err != Z_OK )
+		zlib_error(NULL,err);
+	*read = rpos;
+	*write = wpos;
+	return done;
+}
+
+HL_PRIM void HL_NAME(pdeflate_end)( fmt_pzip *p ) {
+	hl_blocking(true);
+	pz_free(p);
+	hl_blocking(false);
+}
+
+#define _PZIP _ABSTRACT(fmt_pzip)
+
+DEFINE_PRIM(_PZIP, pdeflate_init, _I32 _I32 _I32);
+DEFINE_PRIM(_VOID, pdeflate_finish, _PZIP);
+DEFINE_PRIM(_BOOL, pdeflate_buffer, _PZIP _BYTES _I32 _I32 _BYTES _I32 _I32 _REF(_I32) _REF(_I32));
+DEFINE_PRIM(_VOID, pdeflate_end, _PZIP);
+
+/* ----------------------------------------------- ZSTD / LZ4 ------------------------------------------------- */
+
+/*
+	Streaming contexts sharing the deflate_buffer API. Both libraries are optional :
+	when the hdll is built without them the init functions throw.
+*/
+
+#ifdef HL_FMT_ZSTD
+#	include <zstd.h>
+#endif
+#ifdef HL_FMT_LZ4
+#	include <lz4frame.h>
+#endif
+
+typedef struct _fmt_zstd fmt_zstd;
+struct _fmt_zstd {
+	void (*finalize)( fmt_zstd * );
+#	ifdef HL_FMT_ZSTD
+	ZSTD_CCtx *c;
+	ZSTD_DCtx *d;
+	ZSTD_EndDirective flush;
+#	endif
+};
+
+#ifdef HL_FMT_ZSTD
+static void zstd_free( fmt_zstd *z ) {
+	if( z->c ) ZSTD_freeCCtx(z->c);
+	if( z->d ) ZSTD_freeDCtx(z->d);
+	z->c = NULL;
+	z->d = NULL;
+	z->finalize = NULL;
+}
+
+static void zstd_check( size_t r ) {
+	if( ZSTD_isError(r) )
+		hl_error("ZStd Error : %s",hl_to_utf16(ZSTD_getErrorName(r)));
+}
+#endif
+
+HL_PRIM fmt_zstd *HL_NAME(zstd_compress_init)( int level, int workers ) {
+#	ifdef HL_FMT_ZSTD
+	fmt_zstd *z;
+	ZSTD_CCtx *c = ZSTD_createCCtx();
+	if( c == NULL )
+		hl_error("Failed to create ZStd context");
+	z = (fmt_zstd*)hl_gc_alloc_finalizer(sizeof(fmt_zstd));
+	z->finalize = zstd_free;
+	z->c = c;
+	z->d = NULL;
+	z->flush = ZSTD_e_continue;
+	zstd_check(ZSTD_CCtx_setParameter(c,ZSTD_c_compressionLevel,level));
+	// fails when libzstd is built without multithread support : stay single threaded
+	if( workers > 0 )
+		ZSTD_CCtx_setParameter(c,ZSTD_c_nbWorkers,workers);
+	return z;
+#	else
+	hl_error("ZStd is not supported");
+	return NULL;
+#	endif
+}
+
+HL_PRIM fmt_zstd *HL_NAME(zstd_decompress_init)() {
+#	ifdef HL_FMT_ZSTD
+	fmt_zstd *z;
+	ZSTD_DCtx *d = ZSTD_createDCtx();
+	if( d == NULL )
+		hl_error("Failed to create ZStd context");
+	z = (fmt_zstd*)hl_gc_alloc_finalizer(sizeof(fmt_zstd));
+	z->finalize = zstd_free;
+	z->c = NULL;
+	z->d = d;
+	z->flush = ZSTD_e_continue;
+	return z;
+#	else
+	hl_error("ZStd is not supported");
+	return NULL;
+#	endif
+}
+
+HL_PRIM void HL_NAME(zstd_end)( fmt_zstd *z ) {
+#	ifdef HL_FMT_ZSTD
+	zstd_free(z);
+#	endif
+}
+
+HL_PRIM void HL_NAME(zstd_flush_mode)( fmt_zstd *z, int flush ) {
+#	ifdef HL_FMT_ZSTD
+	switch( flush ) {
+	case 0:
+		z->flush = ZSTD_e_continue;
+		break;
+	case 1:
+	case 2:
+		z->flush = ZSTD_e_flush;
+		break;
+	case 3:
+		z->flush = ZSTD_e_end;
+		break;
+	default:
+		hl_error("Invalid flush mode %d",flush);
+		break;
+	}
+#	endif
+}
+
+HL_PRIM bool HL_NAME(zstd_buffer)( fmt_zstd *z, vbyte *src, int srcpos, int srclen, vbyte *dst, int dstpos, int dstlen, int *read, int *write ) {
+#	ifdef HL_FMT_ZSTD
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	size_t r;
+	int slen = srclen - srcpos;
+	int dlen = dstlen - dstpos;
+	if( srcpos < 0 || dstpos < 0 || slen < 0 || dlen < 0 )
+		hl_error("Out of range");
+	if( !z->c && !z->d )
+		hl_error("Stream is closed");
+	in.src = src + srcpos;
+	in.size = slen;
+	in.pos = 0;
+	out.dst = dst + dstpos;
+	out.size = dlen;
+	out.pos = 0;
+	hl_blocking(true);
+	if( z->c )
+		r = ZSTD_compressStream2(z->c,&out,&in,z->flush);
+	else
+		r = ZSTD_decompressStream(z->d,&out,&in);
+	hl_blocking(false);
+	zstd_check(r);
+	*read = (int)in.pos;
+	*write = (int)out.pos;
+	// compression : frame fully flushed, decompression : frame fully decoded
+	return r == 0 && (z->d || z->flush == ZSTD_e_end);
+#	else
+	return false;
+#	endif
+}
+
+#define LZ4_CHUNK	(64 << 10)
+
+typedef struct _fmt_lz4 fmt_lz4;
+struct _fmt_lz4 {
+	void (*finalize)( fmt_lz4 * );
+#	ifdef HL_FMT_LZ4
+	LZ4F_cctx *c;
+	LZ4F_dctx *d;
+	LZ4F_preferences_t prefs;
+	unsigned char *buf; // compressed bytes not written yet
+	int bufsize;
+	int bpos;
+	int blen;
+	int flush;
+	bool started;
+	bool ended;
+#	endif
+};
+
+#ifdef HL_FMT_LZ4
+static void lz4_free( fmt_lz4 *z ) {
+	if( z->c ) LZ4F_freeCompressionContext(z->c);
+	if( z->d ) LZ4F_freeDecompressionContext(z->d);
+	free(z->buf);
+	z->c = NULL;
+	z->d = NULL;
+	z->buf = NULL;
+	z->finalize = NULL;
+}
+
+static size_t lz4_check( size_t r ) {
+	if( LZ4F_isError(r) )
+		hl_error("LZ4 Error : %s",hl_to_utf16(LZ4F_getErrorName(r)));
+	return r;
+}
+#endif
+
+HL_PRIM fmt_lz4 *HL_NAME(lz4_compress_init)( int level ) {
+#	ifdef HL_FMT_LZ4
+	fmt_lz4 *z;
+	LZ4F_cctx *c;
+	lz4_check(LZ4F_createCompressionContext(&c,LZ4F_VERSION));
+	z = (fmt_lz4*)hl_gc_alloc_finalizer(sizeof(fmt_lz4));
+	memset(z,0,sizeof(fmt_lz4));
+	z->finalize = lz4_free;
+	z->c = c;
+	z->prefs.compressionLevel = level;
+	z->prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+	z->bufsize = (int)LZ4F_compressBound(LZ4_CHUNK,&z->prefs);
+	z->buf = (unsigned char*)malloc(z->bufsize);
+	return z;
+#	else
+	hl_error("LZ4 is not supported");
+	return NULL;
+#	endif
+}
+
+HL_PRIM fmt_lz4 *HL_NAME(lz4_decompress_init)() {
+#	ifdef HL_FMT_LZ4
+	fmt_lz4 *z;
+	LZ4F_dctx *d;
+	lz4_check(LZ4F_createDecompressionContext(&d,LZ4F_VERSION));
+	z = (fmt_lz4*)hl_gc_alloc_finalizer(sizeof(fmt_lz4));
+	memset(z,0,sizeof(fmt_lz4));
+	z->finalize = lz4_free;
+	z->d = d;
+	return z;
+#	else
+	hl_error("LZ4 is not supported");
+	return NULL;
+#	endif
+}
+
+HL_PRIM void HL_NAME(lz4_end)( fmt_lz4 *z ) {
+#	ifdef HL_FMT_LZ4
+	lz4_free(z);
+#	endif
+}
+
+HL_PRIM void HL_NAME(lz4_flush_mode)( fmt_lz4 *z, int flush ) {
+#	ifdef HL_FMT_LZ4
+	if( flush < 0 || flush > 3 )
+		hl_error("Invalid flush mode %d",flush);
+	z->flush = flush;
+#	endif
+}
+
+HL_PRIM bool HL_NAME(lz4_buffer)( fmt_lz4 *z, vbyte *src, int srcpos, int srclen, vbyte *dst, int dstpos, int dstlen, int *read, int *write ) {
+#	ifdef HL_FMT_LZ4
+	int slen = srclen - srcpos;
+	int dlen = dstlen - dstpos;
+	int rpos = 0, wpos = 0;
+	size_t r = 0;
+	bool flushed = false, done = false;
+	if( srcpos < 0 || dstpos < 0 || slen < 0 || dlen < 0 )
+		hl_error("Out of range");
+	if( !z->c && !z->d )
+		hl_error("Stream is closed");
+	if( z->d ) {
+		size_t ssize = slen, dsize = dlen;
+		hl_blocking(true);
+		r = LZ4F_decompress(z->d,dst + dstpos,&dsize,src + srcpos,&ssize,NULL);
+		hl_blocking(false);
+		lz4_check(r);
+		*read = (int)ssize;
+		*write = (int)dsize;
+		// the decompression context is ready for the next frame
+		return r == 0;
+	}
+	// LZ4F wants room for a whole compressed chunk : go through our buffer
+	hl_blocking(true);
+	while( true ) {
+		if( z->bpos < z->blen ) {
+			int n = z->blen - z->bpos;
+			if( n > dlen - wpos ) n = dlen - wpos;
+			memcpy(dst + dstpos + wpos,z->buf + z->bpos,n);
+			z->bpos += n;
+			wpos += n;
+			if( z->bpos < z->blen )
+				break;
+			continue;
+		}
+		if( z->ended ) {
+			// a new frame starts with the next input
+			z->ended = false;
+			z->started = false;
+			done = true;
+			break;
+		}
+		z->bpos = 0;
+		z->blen = 0;
+		if( !z->started ) {
+			r = LZ4F_compressBegin(z->c,z->buf,z->bufsize,&z->prefs);
+			z->started = true;
+		} else if( rpos < slen ) {
+			int n = slen - rpos;
+			if( n > LZ4_CHUNK ) n = LZ4_CHUNK;
+			r = LZ4F_compressUpdate(z->c,z->buf,z->bufsize,src + srcpos + rpos,n,NULL);
+			rpos += n;
+		} else if( z->flush == 3 ) {
+			r = LZ4F_compressEnd(z->c,z->buf,z->bufsize,NULL);
+			z->ended = true;
+		} else if( z->flush != 0 && !flushed ) {
+			r = LZ4F_flush(z->c,z->buf,z->bufsize,NULL);
+			flushed = true;
+		} else
+			break;
+		if( LZ4F_isError(r) )
+			break;
+		z->blen = (int)r;
+	}
+	hl_blocking(false);
+	lz4_check(r);
+	*read = rpos;
+	*write = wpos;
+	return done;
+#	else
+	return false;
+#	endif
+}
+
+#define _ZSTD _ABSTRACT(fmt_zstd)
+#define _LZ4 _ABSTRACT(fmt_lz4)
+
+DEFINE_PRIM(_ZSTD, zstd_compress_init, _I32 _I32);
+DEFINE_PRIM(_ZSTD, zstd_decompress_init, _NO_ARG);
+DEFINE_PRIM(_VOID, zstd_end, _ZSTD);
+DEFINE_PRIM(_VOID, zstd_flush_mode, _ZSTD _I32);
+DEFINE_PRIM(_BOOL, zstd_buffer, _ZSTD _BYTES _I32 _I32 _BYTES _I32 _I32 _REF(_I32) _REF(_I32));
+DEFINE_PRIM(_LZ4, lz4_compress_init, _I32);
+DEFINE_PRIM(_LZ4, lz4_decompress_init, _NO_ARG);
+DEFINE_PRIM(_VOID, lz4_end, _LZ4);
+DEFINE_PRIM(_VOID, lz4_flush_mode, _LZ4 _I32);
+DEFINE_PRIM(_BOOL, lz4_buffer, _LZ4 _BYTES _I32 _I32 _BYTES _I32 _I32 _REF(_I32) _REF(_I32));
+
 /* ----------------------------------------------- SOUND : OGG ------------------------------------------------ */
 
 typedef struct _fmt_ogg fmt_ogg;
@@ -747,42 +2270,312 @@ static void md5_finish( md5_context *ctx, uint8 digest[16] ) {
 }
 
 #include "sha1.h"
+#include "sha2.h"
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+/*
+	crc32c (Castagnoli polynomial), as used by iSCSI, ext4 or leveldb.
+	With SSE4.2 the crc32 instruction runs three independent streams over
+	consecutive blocks which are then combined : shifting a crc by n bytes is
+	a multiplication by x^8n modulo the polynomial.
+*/
+
+#define CRC32C_POLY		0x82F63B78
+#define CRC32C_BLOCK	4096
+
+static uint32 crc32c_table[8][256];
+static uint32 crc32c_shift1, crc32c_shift2;
+static int crc32c_hw = 0;
+// 0 : not built, 1 : being built by another thread, 2 : ready
+static int crc32c_state = 0;
+
+HL_API int hl_atomic_load32( int *a );
+HL_API int hl_atomic_store32( int *a, int value );
+HL_API int hl_atomic_compare_exchange32( int *a, int expected, int replacement );
+
+#if defined(__x86_64__) || defined(_M_X64)
+#	include <nmmintrin.h>
+#	define HL_CRC32C_HW
+#	ifdef HL_VCC
+#		include <intrin.h>
+#		define CRC32C_FUN
+#	else
+#		define CRC32C_FUN __attribute__((target("sse4.2")))
+#	endif
+#endif
 
-HL_PRIM void HL_NAME(digest)( vbyte *out, vbyte *in, int length, int format ) {
-	if( format & 256 ) {
-		in = (vbyte*)hl_to_utf8((uchar*)in);
-		length = (int)strlen((char*)in);
+static uint32 crc32c_multmodp( uint32 a, uint32 b ) {
+	uint32 m = 1u << 31, p = 0;
+	while( true ) {
+		if( a & m ) {
+			p ^= b;
+			if( (a & (m - 1)) == 0 )
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
 	}
-	hl_blocking(true);
-	switch( format & 0xFF ) {
-	case 0:
-		{
-			md5_context ctx;
-			md5_starts(&ctx);
-			md5_update(&ctx,in,(uint32)length);
-			md5_finish(&ctx,out);
+	return p;
+}
+
+static void crc32c_init() {
+	int i, k;
+	uint32 p;
+	for(i=0;i<256;i++) {
+		uint32 c = i;
+		for(k=0;k<8;k++)
+			c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		crc32c_table[0][i] = c;
+	}
+	for(i=0;i<256;i++)
+		for(k=1;k<8;k++)
+			crc32c_table[k][i] = (crc32c_table[k-1][i] >> 8) ^ crc32c_table[0][crc32c_table[k-1][i] & 0xFF];
+	// x^(2^k) for k = 15 (8 * CRC32C_BLOCK bits) and 16
+	p = 1u << 30;
+	for(k=0;k<15;k++)
+		p = crc32c_multmodp(p,p);
+	crc32c_shift1 = p;
+	crc32c_shift2 = crc32c_multmodp(p,p);
+#	ifdef HL_CRC32C_HW
+#	ifdef HL_VCC
+	{
+		int info[4];
+		__cpuid(info,1);
+		crc32c_hw = (info[2] & (1 << 20)) != 0;
+	}
+#	else
+	__builtin_cpu_init();
+	crc32c_hw = __builtin_cpu_supports("sse4.2") != 0;
+#	endif
+#	else
+	crc32c_hw = 0;
+#	endif
+}
+
+static uint32 crc32c_sw( uint32 crc, const uint8 *p, int len ) {
+	while( len && ((int_val)p & 7) ) {
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+		len--;
+	}
+	while( len >= 8 ) {
+		uint32 lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24));
+		crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^ crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24]
+			^ crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]] ^ crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+	while( len-- )
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+	return crc;
+}
+
+#ifdef HL_CRC32C_HW
+CRC32C_FUN static uint32 crc32c_sse42( uint32 crc, const uint8 *p, int len ) {
+	unsigned long long c0, c1, c2, v;
+	while( len && ((int_val)p & 7) ) {
+		crc = _mm_crc32_u8(crc, *p++);
+		len--;
+	}
+	while( len >= CRC32C_BLOCK * 3 ) {
+		const uint8 *end = p + CRC32C_BLOCK;
+		c0 = crc;
+		c1 = c2 = 0;
+		while( p < end ) {
+			c0 = _mm_crc32_u64(c0, *(unsigned long long*)p);
+			c1 = _mm_crc32_u64(c1, *(unsigned long long*)(p + CRC32C_BLOCK));
+			c2 = _mm_crc32_u64(c2, *(unsigned long long*)(p + CRC32C_BLOCK * 2));
+			p += 8;
 		}
-		break;
-	case 1:
-		{
-			SHA1_CTX ctx;
-			sha1_init(&ctx);
-			sha1_update(&ctx,in,length);
-			sha1_final(&ctx,out);
+		crc = crc32c_multmodp(crc32c_shift2, (uint32)c0) ^ crc32c_multmodp(crc32c_shift1, (uint32)c1) ^ (uint32)c2;
+		p += CRC32C_BLOCK * 2;
+		len -= CRC32C_BLOCK * 3;
+	}
+	v = crc;
+	while( len >= 8 ) {
+		v = _mm_crc32_u64(v, *(unsigned long long*)p);
+		p += 8;
+		len -= 8;
+	}
+	crc = (uint32)v;
+	while( len-- )
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+#endif
+
+// same convention as zlib crc32 : pass the previous result to continue
+static uint32 crc32c( uint32 crc, const uint8 *p, int len ) {
+	if( hl_atomic_load32(&crc32c_state) != 2 ) {
+		if( hl_atomic_compare_exchange32(&crc32c_state,0,1) == 0 ) {
+			crc32c_init();
+			hl_atomic_store32(&crc32c_state,2);
+		} else {
+			// only a few microseconds
+			while( hl_atomic_load32(&crc32c_state) != 2 ) {}
 		}
-		break;
-	case 2:
-		*((int*)out) = crc32(*(int*)out, in, length);
-		break;
-	case 3:
-		*((int*)out) = adler32(*(int*)out, in, length);
+	}
+	crc = ~crc;
+#	ifdef HL_CRC32C_HW
+	if( crc32c_hw )
+		return ~crc32c_sse42(crc, p, len);
+#	endif
+	return ~crc32c_sw(crc, p, len);
+}
+
+/*
+	Digest formats : 0 MD5, 1 SHA-1, 2 crc32, 3 adler32, 4 SHA-256, 5 SHA-512,
+	6 crc32c, 7 xxHash3 (64 bits, big endian). crc and adler results are
+	written as a native int.
+*/
+
+#define DIGEST_MD5		0
+#define DIGEST_SHA1		1
+#define DIGEST_CRC32	2
+#define DIGEST_ADLER32	3
+#define DIGEST_SHA256	4
+#define DIGEST_SHA512	5
+#define DIGEST_CRC32C	6
+#define DIGEST_XXH3		7
+
+typedef struct _fmt_digest_ctx fmt_digest_ctx;
+struct _fmt_digest_ctx {
+	void (*finalize)( fmt_digest_ctx * );
+	int format;
+	XXH3_state_t *xxh;
+	union {
+		md5_context md5;
+		SHA1_CTX sha1;
+		SHA256_CTX sha256;
+		SHA512_CTX sha512;
+		uint32 crc;
+	} c;
+};
+
+static void digest_finalize( fmt_digest_ctx *d ) {
+	if( d->xxh ) {
+		XXH3_freeState(d->xxh);
+		d->xxh = NULL;
+	}
+}
+
+static bool digest_start( fmt_digest_ctx *d, int format ) {
+	d->format = format;
+	d->xxh = NULL;
+	switch( format ) {
+	case DIGEST_MD5: md5_starts(&d->c.md5); break;
+	case DIGEST_SHA1: sha1_init(&d->c.sha1); break;
+	case DIGEST_SHA256: sha256_init(&d->c.sha256); break;
+	case DIGEST_SHA512: sha512_init(&d->c.sha512); break;
+	case DIGEST_CRC32: case DIGEST_CRC32C: d->c.crc = 0; break;
+	case DIGEST_ADLER32: d->c.crc = 1; break;
+	case DIGEST_XXH3:
+		d->xxh = XXH3_createState();
+		if( d->xxh == NULL ) hl_error("Out of memory");
+		XXH3_64bits_reset(d->xxh);
 		break;
 	default:
-		hl_blocking(false);
-		hl_error("Unknown digest format %d",format&0xFF);
-		break;
+		return false;
 	}
+	return true;
+}
+
+static void digest_feed( fmt_digest_ctx *d, const uint8 *in, int len ) {
+	switch( d->format ) {
+	case DIGEST_MD5: md5_update(&d->c.md5, (uint8*)in, (uint32)len); break;
+	case DIGEST_SHA1: sha1_update(&d->c.sha1, in, len); break;
+	case DIGEST_SHA256: sha256_update(&d->c.sha256, in, len); break;
+	case DIGEST_SHA512: sha512_update(&d->c.sha512, in, len); break;
+	case DIGEST_CRC32: d->c.crc = crc32(d->c.crc, in, len); break;
+	case DIGEST_ADLER32: d->c.crc = adler32(d->c.crc, in, len); break;
+	case DIGEST_CRC32C: d->c.crc = crc32c(d->c.crc, in, len); break;
+	case DIGEST_XXH3: XXH3_64bits_update(d->xxh, in, len); break;
+	}
+}
+
+// hash the UTF-8 encoding of a string without allocating it
+static void digest_feed_utf16( fmt_digest_ctx *d, const uchar *s ) {
+	uint8 buf[1024];
+	int p = 0;
+	while( *s ) {
+		unsigned int v = *s++;
+		if( p > (int)sizeof(buf) - 4 ) {
+			digest_feed(d, buf, p);
+			p = 0;
+		}
+		if( v < 0x80 )
+			buf[p++] = (uint8)v;
+		else if( v < 0x800 ) {
+			buf[p++] = (uint8)(0xC0 | (v >> 6));
+			buf[p++] = (uint8)(0x80 | (v & 63));
+		} else if( v >= 0xD800 && v <= 0xDBFF && *s >= 0xDC00 && *s <= 0xDFFF ) {
+			int k = ((((int)v - 0xD800) << 10) | (((int)*s++) - 0xDC00)) + 0x10000;
+			buf[p++] = (uint8)(0xF0 | (k >> 18));
+			buf[p++] = (uint8)(0x80 | ((k >> 12) & 63));
+			buf[p++] = (uint8)(0x80 | ((k >> 6) & 63));
+			buf[p++] = (uint8)(0x80 | (k & 63));
+		} else {
+			if( v >= 0xD800 && v <= 0xDFFF ) v = 0xFFFD;
+			buf[p++] = (uint8)(0xE0 | (v >> 12));
+			buf[p++] = (uint8)(0x80 | ((v >> 6) & 63));
+			buf[p++] = (uint8)(0x80 | (v & 63));
+		}
+	}
+	digest_feed(d, buf, p);
+}
+
+static void digest_end( fmt_digest_ctx *d, vbyte *out ) {
+	switch( d->format ) {
+	case DIGEST_MD5: md5_finish(&d->c.md5, out); break;
+	case DIGEST_SHA1: sha1_final(&d->c.sha1, out); break;
+	case DIGEST_SHA256: sha256_final(&d->c.sha256, out); break;
+	case DIGEST_SHA512: sha512_final(&d->c.sha512, out); break;
+	case DIGEST_CRC32: case DIGEST_ADLER32: case DIGEST_CRC32C: *((int*)out) = (int)d->c.crc; break;
+	case DIGEST_XXH3: XXH64_canonicalFromHash((XXH64_canonical_t*)out, XXH3_64bits_digest(d->xxh)); break;
+	}
+}
+
+HL_PRIM void HL_NAME(digest)( vbyte *out, vbyte *in, int length, int format ) {
+	fmt_digest_ctx d;
+	if( !digest_start(&d, format & 0xFF) )
+		hl_error("Unknown digest format %d",format&0xFF);
+	// crc and adler continue from the value already in out
+	if( d.format == DIGEST_CRC32 || d.format == DIGEST_ADLER32 || d.format == DIGEST_CRC32C )
+		d.c.crc = *(uint32*)out;
+	hl_blocking(true);
+	if( format & 256 )
+		digest_feed_utf16(&d, (uchar*)in);
+	else
+		digest_feed(&d, in, length);
+	digest_end(&d, out);
 	hl_blocking(false);
+	digest_finalize(&d);
 }
 
+HL_PRIM fmt_digest_ctx *HL_NAME(digest_init)( int format ) {
+	fmt_digest_ctx *d = (fmt_digest_ctx*)hl_gc_alloc_finalizer(sizeof(fmt_digest_ctx));
+	d->finalize = digest_finalize;
+	if( !digest_start(d, format) )
+		hl_error("Unknown digest format %d",format);
+	return d;
+}
+
+HL_PRIM void HL_NAME(digest_update)( fmt_digest_ctx *d, vbyte *in, int pos, int len ) {
+	hl_blocking(true);
+	digest_feed(d, in + pos, len);
+	hl_blocking(false);
+}
+
+HL_PRIM void HL_NAME(digest_final)( fmt_digest_ctx *d, vbyte *out ) {
+	digest_end(d, out);
+	digest_finalize(d);
+	d->format = -1;
+}
+
+#define _DIGEST _ABSTRACT(fmt_digest_ctx)
+
 DEFINE_PRIM(_VOID, digest, _BYTES _BYTES _I32 _I32);
+DEFINE_PRIM(_DIGEST, digest_init, _I32);
+DEFINE_PRIM(_VOID, digest_update, _DIGEST _BYTES _I32 _I32);
+DEFINE_PRIM(_VOID, digest_final, _DIGEST _BYTES);
@@ -24,6 +24,103 @@
 #include <stdio.h>
 #include <string.h>
 
+#ifdef HL_SHA_NI
+#	include <immintrin.h>
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#		define SHA_NI_FUN
+#	else
+#		include <cpuid.h>
+#		define SHA_NI_FUN __attribute__((target("sha,sse4.1,ssse3")))
+#	endif
+
+static int sha_ni = -1;
+
+int sha_ni_supported() {
+	if( sha_ni < 0 ) {
+		// SSSE3 + SSE4.1 (leaf 1 ecx) and SHA (leaf 7 ebx)
+#		ifdef _MSC_VER
+		int info[4];
+		bool ok = false;
+		__cpuid(info,1);
+		if( (info[2] & ((1 << 9) | (1 << 19))) == ((1 << 9) | (1 << 19)) ) {
+			__cpuidex(info,7,0);
+			ok = (info[1] & (1 << 29)) != 0;
+		}
+		sha_ni = ok;
+#		else
+		unsigned int a, b, c, d;
+		bool ok = false;
+		if( __get_cpuid(1,&a,&b,&c,&d) && (c & ((1 << 9) | (1 << 19))) == ((1 << 9) | (1 << 19)) && __get_cpuid_count(7,0,&a,&b,&c,&d) )
+			ok = (b & (1 << 29)) != 0;
+		sha_ni = ok;
+#		endif
+	}
+	return sha_ni;
+}
+
+// four rounds, with the message schedule of the next words computed on the way
+#define SHA1_ROUNDS(E,EO,M,MN,MX,MP,f) \
+	E = _mm_sha1nexte_epu32(E,M); \
+	EO = abcd; \
+	MN = _mm_sha1msg2_epu32(MN,M); \
+	abcd = _mm_sha1rnds4_epu32(abcd,E,f); \
+	MP = _mm_sha1msg1_epu32(MP,M); \
+	MX = _mm_xor_si128(MX,M);
+
+SHA_NI_FUN static void sha1_ni_blocks( unsigned int state[5], const unsigned char *data, unsigned int blocks ) {
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+	e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+	while( blocks-- ) {
+		abcd_save = abcd;
+		e0_save = e0;
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), mask);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+		// rounds 0-11 : the schedule is not complete yet
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m0 = _mm_sha1msg1_epu32(m0, m1);
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		m1 = _mm_sha1msg1_epu32(m1, m2);
+		m0 = _mm_xor_si128(m0, m2);
+		// rounds 12-79
+		SHA1_ROUNDS(e1,e0,m3,m0,m1,m2,0);
+		SHA1_ROUNDS(e0,e1,m0,m1,m2,m3,0);
+		SHA1_ROUNDS(e1,e0,m1,m2,m3,m0,1);
+		SHA1_ROUNDS(e0,e1,m2,m3,m0,m1,1);
+		SHA1_ROUNDS(e1,e0,m3,m0,m1,m2,1);
+		SHA1_ROUNDS(e0,e1,m0,m1,m2,m3,1);
+		SHA1_ROUNDS(e1,e0,m1,m2,m3,m0,1);
+		SHA1_ROUNDS(e0,e1,m2,m3,m0,m1,2);
+		SHA1_ROUNDS(e1,e0,m3,m0,m1,m2,2);
+		SHA1_ROUNDS(e0,e1,m0,m1,m2,m3,2);
+		SHA1_ROUNDS(e1,e0,m1,m2,m3,m0,2);
+		SHA1_ROUNDS(e0,e1,m2,m3,m0,m1,2);
+		SHA1_ROUNDS(e1,e0,m3,m0,m1,m2,3);
+		SHA1_ROUNDS(e0,e1,m0,m1,m2,m3,3);
+		SHA1_ROUNDS(e1,e0,m1,m2,m3,m0,3);
+		SHA1_ROUNDS(e0,e1,m2,m3,m0,m1,3);
+		SHA1_ROUNDS(e1,e0,m3,m0,m1,m2,3);
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+		data += 64;
+	}
+	_mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = (unsigned int)_mm_extract_epi32(e0, 3);
+}
+#endif
+
 // original code by Steve Reid
 
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
@@ -81,6 +178,19 @@ static void sha1_transform( unsigned int state[5], unsigned char buffer[64] ) {
 	state[4] += e;
 }
 
+static void sha1_blocks( unsigned int state[5], const unsigned char *data, unsigned int blocks ) {
+#	ifdef HL_SHA_NI
+	if( sha_ni_supported() ) {
+		sha1_ni_blocks(state, data, blocks);
+		return;
+	}
+#	endif
+	while( blocks-- ) {
+		sha1_transform(state, (unsigned char *)data);
+		data += 64;
+	}
+}
+
 void sha1_init( SHA1_CTX *context ) {
 	/* SHA1 initialization constants */
 	context->state[0] = 0x67452301;
@@ -98,9 +208,9 @@ void sha1_update( SHA1_CTX *context, const unsigned char *data, unsigned int len
 	context->count[1] += (len >> 29);
 	if ((j + len) > 63) {
 		memcpy(&context->buffer[j], data, (i = 64-j));
-		sha1_transform(context->state, context->buffer);
-		for ( ; i + 63 < len; i += 64 )
-			sha1_transform(context->state, (unsigned char *)&data[i]);
+		sha1_blocks(context->state, context->buffer, 1);
+		sha1_blocks(context->state, &data[i], (len - i) >> 6);
+		i += (len - i) & ~63;
 		j = 0;
 	} else
 		i = 0;
@@ -32,6 +32,14 @@ typedef struct {
 	unsigned char buffer[64];
 } SHA1_CTX;
 
+/*
+	SHA-1 and SHA-256 use the x86 SHA extensions when the CPU has them.
+*/
+#if (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#	define HL_SHA_NI
+int sha_ni_supported();
+#endif
+
 void sha1_init( SHA1_CTX *c );
 void sha1_update( SHA1_CTX *c, const unsigned char *data, unsigned int len );
 void sha1_final( SHA1_CTX *c, SHA1_DIGEST digest );
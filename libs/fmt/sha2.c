@@ -0,0 +1,315 @@
+/*
+ * Copyright (C)2005-2016 Haxe Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include <hl.h>
+#include "sha1.h"
+#include "sha2.h"
+#include <string.h>
+
+#ifdef HL_SHA_NI
+#	include <immintrin.h>
+#	ifdef _MSC_VER
+#		define SHA_NI_FUN
+#	else
+#		define SHA_NI_FUN __attribute__((target("sha,sse4.1,ssse3")))
+#	endif
+#endif
+
+#define ROR32(x,n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x,n)	(((x) >> (n)) | ((x) << (64 - (n))))
+#define CH(x,y,z)	(((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x,y,z)	(((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+static const unsigned int K256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const unsigned long long K512[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static unsigned int load32( const unsigned char *p ) {
+	return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static unsigned long long load64( const unsigned char *p ) {
+	return ((unsigned long long)load32(p) << 32) | load32(p + 4);
+}
+
+static void store32( unsigned char *p, unsigned int v ) {
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static void store64( unsigned char *p, unsigned long long v ) {
+	store32(p, (unsigned int)(v >> 32));
+	store32(p + 4, (unsigned int)v);
+}
+
+/* ----------------------------------------------- SHA-256 ------------------------------------------------ */
+
+static void sha256_transform( unsigned int state[8], const unsigned char *data ) {
+	unsigned int w[64];
+	unsigned int a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+	for(i=0;i<16;i++)
+		w[i] = load32(data + i * 4);
+	for(i=16;i<64;i++) {
+		unsigned int s0 = ROR32(w[i-15],7) ^ ROR32(w[i-15],18) ^ (w[i-15] >> 3);
+		unsigned int s1 = ROR32(w[i-2],17) ^ ROR32(w[i-2],19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+	a = state[0]; b = state[1]; c = state[2]; d = state[3];
+	e = state[4]; f = state[5]; g = state[6]; h = state[7];
+	for(i=0;i<64;i++) {
+		t1 = h + (ROR32(e,6) ^ ROR32(e,11) ^ ROR32(e,25)) + CH(e,f,g) + K256[i] + w[i];
+		t2 = (ROR32(a,2) ^ ROR32(a,13) ^ ROR32(a,22)) + MAJ(a,b,c);
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+#ifdef HL_SHA_NI
+
+// four rounds, the schedule of the previous and next words is computed on the way
+#define SHA256_ROUNDS(g,M,MP,MN) \
+	msg = _mm_add_epi32(M, _mm_loadu_si128((const __m128i*)(K256 + (g) * 4))); \
+	s1 = _mm_sha256rnds2_epu32(s1, s0, msg); \
+	tmp = _mm_alignr_epi8(M, MP, 4); \
+	MN = _mm_sha256msg2_epu32(_mm_add_epi32(MN, tmp), M); \
+	s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0E)); \
+	MP = _mm_sha256msg1_epu32(MP, M);
+
+#define SHA256_FIRST_ROUNDS(g,M,MP) \
+	msg = _mm_add_epi32(M, _mm_loadu_si128((const __m128i*)(K256 + (g) * 4))); \
+	s1 = _mm_sha256rnds2_epu32(s1, s0, msg); \
+	s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0E)); \
+	MP = _mm_sha256msg1_epu32(MP, M);
+
+SHA_NI_FUN static void sha256_ni_blocks( unsigned int state[8], const unsigned char *data, unsigned int blocks ) {
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i s0, s1, msg, tmp, m0, m1, m2, m3, abef_save, cdgh_save;
+	// the state is kept as ABEF / CDGH
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0xB1);
+	s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(state + 4)), 0x1B);
+	s0 = _mm_alignr_epi8(tmp, s1, 8);
+	s1 = _mm_blend_epi16(s1, tmp, 0xF0);
+	while( blocks-- ) {
+		abef_save = s0;
+		cdgh_save = s1;
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), mask);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+		msg = _mm_add_epi32(m0, _mm_loadu_si128((const __m128i*)K256));
+		s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+		s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0E));
+		SHA256_FIRST_ROUNDS(1,m1,m0);
+		SHA256_FIRST_ROUNDS(2,m2,m1);
+		SHA256_ROUNDS(3,m3,m2,m0);
+		SHA256_ROUNDS(4,m0,m3,m1);
+		SHA256_ROUNDS(5,m1,m0,m2);
+		SHA256_ROUNDS(6,m2,m1,m3);
+		SHA256_ROUNDS(7,m3,m2,m0);
+		SHA256_ROUNDS(8,m0,m3,m1);
+		SHA256_ROUNDS(9,m1,m0,m2);
+		SHA256_ROUNDS(10,m2,m1,m3);
+		SHA256_ROUNDS(11,m3,m2,m0);
+		SHA256_ROUNDS(12,m0,m3,m1);
+		SHA256_ROUNDS(13,m1,m0,m2);
+		SHA256_ROUNDS(14,m2,m1,m3);
+		SHA256_ROUNDS(15,m3,m2,m0);
+		s0 = _mm_add_epi32(s0, abef_save);
+		s1 = _mm_add_epi32(s1, cdgh_save);
+		data += 64;
+	}
+	tmp = _mm_shuffle_epi32(s0, 0x1B);
+	s1 = _mm_shuffle_epi32(s1, 0xB1);
+	_mm_storeu_si128((__m128i*)state, _mm_blend_epi16(tmp, s1, 0xF0));
+	_mm_storeu_si128((__m128i*)(state + 4), _mm_alignr_epi8(s1, tmp, 8));
+}
+#endif
+
+static void sha256_blocks( unsigned int state[8], const unsigned char *data, unsigned int blocks ) {
+#	ifdef HL_SHA_NI
+	if( sha_ni_supported() ) {
+		sha256_ni_blocks(state, data, blocks);
+		return;
+	}
+#	endif
+	while( blocks-- ) {
+		sha256_transform(state, data);
+		data += 64;
+	}
+}
+
+void sha256_init( SHA256_CTX *c ) {
+	c->state[0] = 0x6a09e667;
+	c->state[1] = 0xbb67ae85;
+	c->state[2] = 0x3c6ef372;
+	c->state[3] = 0xa54ff53a;
+	c->state[4] = 0x510e527f;
+	c->state[5] = 0x9b05688c;
+	c->state[6] = 0x1f83d9ab;
+	c->state[7] = 0x5be0cd19;
+	c->count = 0;
+}
+
+void sha256_update( SHA256_CTX *c, const unsigned char *data, unsigned int len ) {
+	unsigned int used = (unsigned int)(c->count & 63);
+	c->count += len;
+	if( used ) {
+		unsigned int n = 64 - used;
+		if( len < n ) {
+			memcpy(c->buffer + used, data, len);
+			return;
+		}
+		memcpy(c->buffer + used, data, n);
+		sha256_blocks(c->state, c->buffer, 1);
+		data += n;
+		len -= n;
+	}
+	sha256_blocks(c->state, data, len >> 6);
+	memcpy(c->buffer, data + (len & ~63), len & 63);
+}
+
+void sha256_final( SHA256_CTX *c, unsigned char digest[SHA256_SIZE] ) {
+	unsigned int used = (unsigned int)(c->count & 63);
+	int i;
+	c->buffer[used++] = 0x80;
+	if( used > 56 ) {
+		memset(c->buffer + used, 0, 64 - used);
+		sha256_blocks(c->state, c->buffer, 1);
+		used = 0;
+	}
+	memset(c->buffer + used, 0, 56 - used);
+	store64(c->buffer + 56, c->count << 3);
+	sha256_blocks(c->state, c->buffer, 1);
+	for(i=0;i<8;i++)
+		store32(digest + i * 4, c->state[i]);
+}
+
+/* ----------------------------------------------- SHA-512 ------------------------------------------------ */
+
+static void sha512_transform( unsigned long long state[8], const unsigned char *data ) {
+	unsigned long long w[80];
+	unsigned long long a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+	for(i=0;i<16;i++)
+		w[i] = load64(data + i * 8);
+	for(i=16;i<80;i++) {
+		unsigned long long s0 = ROR64(w[i-15],1) ^ ROR64(w[i-15],8) ^ (w[i-15] >> 7);
+		unsigned long long s1 = ROR64(w[i-2],19) ^ ROR64(w[i-2],61) ^ (w[i-2] >> 6);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+	a = state[0]; b = state[1]; c = state[2]; d = state[3];
+	e = state[4]; f = state[5]; g = state[6]; h = state[7];
+	for(i=0;i<80;i++) {
+		t1 = h + (ROR64(e,14) ^ ROR64(e,18) ^ ROR64(e,41)) + CH(e,f,g) + K512[i] + w[i];
+		t2 = (ROR64(a,28) ^ ROR64(a,34) ^ ROR64(a,39)) + MAJ(a,b,c);
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha512_init( SHA512_CTX *c ) {
+	c->state[0] = 0x6a09e667f3bcc908ULL;
+	c->state[1] = 0xbb67ae8584caa73bULL;
+	c->state[2] = 0x3c6ef372fe94f82bULL;
+	c->state[3] = 0xa54ff53a5f1d36f1ULL;
+	c->state[4] = 0x510e527fade682d1ULL;
+	c->state[5] = 0x9b05688c2b3e6c1fULL;
+	c->state[6] = 0x1f83d9abfb41bd6bULL;
+	c->state[7] = 0x5be0cd19137e2179ULL;
+	c->count = 0;
+}
+
+void sha512_update( SHA512_CTX *c, const unsigned char *data, unsigned int len ) {
+	unsigned int used = (unsigned int)(c->count & 127);
+	c->count += len;
+	if( used ) {
+		unsigned int n = 128 - used;
+		if( len < n ) {
+			memcpy(c->buffer + used, data, len);
+			return;
+		}
+		memcpy(c->buffer + used, data, n);
+		sha512_transform(c->state, c->buffer);
+		data += n;
+		len -= n;
+	}
+	while( len >= 128 ) {
+		sha512_transform(c->state, data);
+		data += 128;
+		len -= 128;
+	}
+	memcpy(c->buffer, data, len);
+}
+
+void sha512_final( SHA512_CTX *c, unsigned char digest[SHA512_SIZE] ) {
+	unsigned int used = (unsigned int)(c->count & 127);
+	int i;
+	c->buffer[used++] = 0x80;
+	if( used > 112 ) {
+		memset(c->buffer + used, 0, 128 - used);
+		sha512_transform(c->state, c->buffer);
+		used = 0;
+	}
+	memset(c->buffer + used, 0, 112 - used);
+	// 128-bit big endian bit length
+	store64(c->buffer + 112, c->count >> 61);
+	store64(c->buffer + 120, c->count << 3);
+	sha512_transform(c->state, c->buffer);
+	for(i=0;i<8;i++)
+		store64(digest + i * 8, c->state[i]);
+}
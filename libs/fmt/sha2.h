@@ -0,0 +1,49 @@
+/*
+ * Copyright (C)2005-2016 Haxe Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHA2_H
+#define SHA2_H
+
+#define SHA256_SIZE 32
+#define SHA512_SIZE 64
+
+typedef struct {
+	unsigned int state[8];
+	unsigned long long count;
+	unsigned char buffer[64];
+} SHA256_CTX;
+
+typedef struct {
+	unsigned long long state[8];
+	unsigned long long count;
+	unsigned char buffer[128];
+} SHA512_CTX;
+
+void sha256_init( SHA256_CTX *c );
+void sha256_update( SHA256_CTX *c, const unsigned char *data, unsigned int len );
+void sha256_final( SHA256_CTX *c, unsigned char digest[SHA256_SIZE] );
+
+void sha512_init( SHA512_CTX *c );
+void sha512_update( SHA512_CTX *c, const unsigned char *data, unsigned int len );
+void sha512_final( SHA512_CTX *c, unsigned char digest[SHA512_SIZE] );
+
+#endif
+/* ************************************************************************ */
@@ -15,11 +15,47 @@
 **/
 typedef struct _database sqlite_database;
 typedef struct _result sqlite_result;
+typedef struct _stmt sqlite_stmt;
+typedef struct _stmt_cache stmt_cache;
+typedef struct _cached_stmt cached_stmt;
+
+#define STMT_CACHE_SIZE 32
+
+/*
+	Prepared statements kept for reuse, most recently used first. A statement
+	is removed from the list while a sqlite_stmt uses it and put back on release.
+	The cache is shared with the statements so they can still be released after
+	the connection is closed or collected.
+*/
+struct _cached_stmt {
+	cached_stmt *prev;
+	cached_stmt *next;
+	sqlite3_stmt *s;
+	uchar *sql;
+	unsigned int hash;
+};
+
+struct _stmt_cache {
+	cached_stmt *head;
+	cached_stmt *tail;
+	int count;
+	int max;
+	int refs;
+	bool closed;
+};
 
 struct _database {
 	void (*finalize)( sqlite_database * );
 	sqlite3 *db;
 	sqlite_result *last;
+	stmt_cache *cache;
+};
+
+struct _stmt {
+	void (*finalize)( sqlite_stmt * );
+	sqlite3_stmt *s;
+	stmt_cache *cache;
+	cached_stmt *entry; // NULL if not from prepare_cached
 };
 
 struct _result {
@@ -62,6 +98,34 @@ static void HL_NAME(finalize_result)(sqlite_result *r ) {
 	if (r && r->db) HL_NAME(finalize_request)(r, false);
 }
 
+static void cache_unlink( stmt_cache *c, cached_stmt *e ) {
+	if( e->prev ) e->prev->next = e->next; else c->head = e->next;
+	if( e->next ) e->next->prev = e->prev; else c->tail = e->prev;
+	e->prev = e->next = NULL;
+	c->count--;
+}
+
+static void cache_free_entry( cached_stmt *e ) {
+	sqlite3_finalize(e->s);
+	free(e->sql);
+	free(e);
+}
+
+static void cache_trim( stmt_cache *c, int max ) {
+	while( c->count > max ) {
+		cached_stmt *e = c->tail;
+		cache_unlink(c, e);
+		cache_free_entry(e);
+	}
+}
+
+static void cache_unref( stmt_cache *c ) {
+	if( --c->refs == 0 ) {
+		cache_trim(c, 0);
+		free(c);
+	}
+}
+
 /**
 close : 'db -> void
 <doc>Closes the database.</doc>
@@ -69,7 +133,14 @@ close : 'db -> void
 HL_PRIM void HL_NAME(close)( sqlite_database *db ) {
 	if (db->last != NULL)
 		HL_NAME(finalize_request)(db->last, false);
-	if (sqlite3_close(db->db) != SQLITE_OK) {
+	if (db->cache != NULL) {
+		cache_trim(db->cache, 0);
+		db->cache->closed = true;
+		cache_unref(db->cache);
+		db->cache = NULL;
+	}
+	// statements still in use keep the connection alive until they are released
+	if (sqlite3_close_v2(db->db) != SQLITE_OK) {
 		// No exception : we shouldn't alloc memory in a finalizer anyway
 	}
 	db->db = NULL;
@@ -93,6 +164,10 @@ HL_PRIM sqlite_database *HL_NAME(connect)( vbyte *filename ) {
 	db->finalize = HL_NAME(finalize_database);
 	db->db = sqlite;
 	db->last = NULL;
+	db->cache = (stmt_cache*)malloc(sizeof(stmt_cache));
+	memset(db->cache, 0, sizeof(stmt_cache));
+	db->cache->max = STMT_CACHE_SIZE;
+	db->cache->refs = 1;
 	return db;
 }
 
@@ -317,8 +392,308 @@ HL_PRIM vdynamic *HL_NAME(result_get_float)( sqlite_result *r, int n ) {
 	return hl_make_dyn(&value, &hlt_f64);
 }
 
+HL_PRIM void HL_NAME(stmt_finalize)( sqlite_stmt *st );
+
+static sqlite_stmt *HL_NAME(alloc_stmt)( sqlite_database *db, vbyte *sql, cached_stmt *entry ) {
+	sqlite_stmt *st;
+	sqlite3_stmt *s = NULL;
+	const void *tl;
+	if( db->db == NULL )
+		hl_error("SQLite error: Database is closed");
+	// allocated first : a collection can release other statements into the cache
+	st = (sqlite_stmt*)hl_gc_alloc_finalizer(sizeof(sqlite_stmt));
+	st->finalize = NULL;
+	st->s = NULL;
+	st->entry = NULL;
+	st->cache = db->cache;
+	if( entry == NULL ) {
+		if( sqlite3_prepare16_v2(db->db, sql, -1, &s, &tl) != SQLITE_OK )
+			HL_NAME(error)(db->db, false);
+		if( s == NULL )
+			hl_error("SQLite error: Empty SQL statement");
+		if( *(uchar*)tl ) {
+			sqlite3_finalize(s);
+			hl_error("SQLite error: Cannot execute several SQL requests at the same time");
+		}
+	} else
+		s = entry->s;
+	st->s = s;
+	st->entry = entry;
+	st->finalize = HL_NAME(stmt_finalize);
+	db->cache->refs++;
+	return st;
+}
+
+/**
+	prepare : 'db -> sql:string -> 'stmt
+	<doc>Compiles a single SQL statement. Parameters are bound with the stmt_bind_* functions.</doc>
+**/
+HL_PRIM sqlite_stmt *HL_NAME(prepare)( sqlite_database *db, vbyte *sql ) {
+	return HL_NAME(alloc_stmt)(db, sql, NULL);
+}
+
+static unsigned int stmt_hash( const uchar *sql ) {
+	unsigned int h = 2166136261u;
+	while( *sql )
+		h = (h ^ *sql++) * 16777619u;
+	return h;
+}
+
+static cached_stmt *cache_find( stmt_cache *c, const uchar *sql, unsigned int hash ) {
+	cached_stmt *e = c->head;
+	while( e ) {
+		if( e->hash == hash && ucmp(e->sql, sql) == 0 )
+			return e;
+		e = e->next;
+	}
+	return NULL;
+}
+
+/**
+	prepare_cached : 'db -> sql:string -> 'stmt
+	<doc>Same as prepare but reuses a compiled statement from the connection cache.
+	The statement goes back to the cache when finalized.</doc>
+**/
+HL_PRIM sqlite_stmt *HL_NAME(prepare_cached)( sqlite_database *db, vbyte *sql ) {
+	sqlite_stmt *st;
+	cached_stmt *e;
+	unsigned int hash;
+	int len;
+	if( db->db == NULL )
+		hl_error("SQLite error: Database is closed");
+	hash = stmt_hash((uchar*)sql);
+	e = cache_find(db->cache, (uchar*)sql, hash);
+	if( e != NULL ) {
+		cache_unlink(db->cache, e);
+		return HL_NAME(alloc_stmt)(db, sql, e);
+	}
+	st = HL_NAME(alloc_stmt)(db, sql, NULL);
+	len = (int)(ustrlen((uchar*)sql) + 1) * sizeof(uchar);
+	e = (cached_stmt*)malloc(sizeof(cached_stmt));
+	memset(e, 0, sizeof(cached_stmt));
+	e->s = st->s;
+	e->sql = (uchar*)malloc(len);
+	memcpy(e->sql, sql, len);
+	e->hash = hash;
+	st->entry = e;
+	return st;
+}
+
+/**
+	set_cache_size : 'db -> int -> void
+	<doc>Sets how many statements prepare_cached keeps per connection (0 disables the cache).</doc>
+**/
+HL_PRIM void HL_NAME(set_cache_size)( sqlite_database *db, int size ) {
+	if( db->cache == NULL )
+		return;
+	if( size < 0 ) size = 0;
+	db->cache->max = size;
+	cache_trim(db->cache, size);
+}
+
+/**
+	stmt_finalize : 'stmt -> void
+	<doc>Releases the statement, back into the cache if it comes from prepare_cached.</doc>
+**/
+HL_PRIM void HL_NAME(stmt_finalize)( sqlite_stmt *st ) {
+	stmt_cache *c = st->cache;
+	cached_stmt *e = st->entry;
+	if( st->s == NULL )
+		return;
+	if( e && !c->closed && c->max > 0 && cache_find(c, e->sql, e->hash) == NULL ) {
+		sqlite3_reset(st->s);
+		sqlite3_clear_bindings(st->s);
+		e->next = c->head;
+		if( c->head ) c->head->prev = e; else c->tail = e;
+		c->head = e;
+		c->count++;
+		cache_trim(c, c->max);
+	} else if( e )
+		cache_free_entry(e);
+	else
+		sqlite3_finalize(st->s);
+	st->s = NULL;
+	st->entry = NULL;
+	st->cache = NULL;
+	st->finalize = NULL;
+	cache_unref(c);
+}
+
+static sqlite3_stmt *HL_NAME(get_stmt)( sqlite_stmt *st ) {
+	if( st->s == NULL )
+		hl_error("SQLite error: Statement is finalized");
+	if( st->cache->closed )
+		hl_error("SQLite error: Database is closed");
+	return st->s;
+}
+
+static void HL_NAME(check_bind)( sqlite3_stmt *s, int err ) {
+	if( err != SQLITE_OK )
+		HL_NAME(error)(sqlite3_db_handle(s), false);
+}
+
+/**
+	stmt_bind_int : 'stmt -> index:int -> int -> void
+	<doc>Binds the [index]th parameter (starting at 1). The stmt_bind_* functions are the same for other types.</doc>
+**/
+HL_PRIM void HL_NAME(stmt_bind_int)( sqlite_stmt *st, int index, int v ) {
+	sqlite3_stmt *s = HL_NAME(get_stmt)(st);
+	HL_NAME(check_bind)(s, sqlite3_bind_int(s, index, v));
+}
+
+HL_PRIM void HL_NAME(stmt_bind_int64)( sqlite_stmt *st, int index, int64 v ) {
+	sqlite3_stmt *s = HL_NAME(get_stmt)(st);
+	HL_NAME(check_bind)(s, sqlite3_bind_int64(s, index, v));
+}
+
+HL_PRIM void HL_NAME(stmt_bind_double)( sqlite_stmt *st, int index, double v ) {
+	sqlite3_stmt *s = HL_NAME(get_stmt)(st);
+	HL_NAME(check_bind)(s, sqlite3_bind_double(s, index, v));
+}
+
+HL_PRIM void HL_NAME(stmt_bind_text)( sqlite_stmt *st, int index, vbyte *v ) {
+	sqlite3_stmt *s = HL_NAME(get_stmt)(st);
+	if( v == NULL )
+		HL_NAME(check_bind)(s, sqlite3_bind_null(s, index));
+	else
+		HL_NAME(check_bind)(s, sqlite3_bind_text16(s, index, v, -1, SQLITE_TRANSIENT));
+}
+
+HL_PRIM void HL_NAME(stmt_bind_blob)( sqlite_stmt *st, int index, vbyte *v, int pos, int len ) {
+	sqlite3_stmt *s = HL_NAME(get_stmt)(st);
+	if( pos < 0 || len < 0 )
+		hl_error("SQLite error: Out of range");
+	HL_NAME(check_bind)(s, sqlite3_bind_blob(s, index, v + pos, len, SQLITE_TRANSIENT));
+}
+
+HL_PRIM void HL_NAME(stmt_bind_null)( sqlite_stmt *st, int index ) {
+	sqlite3_stmt *s = HL_NAME(get_stmt)(st);
+	HL_NAME(check_bind)(s, sqlite3_bind_null(s, index));
+}
+
+/**
+	stmt_bind_index : 'stmt -> name:string -> int
+	<doc>Returns the index of a named parameter (including its :, @ or $ prefix) or 0 if there is none.</doc>
+**/
+HL_PRIM int HL_NAME(stmt_bind_index)( sqlite_stmt *st, vbyte *name ) {
+	return sqlite3_bind_parameter_index(HL_NAME(get_stmt)(st), hl_to_utf8((uchar*)name));
+}
+
+/**
+	stmt_step : 'stmt -> bool
+	<doc>Executes the statement until the next row. Returns false when it is done.</doc>
+**/
+HL_PRIM bool HL_NAME(stmt_step)( sqlite_stmt *st ) {
+	sqlite3_stmt *s = HL_NAME(get_stmt)(st);
+	switch( sqlite3_step(s) ) {
+	case SQLITE_ROW:
+		return true;
+	case SQLITE_DONE:
+		return false;
+	case SQLITE_BUSY:
+		sqlite3_reset(s);
+		hl_error("SQLite error: Database is busy");
+	default:
+		// leave the statement ready to run again, the error message is kept
+		sqlite3_reset(s);
+		HL_NAME(error)(sqlite3_db_handle(s), false);
+	}
+	return false;
+}
+
+/**
+	stmt_reset : 'stmt -> void
+	<doc>Rewinds the statement so it can be executed again. Bound parameters are kept.</doc>
+**/
+HL_PRIM void HL_NAME(stmt_reset)( sqlite_stmt *st ) {
+	sqlite3_reset(HL_NAME(get_stmt)(st));
+}
+
+/**
+	stmt_clear_bindings : 'stmt -> void
+	<doc>Sets all the parameters to NULL.</doc>
+**/
+HL_PRIM void HL_NAME(stmt_clear_bindings)( sqlite_stmt *st ) {
+	sqlite3_clear_bindings(HL_NAME(get_stmt)(st));
+}
+
+/**
+	stmt_column_count : 'stmt -> int
+	<doc>Returns the number of columns in the statement rows.</doc>
+**/
+HL_PRIM int HL_NAME(stmt_column_count)( sqlite_stmt *st ) {
+	return sqlite3_column_count(HL_NAME(get_stmt)(st));
+}
+
+/**
+	stmt_column_name : 'stmt -> n:int -> string
+	<doc>Returns the name of the [n]th column.</doc>
+**/
+HL_PRIM vbyte *HL_NAME(stmt_column_name)( sqlite_stmt *st, int n ) {
+	uchar *name = (uchar*)sqlite3_column_name16(HL_NAME(get_stmt)(st), n);
+	if( name == NULL )
+		return NULL;
+	return hl_copy_bytes((vbyte*)name, (int)(ustrlen(name) + 1) * sizeof(uchar));
+}
+
+/**
+	stmt_column_type : 'stmt -> n:int -> int
+	<doc>Returns the SQLite type of the [n]th column of the current row : 1 integer, 2 float, 3 text, 4 blob, 5 null.</doc>
+**/
+HL_PRIM int HL_NAME(stmt_column_type)( sqlite_stmt *st, int n ) {
+	return sqlite3_column_type(HL_NAME(get_stmt)(st), n);
+}
+
+HL_PRIM int HL_NAME(stmt_column_int)( sqlite_stmt *st, int n ) {
+	return sqlite3_column_int(HL_NAME(get_stmt)(st), n);
+}
+
+HL_PRIM int64 HL_NAME(stmt_column_int64)( sqlite_stmt *st, int n ) {
+	return sqlite3_column_int64(HL_NAME(get_stmt)(st), n);
+}
+
+HL_PRIM double HL_NAME(stmt_column_double)( sqlite_stmt *st, int n ) {
+	return sqlite3_column_double(HL_NAME(get_stmt)(st), n);
+}
+
+/**
+	stmt_column_text : 'stmt -> n:int -> string
+	<doc>Returns the [n]th column of the current row as a string, or null.</doc>
+**/
+HL_PRIM vbyte *HL_NAME(stmt_column_text)( sqlite_stmt *st, int n ) {
+	sqlite3_stmt *s = HL_NAME(get_stmt)(st);
+	uchar *text16 = (uchar*)sqlite3_column_text16(s, n);
+	if( text16 == NULL )
+		return NULL;
+	return hl_copy_bytes((vbyte*)text16, sqlite3_column_bytes16(s, n) + sizeof(uchar));
+}
+
+/**
+	stmt_column_blob : 'stmt -> n:int -> size:ref<int> -> bytes
+	<doc>Returns a copy of the [n]th column of the current row and sets its size.</doc>
+**/
+HL_PRIM vbyte *HL_NAME(stmt_column_blob)( sqlite_stmt *st, int n, int *size ) {
+	sqlite3_stmt *s = HL_NAME(get_stmt)(st);
+	const void *blob = sqlite3_column_blob(s, n);
+	*size = sqlite3_column_bytes(s, n);
+	if( blob == NULL )
+		return NULL;
+	return hl_copy_bytes((vbyte*)blob, *size);
+}
+
+/**
+	changes : 'db -> int
+	<doc>Returns the number of rows changed by the last INSERT, UPDATE or DELETE.</doc>
+**/
+HL_PRIM int HL_NAME(changes)( sqlite_database *db ) {
+	if( db->db == NULL )
+		hl_error("SQLite error: Database is closed");
+	return sqlite3_changes(db->db);
+}
+
 #define _CONNECTION _ABSTRACT( sqlite_database )
 #define _RESULT _ABSTRACT( sqlite_result )
+#define _STMT _ABSTRACT( sqlite_stmt )
 
 DEFINE_PRIM(_CONNECTION, connect, _BYTES);
 DEFINE_PRIM(_VOID,       close,   _CONNECTION);
@@ -332,3 +707,28 @@ DEFINE_PRIM(_NULL(_F64),   result_get_float, _RESULT _I32);
 DEFINE_PRIM(_NULL(_I32),   result_get_length, _RESULT);
 DEFINE_PRIM(_I32,          result_get_nfields, _RESULT);
 DEFINE_PRIM(_ARR,          result_get_fields, _RESULT);
+
+DEFINE_PRIM(_STMT,   prepare,          _CONNECTION _BYTES);
+DEFINE_PRIM(_STMT,   prepare_cached,   _CONNECTION _BYTES);
+DEFINE_PRIM(_VOID,   set_cache_size,   _CONNECTION _I32);
+DEFINE_PRIM(_I32,    changes,          _CONNECTION);
+
+DEFINE_PRIM(_VOID,   stmt_bind_int,    _STMT _I32 _I32);
+DEFINE_PRIM(_VOID,   stmt_bind_int64,  _STMT _I32 _I64);
+DEFINE_PRIM(_VOID,   stmt_bind_double, _STMT _I32 _F64);
+DEFINE_PRIM(_VOID,   stmt_bind_text,   _STMT _I32 _BYTES);
+DEFINE_PRIM(_VOID,   stmt_bind_blob,   _STMT _I32 _BYTES _I32 _I32);
+DEFINE_PRIM(_VOID,   stmt_bind_null,   _STMT _I32);
+DEFINE_PRIM(_I32,    stmt_bind_index,  _STMT _BYTES);
+DEFINE_PRIM(_BOOL,   stmt_step,        _STMT);
+DEFINE_PRIM(_VOID,   stmt_reset,       _STMT);
+DEFINE_PRIM(_VOID,   stmt_clear_bindings, _STMT);
+DEFINE_PRIM(_VOID,   stmt_finalize,    _STMT);
+DEFINE_PRIM(_I32,    stmt_column_count, _STMT);
+DEFINE_PRIM(_BYTES,  stmt_column_name, _STMT _I32);
+DEFINE_PRIM(_I32,    stmt_column_type, _STMT _I32);
+DEFINE_PRIM(_I32,    stmt_column_int,  _STMT _I32);
+DEFINE_PRIM(_I64,    stmt_column_int64, _STMT _I32);
+DEFINE_PRIM(_F64,    stmt_column_double, _STMT _I32);
+DEFINE_PRIM(_BYTES,  stmt_column_text, _STMT _I32);
+DEFINE_PRIM(_BYTES,  stmt_column_blob, _STMT _I32 _REF(_I32));
@@ -9,6 +9,7 @@ class Main
 		r.add(new BasicTestCase());
 		r.add(new ResultSetTestCase());
 		r.add(new ExceptionTestCase());
+		r.add(new PreparedTestCase());
 		r.run();
 	}
 	/*
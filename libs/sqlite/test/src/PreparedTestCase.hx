@@ -0,0 +1,160 @@
+package ;
+
+import haxe.unit.TestCase;
+import sys.FileSystem;
+
+private typedef Db = hl.Abstract<"sqlite_database">;
+private typedef Stmt = hl.Abstract<"sqlite_stmt">;
+
+@:hlNative("sqlite")
+private class Native
+{
+	public static function connect( file : hl.Bytes ) : Db { return null; }
+	public static function close( db : Db ) : Void {}
+	public static function prepare( db : Db, sql : hl.Bytes ) : Stmt { return null; }
+	@:hlNative("sqlite", "prepare_cached") public static function prepareCached( db : Db, sql : hl.Bytes ) : Stmt { return null; }
+	@:hlNative("sqlite", "set_cache_size") public static function setCacheSize( db : Db, size : Int ) : Void {}
+	public static function changes( db : Db ) : Int { return 0; }
+	@:hlNative("sqlite", "stmt_bind_int") public static function bindInt( s : Stmt, index : Int, v : Int ) : Void {}
+	@:hlNative("sqlite", "stmt_bind_int64") public static function bindInt64( s : Stmt, index : Int, v : hl.I64 ) : Void {}
+	@:hlNative("sqlite", "stmt_bind_double") public static function bindDouble( s : Stmt, index : Int, v : Float ) : Void {}
+	@:hlNative("sqlite", "stmt_bind_text") public static function bindText( s : Stmt, index : Int, v : hl.Bytes ) : Void {}
+	@:hlNative("sqlite", "stmt_bind_blob") public static function bindBlob( s : Stmt, index : Int, v : hl.Bytes, pos : Int, len : Int ) : Void {}
+	@:hlNative("sqlite", "stmt_bind_null") public static function bindNull( s : Stmt, index : Int ) : Void {}
+	@:hlNative("sqlite", "stmt_bind_index") public static function bindIndex( s : Stmt, name : hl.Bytes ) : Int { return 0; }
+	@:hlNative("sqlite", "stmt_step") public static function step( s : Stmt ) : Bool { return false; }
+	@:hlNative("sqlite", "stmt_reset") public static function reset( s : Stmt ) : Void {}
+	@:hlNative("sqlite", "stmt_finalize") public static function finalize( s : Stmt ) : Void {}
+	@:hlNative("sqlite", "stmt_column_count") public static function columnCount( s : Stmt ) : Int { return 0; }
+	@:hlNative("sqlite", "stmt_column_type") public static function columnType( s : Stmt, n : Int ) : Int { return 0; }
+	@:hlNative("sqlite", "stmt_column_int") public static function columnInt( s : Stmt, n : Int ) : Int { return 0; }
+	@:hlNative("sqlite", "stmt_column_int64") public static function columnInt64( s : Stmt, n : Int ) : hl.I64 { return 0; }
+	@:hlNative("sqlite", "stmt_column_double") public static function columnDouble( s : Stmt, n : Int ) : Float { return 0.; }
+	@:hlNative("sqlite", "stmt_column_text") public static function columnText( s : Stmt, n : Int ) : hl.Bytes { return null; }
+	@:hlNative("sqlite", "stmt_column_blob") public static function columnBlob( s : Stmt, n : Int, size : hl.Ref<Int> ) : hl.Bytes { return null; }
+}
+
+class PreparedTestCase extends TestCase
+{
+	var file : String;
+	var db : Db;
+
+	override public function setup( ) : Void
+	{
+		super.setup();
+
+		file = '${currentTest.classname}-${currentTest.method}.sqlite';
+		db = Native.connect(@:privateAccess file.bytes);
+		exec('DROP TABLE IF EXISTS t1');
+		exec('CREATE TABLE t1(i int, i64 int, f float, t text, bl blob)');
+	}
+
+	override public function tearDown( ) : Void
+	{
+		super.tearDown();
+
+		Native.close(db);
+		FileSystem.deleteFile(file);
+	}
+
+	function exec( sql : String ) : Void
+	{
+		var s = Native.prepare(db, @:privateAccess sql.bytes);
+		Native.step(s);
+		Native.finalize(s);
+	}
+
+	function text( b : hl.Bytes ) : String
+	{
+		return b == null ? null : @:privateAccess String.fromUCS2(b);
+	}
+
+	public function testBindTypes( ) : Void
+	{
+		var s = Native.prepare(db, @:privateAccess "INSERT INTO t1 VALUES(?, ?, ?, :t, ?)".bytes);
+		var blob = haxe.io.Bytes.ofHex("00112233");
+		Native.bindInt(s, 1, -5);
+		Native.bindInt64(s, 2, haxe.Int64.make(1, 2));
+		Native.bindDouble(s, 3, 0.25);
+		Native.bindText(s, Native.bindIndex(s, @:privateAccess ":t".bytes), @:privateAccess "Привет!".bytes);
+		Native.bindBlob(s, 5, blob, 1, 2);
+		assertFalse(Native.step(s));
+		assertEquals(1, Native.changes(db));
+		Native.reset(s);
+		Native.bindNull(s, 5);
+		Native.step(s);
+		Native.finalize(s);
+
+		var s = Native.prepare(db, @:privateAccess "SELECT * FROM t1 ORDER BY rowid".bytes);
+		assertEquals(5, Native.columnCount(s));
+		assertTrue(Native.step(s));
+		assertEquals(-5, Native.columnInt(s, 0));
+		assertTrue(Native.columnInt64(s, 1) == haxe.Int64.make(1, 2));
+		assertEquals(0.25, Native.columnDouble(s, 2));
+		assertEquals("Привет!", text(Native.columnText(s, 3)));
+		var size = 0;
+		var b = Native.columnBlob(s, 4, size);
+		assertEquals("1122", b.toBytes(size).toHex());
+		assertTrue(Native.step(s));
+		assertEquals(5, Native.columnType(s, 4));
+		assertEquals(null, Native.columnBlob(s, 4, size));
+		assertFalse(Native.step(s));
+		Native.finalize(s);
+	}
+
+	public function testBulkInsert( ) : Void
+	{
+		var count = 100000;
+		exec('BEGIN');
+		for( i in 0...count ) {
+			var s = Native.prepareCached(db, @:privateAccess "INSERT INTO t1(i, t) VALUES(?, ?)".bytes);
+			Native.bindInt(s, 1, i);
+			Native.bindText(s, 2, @:privateAccess "row".bytes);
+			Native.step(s);
+			Native.finalize(s);
+		}
+		exec('COMMIT');
+
+		var s = Native.prepare(db, @:privateAccess "SELECT count(*), sum(i) FROM t1".bytes);
+		assertTrue(Native.step(s));
+		assertEquals(count, Native.columnInt(s, 0));
+		assertEquals(count * (count - 1) / 2, Native.columnDouble(s, 1));
+		Native.finalize(s);
+	}
+
+	public function testCache( ) : Void
+	{
+		Native.setCacheSize(db, 2);
+		for( i in 0...4 ) {
+			var s = Native.prepareCached(db, @:privateAccess 'SELECT $i'.bytes);
+			Native.step(s);
+			Native.finalize(s);
+		}
+		// a cached statement comes back reset with its parameters cleared
+		var s = Native.prepareCached(db, @:privateAccess "SELECT ?".bytes);
+		Native.bindInt(s, 1, 7);
+		assertTrue(Native.step(s));
+		assertEquals(7, Native.columnInt(s, 0));
+		Native.finalize(s);
+		var s = Native.prepareCached(db, @:privateAccess "SELECT ?".bytes);
+		assertTrue(Native.step(s));
+		assertEquals(5, Native.columnType(s, 0));
+		// the same SQL used twice at the same time gets two statements
+		var s2 = Native.prepareCached(db, @:privateAccess "SELECT ?".bytes);
+		assertTrue(Native.step(s2));
+		Native.finalize(s2);
+		Native.finalize(s);
+	}
+
+	public function testErrors( ) : Void
+	{
+		var s = Native.prepare(db, @:privateAccess "INSERT INTO t1(i) VALUES(?)".bytes);
+		var failed = false;
+		try Native.bindInt(s, 2, 0) catch( e : Dynamic ) failed = true;
+		assertTrue(failed);
+		Native.finalize(s);
+		failed = false;
+		try Native.prepare(db, @:privateAccess "SELECT * FROM missing".bytes) catch( e : Dynamic ) failed = true;
+		assertTrue(failed);
+	}
+}
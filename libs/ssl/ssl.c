@@ -31,6 +31,8 @@ typedef int SOCKET;
 #include "mbedtls/oid.h"
 #include "mbedtls/x509_crt.h"
 #include "mbedtls/ssl.h"
+#include "mbedtls/ssl_cache.h"
+#include "mbedtls/ssl_ticket.h"
 
 #ifdef MBEDTLS_PSA_CRYPTO_C
 #include <psa/crypto.h>
@@ -61,11 +63,41 @@ struct _hl_ssl_pkey {
 	mbedtls_pk_context *k;
 };
 
+typedef struct _hl_ssl_cache hl_ssl_cache;
+struct _hl_ssl_cache {
+	void(*finalize)(hl_ssl_cache *);
+	mbedtls_ssl_cache_context *c;
+};
+
+typedef struct _hl_ssl_ticket hl_ssl_ticket;
+struct _hl_ssl_ticket {
+	void(*finalize)(hl_ssl_ticket *);
+	mbedtls_ssl_ticket_context *t;
+};
+
+typedef struct {
+	unsigned char *data;
+	unsigned int mask;
+	unsigned int rpos;
+	unsigned int wpos;
+} hl_ring;
+
+typedef struct _hl_ssl_mem hl_ssl_mem;
+struct _hl_ssl_mem {
+	void(*finalize)(hl_ssl_mem *);
+	hl_ring in;
+	hl_ring out;
+	bool eof;
+};
+
 #define _SOCK	_ABSTRACT(hl_socket)
 #define TSSL _ABSTRACT(mbedtls_ssl_context)
 #define TCONF _ABSTRACT(mbedtls_ssl_config)
 #define TCERT _ABSTRACT(hl_ssl_cert)
 #define TPKEY _ABSTRACT(hl_ssl_pkey)
+#define TCACHE _ABSTRACT(hl_ssl_cache)
+#define TTICKET _ABSTRACT(hl_ssl_ticket)
+#define TMEM _ABSTRACT(hl_ssl_mem)
 
 static bool ssl_init_done = false;
 static mbedtls_entropy_context entropy;
@@ -75,6 +107,13 @@ static bool is_ssl_blocking( int r ) {
 	return r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE;
 }
 
+// TLS 1.3 tickets arrive after the handshake, they are stored in the session and reading can go on
+#ifdef MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+#	define is_new_ticket(r)	((r) == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+#else
+#	define is_new_ticket(r)	false
+#endif
+
 static int ssl_block_error( int r ) {
 	return is_ssl_blocking(r) ? -1 : -2;
 }
@@ -91,6 +130,18 @@ static void pkey_finalize(hl_ssl_pkey *k) {
 	k->k = NULL;
 }
 
+static void cache_finalize(hl_ssl_cache *c) {
+	mbedtls_ssl_cache_free(c->c);
+	free(c->c);
+	c->c = NULL;
+}
+
+static void ticket_finalize(hl_ssl_ticket *t) {
+	mbedtls_ssl_ticket_free(t->t);
+	free(t->t);
+	t->t = NULL;
+}
+
 static int ssl_error(int ret) {
 	char buf[128];
 	uchar buf16[128];
@@ -119,7 +170,9 @@ HL_PRIM void HL_NAME(ssl_close)(mbedtls_ssl_context *ssl) {
 
 HL_PRIM int HL_NAME(ssl_handshake)(mbedtls_ssl_context *ssl) {
 	int r;
-	r = mbedtls_ssl_handshake(ssl);
+	do {
+		r = mbedtls_ssl_handshake(ssl);
+	} while( is_new_ticket(r) );
 	if( is_ssl_blocking(r) )
 		return -1;
 	if( r == MBEDTLS_ERR_SSL_CONN_EOF )
@@ -175,6 +228,160 @@ HL_PRIM void HL_NAME(ssl_set_bio)( mbedtls_ssl_context *ssl, varray *ctx ) {
 	mbedtls_ssl_set_bio(ssl, ctx, arr_write, arr_read, NULL);	
 }
 
+/*
+	Memory BIO : ciphertext coming from the transport is fed into the input ring and
+	ciphertext produced by the TLS engine is drained from the output ring, so the
+	connection can be driven by any event loop without callbacks.
+	Ring positions are free running counters, sizes are powers of two.
+*/
+
+#define MEM_WANT_READ	-1
+#define MEM_CLOSED		-2
+#define MEM_WANT_WRITE	-3
+
+static int ring_used( hl_ring *r ) {
+	return (int)(r->wpos - r->rpos);
+}
+
+static int ring_write( hl_ring *r, const unsigned char *buf, int len ) {
+	int space = (int)(r->mask + 1) - ring_used(r);
+	int pos, first;
+	if( len > space ) len = space;
+	pos = (int)(r->wpos & r->mask);
+	first = (int)(r->mask + 1) - pos;
+	if( first > len ) first = len;
+	memcpy(r->data + pos, buf, first);
+	memcpy(r->data, buf + first, len - first);
+	r->wpos += len;
+	return len;
+}
+
+static int ring_read( hl_ring *r, unsigned char *buf, int len ) {
+	int used = ring_used(r);
+	int pos, first;
+	if( len > used ) len = used;
+	pos = (int)(r->rpos & r->mask);
+	first = (int)(r->mask + 1) - pos;
+	if( first > len ) first = len;
+	memcpy(buf, r->data + pos, first);
+	memcpy(buf + first, r->data, len - first);
+	r->rpos += len;
+	return len;
+}
+
+static void mem_finalize( hl_ssl_mem *m ) {
+	free(m->in.data);
+	free(m->out.data);
+	m->in.data = NULL;
+	m->out.data = NULL;
+}
+
+static int mem_recv( void *ctx, unsigned char *buf, size_t len ) {
+	hl_ssl_mem *m = (hl_ssl_mem*)ctx;
+	if( ring_used(&m->in) == 0 )
+		return m->eof ? 0 : MBEDTLS_ERR_SSL_WANT_READ;
+	return ring_read(&m->in, buf, len > 0x7FFFFFFF ? 0x7FFFFFFF : (int)len);
+}
+
+static int mem_send( void *ctx, const unsigned char *buf, size_t len ) {
+	hl_ssl_mem *m = (hl_ssl_mem*)ctx;
+	int r = ring_write(&m->out, buf, len > 0x7FFFFFFF ? 0x7FFFFFFF : (int)len);
+	return r == 0 ? MBEDTLS_ERR_SSL_WANT_WRITE : r;
+}
+
+static int mem_status( int r ) {
+	if( r == MBEDTLS_ERR_SSL_WANT_READ ) return MEM_WANT_READ;
+	if( r == MBEDTLS_ERR_SSL_WANT_WRITE ) return MEM_WANT_WRITE;
+	return MEM_CLOSED;
+}
+
+static void ring_init( hl_ring *r, int size ) {
+	unsigned int cap = 1024;
+	while( cap < (unsigned int)size && cap < 0x40000000 ) cap <<= 1;
+	r->data = (unsigned char*)malloc(cap);
+	if( r->data == NULL ) hl_error("Out of memory");
+	r->mask = cap - 1;
+	r->rpos = r->wpos = 0;
+}
+
+HL_PRIM hl_ssl_mem *HL_NAME(mem_new)( int size ) {
+	hl_ssl_mem *m = (hl_ssl_mem*)hl_gc_alloc_finalizer(sizeof(hl_ssl_mem));
+	memset(m, 0, sizeof(hl_ssl_mem));
+	m->finalize = mem_finalize;
+	// a full TLS record fits by default
+	if( size <= 0 ) size = MBEDTLS_SSL_IN_CONTENT_LEN + 1024;
+	ring_init(&m->in, size);
+	ring_init(&m->out, size);
+	return m;
+}
+
+// the bytes length is not known here : the caller checks that pos + len fits
+static void mem_check_range( int pos, int len ) {
+	if( pos < 0 || len < 0 || pos > 0x7FFFFFFF - len )
+		hl_error("Invalid buffer range");
+}
+
+HL_PRIM int HL_NAME(mem_feed)( hl_ssl_mem *m, vbyte *buf, int pos, int len ) {
+	mem_check_range(pos, len);
+	return ring_write(&m->in, (unsigned char*)buf + pos, len);
+}
+
+HL_PRIM int HL_NAME(mem_drain)( hl_ssl_mem *m, vbyte *buf, int pos, int len ) {
+	mem_check_range(pos, len);
+	return ring_read(&m->out, (unsigned char*)buf + pos, len);
+}
+
+HL_PRIM int HL_NAME(mem_pending)( hl_ssl_mem *m ) {
+	return ring_used(&m->out);
+}
+
+HL_PRIM int HL_NAME(mem_space)( hl_ssl_mem *m ) {
+	return (int)(m->in.mask + 1) - ring_used(&m->in);
+}
+
+HL_PRIM void HL_NAME(mem_set_eof)( hl_ssl_mem *m ) {
+	m->eof = true;
+}
+
+HL_PRIM void HL_NAME(ssl_set_mem)( mbedtls_ssl_context *ssl, hl_ssl_mem *m ) {
+	mbedtls_ssl_set_bio(ssl, m, mem_send, mem_recv, NULL);
+}
+
+HL_PRIM int HL_NAME(ssl_mem_handshake)( mbedtls_ssl_context *ssl ) {
+	int r;
+	do {
+		r = mbedtls_ssl_handshake(ssl);
+	} while( is_new_ticket(r) );
+	if( r == 0 )
+		return 0;
+	if( is_ssl_blocking(r) || r == MBEDTLS_ERR_SSL_CONN_EOF )
+		return mem_status(r);
+	return ssl_error(r);
+}
+
+HL_PRIM int HL_NAME(ssl_mem_send)( mbedtls_ssl_context *ssl, vbyte *buf, int pos, int len ) {
+	int r;
+	mem_check_range(pos, len);
+	r = mbedtls_ssl_write(ssl, (const unsigned char *)buf + pos, len);
+	return r < 0 ? mem_status(r) : r;
+}
+
+HL_PRIM int HL_NAME(ssl_mem_recv)( mbedtls_ssl_context *ssl, vbyte *buf, int pos, int len ) {
+	int r;
+	mem_check_range(pos, len);
+	do {
+		r = mbedtls_ssl_read(ssl, (unsigned char*)buf + pos, len);
+	} while( is_new_ticket(r) );
+	if( r == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY )
+		return 0;
+	return r < 0 ? mem_status(r) : r;
+}
+
+HL_PRIM int HL_NAME(ssl_mem_close_notify)( mbedtls_ssl_context *ssl ) {
+	int r = mbedtls_ssl_close_notify(ssl);
+	return r < 0 ? mem_status(r) : 0;
+}
+
 HL_PRIM void HL_NAME(ssl_set_hostname)(mbedtls_ssl_context *ssl, vbyte *hostname) {
 	int ret;
 	if ((ret = mbedtls_ssl_set_hostname(ssl, (char*)hostname)) != 0)
@@ -194,6 +401,17 @@ DEFINE_PRIM(_VOID, ssl_set_bio, TSSL _DYN);
 DEFINE_PRIM(_VOID, ssl_set_socket, TSSL _SOCK);
 DEFINE_PRIM(_VOID, ssl_set_hostname, TSSL _BYTES);
 DEFINE_PRIM(TCERT, ssl_get_peer_certificate, TSSL);
+DEFINE_PRIM(TMEM, mem_new, _I32);
+DEFINE_PRIM(_I32, mem_feed, TMEM _BYTES _I32 _I32);
+DEFINE_PRIM(_I32, mem_drain, TMEM _BYTES _I32 _I32);
+DEFINE_PRIM(_I32, mem_pending, TMEM);
+DEFINE_PRIM(_I32, mem_space, TMEM);
+DEFINE_PRIM(_VOID, mem_set_eof, TMEM);
+DEFINE_PRIM(_VOID, ssl_set_mem, TSSL TMEM);
+DEFINE_PRIM(_I32, ssl_mem_handshake, TSSL);
+DEFINE_PRIM(_I32, ssl_mem_send, TSSL _BYTES _I32 _I32);
+DEFINE_PRIM(_I32, ssl_mem_recv, TSSL _BYTES _I32 _I32);
+DEFINE_PRIM(_I32, ssl_mem_close_notify, TSSL);
 
 HL_PRIM int HL_NAME(ssl_send_char)(mbedtls_ssl_context *ssl, int c) {
 	unsigned char cc;
@@ -214,14 +432,20 @@ HL_PRIM int HL_NAME(ssl_send)(mbedtls_ssl_context *ssl, vbyte *buf, int pos, int
 
 HL_PRIM int HL_NAME(ssl_recv_char)(mbedtls_ssl_context *ssl) {
 	unsigned char c;
-	int ret = mbedtls_ssl_read(ssl, &c, 1);
+	int ret;
+	do {
+		ret = mbedtls_ssl_read(ssl, &c, 1);
+	} while( is_new_ticket(ret) );
 	if( ret != 1 )
 		return ssl_block_error(ret);
 	return c;
 }
 
 HL_PRIM int HL_NAME(ssl_recv)(mbedtls_ssl_context *ssl, vbyte *buf, int pos, int len) {
-	int ret = mbedtls_ssl_read(ssl, (unsigned char*)buf+pos, len);
+	int ret;
+	do {
+		ret = mbedtls_ssl_read(ssl, (unsigned char*)buf+pos, len);
+	} while( is_new_ticket(ret) );
 	if( ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY )
 		return 0;
 	if( ret < 0 )
@@ -305,6 +529,149 @@ DEFINE_PRIM(_VOID, conf_set_verify, TCONF _I32);
 DEFINE_PRIM(_VOID, conf_set_cert, TCONF TCERT TPKEY);
 DEFINE_PRIM(_VOID, conf_set_servername_callback, TCONF _FUN(_OBJ(TCERT TPKEY), _BYTES));
 
+/*
+	Session resumption. On the server, TLS 1.2 sessions can be kept in a cache indexed
+	by session id, while tickets (the only way to resume TLS 1.3) let the client keep
+	the encrypted session state. Ticket keys are rotated every lifetime seconds, the
+	previous key is kept so tickets issued just before remain valid.
+	The cache and ticket objects must be kept alive as long as the config uses them.
+*/
+
+HL_PRIM hl_ssl_cache *HL_NAME(cache_new)(int max_entries, int timeout) {
+#ifdef MBEDTLS_SSL_CACHE_C
+	hl_ssl_cache *cache;
+	mbedtls_ssl_cache_context *c = (mbedtls_ssl_cache_context*)malloc(sizeof(mbedtls_ssl_cache_context));
+	mbedtls_ssl_cache_init(c);
+	if( max_entries > 0 ) mbedtls_ssl_cache_set_max_entries(c, max_entries);
+	if( timeout >= 0 ) mbedtls_ssl_cache_set_timeout(c, timeout);
+	cache = (hl_ssl_cache*)hl_gc_alloc_finalizer(sizeof(hl_ssl_cache));
+	cache->c = c;
+	cache->finalize = cache_finalize;
+	return cache;
+#else
+	hl_error("Session cache is not supported");
+	return NULL;
+#endif
+}
+
+HL_PRIM void HL_NAME(conf_set_session_cache)(mbedtls_ssl_config *conf, hl_ssl_cache *cache) {
+#ifdef MBEDTLS_SSL_CACHE_C
+	if( cache == NULL )
+		mbedtls_ssl_conf_session_cache(conf, NULL, NULL, NULL);
+	else
+		mbedtls_ssl_conf_session_cache(conf, cache->c, mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+#endif
+}
+
+HL_PRIM hl_ssl_ticket *HL_NAME(ticket_new)(int lifetime) {
+#ifdef MBEDTLS_SSL_TICKET_C
+	int r;
+	hl_ssl_ticket *ticket;
+	mbedtls_ssl_ticket_context *t = (mbedtls_ssl_ticket_context*)malloc(sizeof(mbedtls_ssl_ticket_context));
+	mbedtls_ssl_ticket_init(t);
+	if ((r = mbedtls_ssl_ticket_setup(t, mbedtls_ctr_drbg_random, &ctr_drbg, MBEDTLS_CIPHER_AES_256_GCM, (uint32_t)lifetime)) != 0) {
+		mbedtls_ssl_ticket_free(t);
+		free(t);
+		ssl_error(r);
+		return NULL;
+	}
+	ticket = (hl_ssl_ticket*)hl_gc_alloc_finalizer(sizeof(hl_ssl_ticket));
+	ticket->t = t;
+	ticket->finalize = ticket_finalize;
+	return ticket;
+#else
+	hl_error("Session tickets are not supported");
+	return NULL;
+#endif
+}
+
+/*
+	Replace the current ticket key by an externally provided one, for instance to share
+	keys between several servers. The name is 4 bytes, the key 32 bytes.
+*/
+HL_PRIM void HL_NAME(ticket_rotate)(hl_ssl_ticket *ticket, vbyte *name, vbyte *key, int klen, int lifetime) {
+#if defined(MBEDTLS_SSL_TICKET_C) && MBEDTLS_VERSION_NUMBER >= 0x03020000
+	int r;
+	if ((r = mbedtls_ssl_ticket_rotate(ticket->t, (const unsigned char*)name, MBEDTLS_SSL_TICKET_KEY_NAME_BYTES, (const unsigned char*)key, klen, (uint32_t)lifetime)) != 0)
+		ssl_error(r);
+#else
+	hl_error("Ticket rotation is not supported");
+#endif
+}
+
+HL_PRIM void HL_NAME(conf_set_ticket_keys)(mbedtls_ssl_config *conf, hl_ssl_ticket *ticket) {
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_TICKET_C)
+	if( ticket == NULL )
+		mbedtls_ssl_conf_session_tickets_cb(conf, NULL, NULL, NULL);
+	else
+		mbedtls_ssl_conf_session_tickets_cb(conf, mbedtls_ssl_ticket_write, mbedtls_ssl_ticket_parse, ticket->t);
+#endif
+}
+
+HL_PRIM void HL_NAME(conf_set_session_tickets)(mbedtls_ssl_config *conf, bool enable) {
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+	mbedtls_ssl_conf_session_tickets(conf, enable ? MBEDTLS_SSL_SESSION_TICKETS_ENABLED : MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+#	if defined(MBEDTLS_SSL_PROTO_TLS1_3) && MBEDTLS_VERSION_NUMBER >= 0x03060100
+	mbedtls_ssl_conf_tls13_enable_signal_new_session_tickets(conf, enable ? MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED : MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_DISABLED);
+#	endif
+#endif
+}
+
+/*
+	Client side : export the current session so a later connection to the same server
+	can resume it. Returns null if there is nothing to export (each session can only be
+	exported once).
+*/
+HL_PRIM vbyte *HL_NAME(ssl_get_session)(mbedtls_ssl_context *ssl, int *size) {
+	int r;
+	size_t len = 0;
+	vbyte *out = NULL;
+	mbedtls_ssl_session s;
+	mbedtls_ssl_session_init(&s);
+	if( mbedtls_ssl_get_session(ssl, &s) == 0 ) {
+		mbedtls_ssl_session_save(&s, NULL, 0, &len);
+		out = hl_gc_alloc_noptr((int)len);
+		if ((r = mbedtls_ssl_session_save(&s, (unsigned char*)out, len, &len)) != 0) {
+			mbedtls_ssl_session_free(&s);
+			ssl_error(r);
+			return NULL;
+		}
+		*size = (int)len;
+	}
+	mbedtls_ssl_session_free(&s);
+	return out;
+}
+
+/*
+	Must be called before the handshake. Returns false if the data could not be
+	loaded (corrupted, or saved by an incompatible version) : a full handshake will occur.
+*/
+HL_PRIM bool HL_NAME(ssl_set_session)(mbedtls_ssl_context *ssl, vbyte *data, int len) {
+	int r;
+	mbedtls_ssl_session s;
+	mbedtls_ssl_session_init(&s);
+	if( mbedtls_ssl_session_load(&s, (const unsigned char*)data, len) != 0 ) {
+		mbedtls_ssl_session_free(&s);
+		return false;
+	}
+	r = mbedtls_ssl_set_session(ssl, &s);
+	mbedtls_ssl_session_free(&s);
+	if( r != 0 ) {
+		ssl_error(r);
+		return false;
+	}
+	return true;
+}
+
+DEFINE_PRIM(TCACHE, cache_new, _I32 _I32);
+DEFINE_PRIM(_VOID, conf_set_session_cache, TCONF TCACHE);
+DEFINE_PRIM(TTICKET, ticket_new, _I32);
+DEFINE_PRIM(_VOID, ticket_rotate, TTICKET _BYTES _BYTES _I32 _I32);
+DEFINE_PRIM(_VOID, conf_set_ticket_keys, TCONF TTICKET);
+DEFINE_PRIM(_VOID, conf_set_session_tickets, TCONF _BOOL);
+DEFINE_PRIM(_BYTES, ssl_get_session, TSSL _REF(_I32));
+DEFINE_PRIM(_BOOL, ssl_set_session, TSSL _BYTES _I32);
+
 HL_PRIM hl_ssl_cert *HL_NAME(cert_load_file)(vbyte *file) {
 #ifdef HL_CONSOLE
 	return NULL;
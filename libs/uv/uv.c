@@ -2,6 +2,7 @@
 #ifdef _WIN32
 #	include <uv.h>
 #	include <hl.h>
+#	include <fcntl.h>
 #else
 #	include <hl.h>
 #	include <uv.h>
@@ -22,18 +23,31 @@ typedef struct sockaddr uv_sockaddr;
 #define EVT_CONNECT	0	// connect_t
 
 #define EVT_FS	0
+#define EVT_TIMER	0
+#define EVT_WATCHER	0	// idle, check, prepare
+#define EVT_ASYNC	0
+
+#define EVT_WORK	0	// work_t
+#define EVT_AFTER_WORK	2	// work_t
+
+#define EVT_FS_REQ	0	// fs_t
 
 #define EVT_MAX		2
 
 typedef struct {
 	vclosure *events[EVT_MAX + 1];
 	void *write_data;
+	void *borrowed;
+	vdynamic *result;
+	void *work;
+	bool failed;
 } events_data;
 
 #define UV_DATA(h)		((events_data*)((h)->data))
 
 #define _LOOP	_ABSTRACT(uv_loop)
 #define _HANDLE _ABSTRACT(uv_handle)
+#define _WORK	_ABSTRACT(uv_work)
 #define _CALLB	_FUN(_VOID,_NO_ARG)
 #define UV_ALLOC(t)		((t*)malloc(sizeof(t)))
 
@@ -58,10 +72,23 @@ static void clear_callb( uv_handle_t *h, int event_kind ) {
 
 static void trigger_callb( uv_handle_t *h, int event_kind, vdynamic **args, int nargs, bool repeat ) {
 	events_data *ev = UV_DATA(h);
-	vclosure *c = ev ? ev->events[event_kind] : NULL;
-	if( !c ) return;
-	if( !repeat ) ev->events[event_kind] = NULL;
-	hl_dyn_call(c, args, nargs);
+	vclosure *c;
+	hl_thread_info *t;
+	bool blocking;
+	if( !ev || !ev->events[event_kind] ) return;
+	/*
+		back to the VM if we are called from a blocking uv_run, before taking
+		the closure : the GC does not scan this frame while we are blocking
+	*/
+	t = hl_get_thread();
+	blocking = t && t->gc_blocking;
+	if( blocking ) hl_blocking(false);
+	c = ev->events[event_kind];
+	if( c ) {
+		if( !repeat ) ev->events[event_kind] = NULL;
+		hl_dyn_call(c, args, nargs);
+	}
+	if( blocking ) hl_blocking(true);
 }
 
 static void on_close( uv_handle_t *h ) {
@@ -85,6 +112,67 @@ HL_PRIM void HL_NAME(close_handle)( uv_handle_t *h, vclosure *c ) {
 
 DEFINE_PRIM(_VOID, close_handle, _HANDLE _CALLB);
 
+// POOLS
+
+/*
+	Read buffers and write requests are recycled through a per loop pool kept
+	in loop->data, so the loop thread never contends for it. Pooled write
+	requests keep their rooted events_data between uses.
+*/
+
+#define POOL_BLOCK	65536
+#define POOL_MAX	64
+
+typedef struct {
+	char *blocks[POOL_MAX];
+	int nblocks;
+	uv_write_t *writes[POOL_MAX];
+	int nwrites;
+} loop_pool;
+
+static loop_pool *get_pool( uv_loop_t *loop ) {
+	loop_pool *p = (loop_pool*)loop->data;
+	if( !p ) {
+		p = UV_ALLOC(loop_pool);
+		memset(p,0,sizeof(loop_pool));
+		loop->data = p;
+	}
+	return p;
+}
+
+static void free_pool( uv_loop_t *loop ) {
+	loop_pool *p = (loop_pool*)loop->data;
+	if( !p ) return;
+	while( p->nblocks )
+		free(p->blocks[--p->nblocks]);
+	while( p->nwrites )
+		on_close((uv_handle_t*)p->writes[--p->nwrites]);
+	free(p);
+	loop->data = NULL;
+}
+
+static uv_write_t *alloc_write( loop_pool *p ) {
+	uv_write_t *wr;
+	if( p->nwrites )
+		return p->writes[--p->nwrites];
+	wr = UV_ALLOC(uv_write_t);
+	init_hl_data((uv_handle_t*)wr);
+	return wr;
+}
+
+static void release_write( loop_pool *p, uv_write_t *wr ) {
+	events_data *d = UV_DATA(wr);
+	if( p->nwrites == POOL_MAX ) {
+		on_close((uv_handle_t*)wr);
+		return;
+	}
+	free(d->write_data);
+	d->write_data = NULL;
+	d->borrowed = NULL;
+	d->events[EVT_WRITE] = NULL;
+	p->writes[p->nwrites++] = wr;
+}
+
 // STREAM
 
 static void on_write( uv_write_t *wr, int status ) {
@@ -93,34 +181,107 @@ static void on_write( uv_write_t *wr, int status ) {
 	b.t = &hlt_bool;
 	b.v.b = status == 0;
 	trigger_callb((uv_handle_t*)wr,EVT_WRITE,&args,1,false);
-	on_close((uv_handle_t*)wr);
+	release_write(get_pool(wr->handle->loop),wr);
 }
 
-HL_PRIM bool HL_NAME(stream_write)( uv_stream_t *s, vbyte *b, int size, vclosure *c ) {
-	uv_write_t *wr = UV_ALLOC(uv_write_t);
-	events_data *d = init_hl_data((uv_handle_t*)wr);
-	// keep a copy of the data
-	uv_buf_t buf;
-	d->write_data = malloc(size);
-	memcpy(d->write_data,b,size);
-	buf.base = d->write_data;
-	buf.len = size;
+/*
+	Writes as much as possible right away with uv_try_write and only queues
+	the rest. The remaining data is either copied or borrowed : a borrowed
+	buffer is kept alive by the request and must not be modified before the
+	callback is called.
+*/
+static bool queue_write( uv_stream_t *s, uv_buf_t *bufs, int nbufs, void *borrowed, vclosure *c ) {
+	loop_pool *p = get_pool(s->loop);
+	uv_write_t *wr;
+	events_data *d;
+	uv_buf_t empty;
+	int n = uv_try_write(s,bufs,nbufs);
+	if( n > 0 ) {
+		while( nbufs && (size_t)n >= bufs->len ) {
+			n -= (int)bufs->len;
+			bufs++;
+			nbufs--;
+		}
+		if( nbufs ) {
+			bufs->base += n;
+			bufs->len -= n;
+		} else {
+			// everything was sent : still go through the loop for the callback
+			empty = uv_buf_init(NULL,0);
+			bufs = &empty;
+			nbufs = 1;
+		}
+	}
+	wr = alloc_write(p);
+	d = UV_DATA(wr);
+	if( borrowed )
+		d->borrowed = borrowed;
+	else if( bufs->len ) {
+		// keep a copy of the data
+		d->write_data = malloc(bufs->len);
+		memcpy(d->write_data,bufs->base,bufs->len);
+		bufs->base = d->write_data;
+	}
 	register_callb((uv_handle_t*)wr,c,EVT_WRITE);
-	if( uv_write(wr,s,&buf,1,on_write) < 0 ) {
-		on_close((uv_handle_t*)wr);
+	if( uv_write(wr,s,bufs,nbufs,on_write) < 0 ) {
+		release_write(p,wr);
 		return false;
 	}
 	return true;
 }
 
+HL_PRIM bool HL_NAME(stream_write)( uv_stream_t *s, vbyte *b, int size, vclosure *c ) {
+	uv_buf_t buf = uv_buf_init((char*)b,size);
+	return queue_write(s,&buf,1,NULL,c);
+}
+
+HL_PRIM bool HL_NAME(stream_write_borrow)( uv_stream_t *s, vbyte *b, int pos, int size, vclosure *c ) {
+	uv_buf_t buf = uv_buf_init((char*)b + pos,size);
+	return queue_write(s,&buf,1,b,c);
+}
+
+#define WRITE_VEC_MAX	64
+
+/*
+	Borrows every bytes of the array, ranges holding a (pos,len) pair of
+	ints for each of them. Up to WRITE_VEC_MAX buffers are described on the
+	stack, larger counts use a temporary heap array (uv_write copies it).
+*/
+HL_PRIM bool HL_NAME(stream_write_vec)( uv_stream_t *s, varray *a, vbyte *ranges, int count, vclosure *c ) {
+	uv_buf_t tmp[WRITE_VEC_MAX];
+	uv_buf_t *bufs = tmp;
+	int *r = (int*)ranges;
+	int i;
+	bool ret;
+	if( count <= 0 || count > a->size ) return false;
+	if( count > WRITE_VEC_MAX ) {
+		bufs = (uv_buf_t*)malloc(sizeof(uv_buf_t) * count);
+		if( bufs == NULL ) hl_error("Out of memory");
+	}
+	for(i=0;i<count;i++)
+		bufs[i] = uv_buf_init((char*)hl_aptr(a,vbyte*)[i] + r[i<<1],r[(i<<1)+1]);
+	ret = queue_write(s,bufs,count,a,c);
+	if( bufs != tmp ) free(bufs);
+	return ret;
+}
+
+// returns the number of bytes written, or a negative error code (UV_EAGAIN if nothing could be written)
+HL_PRIM int HL_NAME(stream_try_write)( uv_stream_t *s, vbyte *b, int pos, int size ) {
+	uv_buf_t buf = uv_buf_init((char*)b + pos,size);
+	return uv_try_write(s,&buf,1);
+}
+
 static void on_alloc( uv_handle_t* h, size_t size, uv_buf_t *buf ) {
-	*buf = uv_buf_init(malloc(size), (int)size);
+	loop_pool *p = get_pool(h->loop);
+	char *b = p->nblocks ? p->blocks[--p->nblocks] : (char*)malloc(POOL_BLOCK);
+	*buf = uv_buf_init(b, POOL_BLOCK);
 }
 
 static void on_read( uv_stream_t *s, ssize_t nread, const uv_buf_t *buf ) {
 	vdynamic bytes;
 	vdynamic len;
 	vdynamic *args[2];
+	loop_pool *p;
 	bytes.t = &hlt_bytes;
 	bytes.v.ptr = buf->base;
 	len.t = &hlt_i32;
@@ -128,7 +289,13 @@ static void on_read( uv_stream_t *s, ssize_t nread, const uv_buf_t *buf ) {
 	args[0] = &bytes;
 	args[1] = &len;
 	trigger_callb((uv_handle_t*)s,EVT_READ,args,2,true);
-	free(buf->base);
+	// the bytes are only valid during the callback
+	if( !buf->base ) return;
+	p = get_pool(s->loop);
+	if( p->nblocks < POOL_MAX )
+		p->blocks[p->nblocks++] = buf->base;
+	else
+		free(buf->base);
 }
 
 HL_PRIM bool HL_NAME(stream_read_start)( uv_stream_t *s, vclosure *c ) {
@@ -151,6 +318,9 @@ HL_PRIM bool HL_NAME(stream_listen)( uv_stream_t *s, int count, vclosure *c ) {
 }
 
 DEFINE_PRIM(_BOOL, stream_write, _HANDLE _BYTES _I32 _FUN(_VOID,_BOOL));
+DEFINE_PRIM(_BOOL, stream_write_borrow, _HANDLE _BYTES _I32 _I32 _FUN(_VOID,_BOOL));
+DEFINE_PRIM(_BOOL, stream_write_vec, _HANDLE _ARR _BYTES _I32 _FUN(_VOID,_BOOL));
+DEFINE_PRIM(_I32, stream_try_write, _HANDLE _BYTES _I32 _I32);
 DEFINE_PRIM(_BOOL, stream_read_start, _HANDLE _FUN(_VOID,_BYTES _I32));
 DEFINE_PRIM(_VOID, stream_read_stop, _HANDLE);
 DEFINE_PRIM(_BOOL, stream_listen, _HANDLE _I32 _CALLB);
@@ -268,6 +438,434 @@ DEFINE_PRIM(_VOID, tcp_nodelay_wrap, _TCP _BOOL);
 DEFINE_PRIM(_FS, fs_start_wrap, _LOOP _FUN(_VOID, _I32) _BYTES);
 DEFINE_PRIM(_BOOL, fs_stop_wrap, _FS);
 
+// TIMER
+
+#define _TIMER _HANDLE
+
+static void on_timer( uv_timer_t *t ) {
+	trigger_callb((uv_handle_t*)t, EVT_TIMER, NULL, 0, true);
+}
+
+HL_PRIM uv_timer_t *HL_NAME(timer_init_wrap)( uv_loop_t *loop ) {
+	uv_timer_t *t = UV_ALLOC(uv_timer_t);
+	if( uv_timer_init(loop,t) < 0 ) {
+		free(t);
+		return NULL;
+	}
+	init_hl_data((uv_handle_t*)t);
+	return t;
+}
+
+HL_PRIM bool HL_NAME(timer_start_wrap)( uv_timer_t *t, vclosure *c, int timeout, int repeat ) {
+	register_callb((uv_handle_t*)t,c,EVT_TIMER);
+	return uv_timer_start(t,on_timer,(uint64_t)timeout,(uint64_t)repeat) >= 0;
+}
+
+HL_PRIM bool HL_NAME(timer_stop_wrap)( uv_timer_t *t ) {
+	clear_callb((uv_handle_t*)t,EVT_TIMER);
+	return uv_timer_stop(t) >= 0;
+}
+
+HL_PRIM bool HL_NAME(timer_again_wrap)( uv_timer_t *t ) {
+	return uv_timer_again(t) >= 0;
+}
+
+HL_PRIM void HL_NAME(timer_set_repeat_wrap)( uv_timer_t *t, int repeat ) {
+	uv_timer_set_repeat(t,(uint64_t)repeat);
+}
+
+DEFINE_PRIM(_TIMER, timer_init_wrap, _LOOP);
+DEFINE_PRIM(_BOOL, timer_start_wrap, _TIMER _CALLB _I32 _I32);
+DEFINE_PRIM(_BOOL, timer_stop_wrap, _TIMER);
+DEFINE_PRIM(_BOOL, timer_again_wrap, _TIMER);
+DEFINE_PRIM(_VOID, timer_set_repeat_wrap, _TIMER _I32);
+
+// IDLE / CHECK / PREPARE
+
+#define LOOP_WATCHER(name) \
+	static void on_##name( uv_##name##_t *h ) { \
+		trigger_callb((uv_handle_t*)h, EVT_WATCHER, NULL, 0, true); \
+	} \
+	HL_PRIM uv_##name##_t *HL_NAME(name##_init_wrap)( uv_loop_t *loop ) { \
+		uv_##name##_t *h = UV_ALLOC(uv_##name##_t); \
+		if( uv_##name##_init(loop,h) < 0 ) { \
+			free(h); \
+			return NULL; \
+		} \
+		init_hl_data((uv_handle_t*)h); \
+		return h; \
+	} \
+	HL_PRIM bool HL_NAME(name##_start_wrap)( uv_##name##_t *h, vclosure *c ) { \
+		register_callb((uv_handle_t*)h,c,EVT_WATCHER); \
+		return uv_##name##_start(h,on_##name) >= 0; \
+	} \
+	HL_PRIM bool HL_NAME(name##_stop_wrap)( uv_##name##_t *h ) { \
+		clear_callb((uv_handle_t*)h,EVT_WATCHER); \
+		return uv_##name##_stop(h) >= 0; \
+	} \
+	DEFINE_PRIM(_HANDLE, name##_init_wrap, _LOOP); \
+	DEFINE_PRIM(_BOOL, name##_start_wrap, _HANDLE _CALLB); \
+	DEFINE_PRIM(_BOOL, name##_stop_wrap, _HANDLE);
+
+LOOP_WATCHER(idle);
+LOOP_WATCHER(check);
+LOOP_WATCHER(prepare);
+
+// ASYNC
+
+#define _ASYNC _HANDLE
+
+static void on_async( uv_async_t *a ) {
+	trigger_callb((uv_handle_t*)a, EVT_ASYNC, NULL, 0, true);
+}
+
+HL_PRIM uv_async_t *HL_NAME(async_init_wrap)( uv_loop_t *loop, vclosure *c ) {
+	uv_async_t *a = UV_ALLOC(uv_async_t);
+	if( uv_async_init(loop,a,on_async) < 0 ) {
+		free(a);
+		return NULL;
+	}
+	init_hl_data((uv_handle_t*)a);
+	register_callb((uv_handle_t*)a,c,EVT_ASYNC);
+	return a;
+}
+
+// can be called from any thread, several sends before the callback runs are coalesced
+HL_PRIM bool HL_NAME(async_send_wrap)( uv_async_t *a ) {
+	return uv_async_send(a) >= 0;
+}
+
+DEFINE_PRIM(_ASYNC, async_init_wrap, _LOOP _CALLB);
+DEFINE_PRIM(_BOOL, async_send_wrap, _ASYNC);
+
+// WORK
+
+/*
+	The work closure runs in the libuv threadpool. The worker thread is
+	registered to the GC for the duration of the call only : an idle pool
+	thread must not hold back collections. The after closure then runs on the
+	loop thread with the work result, or the exception and false on failure.
+*/
+
+static void on_work( uv_work_t *w ) {
+	events_data *ev = UV_DATA(w);
+	bool isExc = false;
+	bool reg = hl_get_thread() == NULL;
+	if( reg ) hl_register_thread(&reg);
+	ev->result = hl_dyn_call_safe(ev->events[EVT_WORK],NULL,0,&isExc);
+	ev->events[EVT_WORK] = NULL;
+	ev->failed = isExc;
+	if( reg ) hl_unregister_thread();
+}
+
+// the uv_work_t is freed once after has run, the handle given to HL outlives it
+typedef struct {
+	uv_work_t *w;
+} work_handle;
+
+static void on_after_work( uv_work_t *w, int status ) {
+	events_data *ev = UV_DATA(w);
+	vdynamic b;
+	vdynamic *args[2];
+	((work_handle*)ev->work)->w = NULL;
+	b.t = &hlt_bool;
+	b.v.b = status == 0 && !ev->failed;
+	args[0] = ev->result;
+	args[1] = &b;
+	trigger_callb((uv_handle_t*)w,EVT_AFTER_WORK,args,2,false);
+	on_close((uv_handle_t*)w);
+}
+
+HL_PRIM work_handle *HL_NAME(queue_work_wrap)( uv_loop_t *loop, vclosure *work, vclosure *after ) {
+	work_handle *h = (work_handle*)hl_gc_alloc_noptr(sizeof(work_handle));
+	uv_work_t *w = UV_ALLOC(uv_work_t);
+	events_data *ev = init_hl_data((uv_handle_t*)w);
+	ev->work = h;
+	h->w = w;
+	register_callb((uv_handle_t*)w,work,EVT_WORK);
+	register_callb((uv_handle_t*)w,after,EVT_AFTER_WORK);
+	if( uv_queue_work(loop,w,on_work,on_after_work) < 0 ) {
+		on_close((uv_handle_t*)w);
+		return NULL;
+	}
+	return h;
+}
+
+// only succeeds if the work has not started yet, after is then called with false
+HL_PRIM bool HL_NAME(cancel_work_wrap)( work_handle *h ) {
+	if( !h->w ) return false;
+	return uv_cancel((uv_req_t*)h->w) == 0;
+}
+
+DEFINE_PRIM(_WORK, queue_work_wrap, _LOOP _FUN(_DYN,_NO_ARG) _FUN(_VOID,_DYN _BOOL));
+DEFINE_PRIM(_BOOL, cancel_work_wrap, _WORK);
+
+// UDP
+
+#define _UDP _HANDLE
+
+#if UV_VERSION_MAJOR > 1 || UV_VERSION_MINOR >= 40
+#	define UDP_MMSG
+#endif
+
+// room for several datagrams so that recvmmsg can fill them in one call
+#define UDP_BUFFER	(20 * 65536)
+
+static void on_udp_alloc( uv_handle_t *h, size_t size, uv_buf_t *buf ) {
+	// one buffer per handle, reused : data is only valid during the callback
+	events_data *ev = UV_DATA(h);
+	if( !ev->write_data ) ev->write_data = malloc(UDP_BUFFER);
+	*buf = uv_buf_init(ev->write_data, UDP_BUFFER);
+}
+
+static void on_udp_recv( uv_udp_t *u, ssize_t nread, const uv_buf_t *buf, const uv_sockaddr *addr, unsigned flags ) {
+	vdynamic bytes, len, host, port;
+	vdynamic *args[4];
+#	ifdef UDP_MMSG
+	if( flags & UV_UDP_MMSG_FREE ) return;
+#	endif
+	// nothing more to read
+	if( nread == 0 && addr == NULL ) return;
+	bytes.t = &hlt_bytes;
+	bytes.v.ptr = buf->base;
+	len.t = &hlt_i32;
+	len.v.i = (int)nread;
+	host.t = &hlt_i32;
+	host.v.i = addr ? *(int*)&((struct sockaddr_in*)addr)->sin_addr : 0;
+	port.t = &hlt_i32;
+	port.v.i = addr ? ntohs(((struct sockaddr_in*)addr)->sin_port) : 0;
+	args[0] = &bytes;
+	args[1] = &len;
+	args[2] = &host;
+	args[3] = &port;
+	trigger_callb((uv_handle_t*)u,EVT_READ,args,4,true);
+}
+
+HL_PRIM uv_udp_t *HL_NAME(udp_init_wrap)( uv_loop_t *loop ) {
+	uv_udp_t *u = UV_ALLOC(uv_udp_t);
+#	ifdef UDP_MMSG
+	int r = uv_udp_init_ex(loop,u,AF_INET | UV_UDP_RECVMMSG);
+#	else
+	int r = uv_udp_init(loop,u);
+#	endif
+	if( r < 0 ) {
+		free(u);
+		return NULL;
+	}
+	init_hl_data((uv_handle_t*)u);
+	return u;
+}
+
+HL_PRIM bool HL_NAME(udp_bind_wrap)( uv_udp_t *u, int host, int port ) {
+	struct sockaddr_in addr;
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	*(int*)&addr.sin_addr.s_addr = host;
+	return uv_udp_bind(u,(uv_sockaddr *)&addr,0) >= 0;
+}
+
+HL_PRIM bool HL_NAME(udp_recv_start_wrap)( uv_udp_t *u, vclosure *c ) {
+	register_callb((uv_handle_t*)u,c,EVT_READ);
+	return uv_udp_recv_start(u,on_udp_alloc,on_udp_recv) >= 0;
+}
+
+HL_PRIM bool HL_NAME(udp_recv_stop_wrap)( uv_udp_t *u ) {
+	clear_callb((uv_handle_t*)u,EVT_READ);
+	return uv_udp_recv_stop(u) >= 0;
+}
+
+static void on_udp_send( uv_udp_send_t *req, int status ) {
+	vdynamic b;
+	vdynamic *args = &b;
+	b.t = &hlt_bool;
+	b.v.b = status == 0;
+	trigger_callb((uv_handle_t*)req,EVT_WRITE,&args,1,false);
+	on_close((uv_handle_t*)req);
+}
+
+// returns the number of bytes sent, or a negative error code (UV_EAGAIN if it would need queueing)
+HL_PRIM int HL_NAME(udp_try_send_wrap)( uv_udp_t *u, vbyte *b, int pos, int len, int host, int port ) {
+	struct sockaddr_in addr;
+	uv_buf_t buf = uv_buf_init((char*)b + pos,len);
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	*(int*)&addr.sin_addr.s_addr = host;
+	return uv_udp_try_send(u,&buf,1,(uv_sockaddr *)&addr);
+}
+
+HL_PRIM bool HL_NAME(udp_send_wrap)( uv_udp_t *u, vbyte *b, int pos, int len, int host, int port, vclosure *c ) {
+	uv_udp_send_t *req = UV_ALLOC(uv_udp_send_t);
+	events_data *d = init_hl_data((uv_handle_t*)req);
+	struct sockaddr_in addr;
+	uv_buf_t buf;
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	*(int*)&addr.sin_addr.s_addr = host;
+	// keep a copy of the data
+	d->write_data = malloc(len);
+	memcpy(d->write_data,b + pos,len);
+	buf = uv_buf_init(d->write_data,len);
+	register_callb((uv_handle_t*)req,c,EVT_WRITE);
+	if( uv_udp_send(req,u,&buf,1,(uv_sockaddr *)&addr,on_udp_send) < 0 ) {
+		on_close((uv_handle_t*)req);
+		return false;
+	}
+	return true;
+}
+
+DEFINE_PRIM(_UDP, udp_init_wrap, _LOOP);
+DEFINE_PRIM(_BOOL, udp_bind_wrap, _UDP _I32 _I32);
+DEFINE_PRIM(_BOOL, udp_recv_start_wrap, _UDP _FUN(_VOID,_BYTES _I32 _I32 _I32));
+DEFINE_PRIM(_BOOL, udp_recv_stop_wrap, _UDP);
+DEFINE_PRIM(_I32, udp_try_send_wrap, _UDP _BYTES _I32 _I32 _I32 _I32);
+DEFINE_PRIM(_BOOL, udp_send_wrap, _UDP _BYTES _I32 _I32 _I32 _I32 _FUN(_VOID,_BOOL));
+
+// FS REQUESTS
+
+/*
+	Asynchronous file operations, completed through the loop. The callback
+	receives the libuv result : a file descriptor, a number of bytes or a
+	negative error code. Buffers given to read/write are borrowed and must
+	not be modified before the callback is called. An offset of -1 uses the
+	current file position.
+*/
+
+#define FS_READ		1
+#define FS_WRITE	2
+#define FS_CREATE	4
+#define FS_TRUNC	8
+#define FS_APPEND	16
+#define FS_EXCL		32
+
+#define _FS_CALLB _FUN(_VOID,_I32)
+#define _STAT_CALLB _FUN(_VOID,_I32 _F64 _F64 _I32)
+
+static uv_fs_t *alloc_fs( vclosure *c, void *borrowed ) {
+	uv_fs_t *req = UV_ALLOC(uv_fs_t);
+	events_data *d = init_hl_data((uv_handle_t*)req);
+	d->borrowed = borrowed;
+	register_callb((uv_handle_t*)req,c,EVT_FS_REQ);
+	return req;
+}
+
+static void on_fs( uv_fs_t *req ) {
+	vdynamic r;
+	vdynamic *args = &r;
+	r.t = &hlt_i32;
+	r.v.i = (int)req->result;
+	uv_fs_req_cleanup(req);
+	trigger_callb((uv_handle_t*)req,EVT_FS_REQ,&args,1,false);
+	on_close((uv_handle_t*)req);
+}
+
+static void on_fs_stat( uv_fs_t *req ) {
+	vdynamic r, size, mtime, mode;
+	vdynamic *args[4];
+	bool ok = req->result >= 0;
+	r.t = &hlt_i32;
+	r.v.i = (int)req->result;
+	size.t = &hlt_f64;
+	size.v.d = ok ? (double)req->statbuf.st_size : 0.;
+	mtime.t = &hlt_f64;
+	mtime.v.d = ok ? (double)req->statbuf.st_mtim.tv_sec + req->statbuf.st_mtim.tv_nsec / 1e9 : 0.;
+	mode.t = &hlt_i32;
+	mode.v.i = ok ? (int)req->statbuf.st_mode : 0;
+	args[0] = &r;
+	args[1] = &size;
+	args[2] = &mtime;
+	args[3] = &mode;
+	uv_fs_req_cleanup(req);
+	trigger_callb((uv_handle_t*)req,EVT_FS_REQ,args,4,false);
+	on_close((uv_handle_t*)req);
+}
+
+static bool fs_result( uv_fs_t *req, int r ) {
+	if( r < 0 ) {
+		uv_fs_req_cleanup(req);
+		on_close((uv_handle_t*)req);
+		return false;
+	}
+	return true;
+}
+
+HL_PRIM bool HL_NAME(fs_open_wrap)( uv_loop_t *loop, vbyte *path, int flags, int mode, vclosure *c ) {
+	uv_fs_t *req = alloc_fs(c,NULL);
+	int f = 0;
+	if( (flags & FS_READ) && (flags & FS_WRITE) ) f |= O_RDWR; else if( flags & FS_WRITE ) f |= O_WRONLY; else f |= O_RDONLY;
+	if( flags & FS_CREATE ) f |= O_CREAT;
+	if( flags & FS_TRUNC ) f |= O_TRUNC;
+	if( flags & FS_APPEND ) f |= O_APPEND;
+	if( flags & FS_EXCL ) f |= O_EXCL;
+	return fs_result(req,uv_fs_open(loop,req,(char*)path,f,mode,on_fs));
+}
+
+HL_PRIM bool HL_NAME(fs_close_wrap)( uv_loop_t *loop, int fd, vclosure *c ) {
+	uv_fs_t *req = alloc_fs(c,NULL);
+	return fs_result(req,uv_fs_close(loop,req,fd,on_fs));
+}
+
+HL_PRIM bool HL_NAME(fs_read_wrap)( uv_loop_t *loop, int fd, vbyte *b, int pos, int len, double offset, vclosure *c ) {
+	uv_fs_t *req = alloc_fs(c,b);
+	uv_buf_t buf = uv_buf_init((char*)b + pos,len);
+	return fs_result(req,uv_fs_read(loop,req,fd,&buf,1,(int64_t)offset,on_fs));
+}
+
+HL_PRIM bool HL_NAME(fs_write_wrap)( uv_loop_t *loop, int fd, vbyte *b, int pos, int len, double offset, vclosure *c ) {
+	uv_fs_t *req = alloc_fs(c,b);
+	uv_buf_t buf = uv_buf_init((char*)b + pos,len);
+	return fs_result(req,uv_fs_write(loop,req,fd,&buf,1,(int64_t)offset,on_fs));
+}
+
+HL_PRIM bool HL_NAME(fs_fsync_wrap)( uv_loop_t *loop, int fd, bool datasync, vclosure *c ) {
+	uv_fs_t *req = alloc_fs(c,NULL);
+	return fs_result(req,datasync ? uv_fs_fdatasync(loop,req,fd,on_fs) : uv_fs_fsync(loop,req,fd,on_fs));
+}
+
+HL_PRIM bool HL_NAME(fs_stat_wrap)( uv_loop_t *loop, vbyte *path, vclosure *c ) {
+	uv_fs_t *req = alloc_fs(c,NULL);
+	return fs_result(req,uv_fs_stat(loop,req,(char*)path,on_fs_stat));
+}
+
+HL_PRIM bool HL_NAME(fs_fstat_wrap)( uv_loop_t *loop, int fd, vclosure *c ) {
+	uv_fs_t *req = alloc_fs(c,NULL);
+	return fs_result(req,uv_fs_fstat(loop,req,fd,on_fs_stat));
+}
+
+// out_fd is usually a socket, see handle_fileno_wrap
+HL_PRIM bool HL_NAME(fs_sendfile_wrap)( uv_loop_t *loop, int out_fd, int in_fd, double offset, int len, vclosure *c ) {
+	uv_fs_t *req = alloc_fs(c,NULL);
+	return fs_result(req,uv_fs_sendfile(loop,req,out_fd,in_fd,(int64_t)offset,(size_t)len,on_fs));
+}
+
+/*
+	Returns the fd of the handle for use with fs_sendfile, or -1 if unavailable.
+	The fd stays owned by the handle and must not be closed. Always -1 on Windows :
+	a CRT fd from _open_osfhandle would take ownership of the socket and leak a slot
+	on every call.
+*/
+HL_PRIM int HL_NAME(handle_fileno_wrap)( uv_handle_t *h ) {
+#	ifdef _WIN32
+	return -1;
+#	else
+	uv_os_fd_t fd;
+	if( uv_fileno(h,&fd) < 0 ) return -1;
+	return fd;
+#	endif
+}
+
+DEFINE_PRIM(_BOOL, fs_open_wrap, _LOOP _BYTES _I32 _I32 _FS_CALLB);
+DEFINE_PRIM(_BOOL, fs_close_wrap, _LOOP _I32 _FS_CALLB);
+DEFINE_PRIM(_BOOL, fs_read_wrap, _LOOP _I32 _BYTES _I32 _I32 _F64 _FS_CALLB);
+DEFINE_PRIM(_BOOL, fs_write_wrap, _LOOP _I32 _BYTES _I32 _I32 _F64 _FS_CALLB);
+DEFINE_PRIM(_BOOL, fs_fsync_wrap, _LOOP _I32 _BOOL _FS_CALLB);
+DEFINE_PRIM(_BOOL, fs_stat_wrap, _LOOP _BYTES _STAT_CALLB);
+DEFINE_PRIM(_BOOL, fs_fstat_wrap, _LOOP _I32 _STAT_CALLB);
+DEFINE_PRIM(_BOOL, fs_sendfile_wrap, _LOOP _I32 _I32 _F64 _I32 _FS_CALLB);
+DEFINE_PRIM(_I32, handle_fileno_wrap, _HANDLE);
+
 // loop
 
 HL_PRIM uv_loop_t *HL_NAME(create_loop)() {
@@ -288,11 +886,18 @@ HL_PRIM uv_loop_t* HL_NAME(default_loop_wrap)() {
 }
 
 HL_PRIM int HL_NAME(loop_close_wrap)(uv_loop_t* loop) {
-	return uv_loop_close(loop);
+	int r = uv_loop_close(loop);
+	if( r == 0 ) free_pool(loop);
+	return r;
 }
 
 HL_PRIM int HL_NAME(run_wrap)(uv_loop_t* loop, int mode) {
-	return uv_run(loop, (uv_run_mode)mode);
+	int r;
+	// let the GC run (threadpool work, other threads) while waiting for events
+	hl_blocking(true);
+	r = uv_run(loop, (uv_run_mode)mode);
+	hl_blocking(false);
+	return r;
 }
 
 HL_PRIM int HL_NAME(loop_alive_wrap)(uv_loop_t* loop) {
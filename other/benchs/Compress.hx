@@ -0,0 +1,44 @@
+
+@:result(87B38DB1)
+class Compress {
+
+	#if hl
+	@:hlNative("fmt","pdeflate_init") static function pdeflateInit( level : Int, threads : Int, blockSize : Int ) : hl.Abstract<"fmt_pzip"> { return null; }
+	@:hlNative("fmt","pdeflate_finish") static function pdeflateFinish( p : hl.Abstract<"fmt_pzip"> ) : Void {}
+	@:hlNative("fmt","pdeflate_buffer") static function pdeflateBuffer( p : hl.Abstract<"fmt_pzip">, src : hl.Bytes, srcPos : Int, srcLen : Int, dst : hl.Bytes, dstPos : Int, dstLen : Int, read : hl.Ref<Int>, write : hl.Ref<Int> ) : Bool { return false; }
+	@:hlNative("fmt","pdeflate_end") static function pdeflateEnd( p : hl.Abstract<"fmt_pzip"> ) : Void {}
+	#end
+
+	public static function main() {
+		var chunk = haxe.io.Bytes.alloc(1 << 20);
+		for( i in 0...chunk.length )
+			chunk.set(i, (i * 7 + (i >> 8)) & 0xFF);
+		var all = haxe.io.Bytes.alloc(chunk.length * 16);
+		for( k in 0...16 )
+			all.blit(k * chunk.length, chunk, 0, chunk.length);
+		#if hl
+		// gzip on all cores, then inflate it back
+		var p = pdeflateInit(6, 0, 0);
+		var out = new haxe.io.BytesBuffer();
+		var buf = haxe.io.Bytes.alloc(1 << 16);
+		var pos = 0, read = 0, write = 0;
+		pdeflateFinish(p);
+		while( true ) {
+			var done = pdeflateBuffer(p, all, pos, all.length, buf, 0, buf.length, read, write);
+			pos += read;
+			out.addBytes(buf, 0, write);
+			if( done ) break;
+		}
+		pdeflateEnd(p);
+		var gz = out.getBytes();
+		var u = new haxe.zip.Uncompress(31);
+		var back = haxe.io.Bytes.alloc(all.length);
+		var r = u.execute(gz, 0, back, 0);
+		u.close();
+		if( !r.done || r.write != all.length ) throw "Invalid gzip stream";
+		all = back;
+		#end
+		Benchs.result(StringTools.hex(haxe.crypto.Crc32.make(all), 8));
+	}
+
+}
@@ -0,0 +1,31 @@
+
+@:result(c3100899242f45f2b4f13f1876b8a457337b82e8673657fd57fce19d75d3c5f1)
+class Digest {
+
+	#if hl
+	@:hlNative("fmt","digest_init") static function digestInit( format : Int ) : hl.Abstract<"fmt_digest_ctx"> { return null; }
+	@:hlNative("fmt","digest_update") static function digestUpdate( d : hl.Abstract<"fmt_digest_ctx">, b : hl.Bytes, pos : Int, len : Int ) : Void {}
+	@:hlNative("fmt","digest_final") static function digestFinal( d : hl.Abstract<"fmt_digest_ctx">, out : hl.Bytes ) : Void {}
+	#end
+
+	public static function main() {
+		var chunk = haxe.io.Bytes.alloc(1 << 20);
+		for( i in 0...chunk.length )
+			chunk.set(i, (i * 7 + (i >> 8)) & 0xFF);
+		#if hl
+		// SHA-256, streamed one chunk at a time
+		var d = digestInit(4);
+		for( k in 0...16 )
+			digestUpdate(d, chunk, 0, chunk.length);
+		var out = haxe.io.Bytes.alloc(32);
+		digestFinal(d, out);
+		#else
+		var all = haxe.io.Bytes.alloc(chunk.length * 16);
+		for( k in 0...16 )
+			all.blit(k * chunk.length, chunk, 0, chunk.length);
+		var out = haxe.crypto.Sha256.make(all);
+		#end
+		Benchs.result(out.toHex());
+	}
+
+}
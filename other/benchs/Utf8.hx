@@ -0,0 +1,26 @@
+
+@:result(182800000)
+class Utf8 {
+
+	public static function main() {
+		var b = new StringBuf();
+		for( k in 0...50 ) {
+			for( i in 0...20 )
+				b.add("The quick brown fox jumps over the lazy dog. ");
+			b.add("Größe 日本語 ");
+		}
+		var str = b.toString();
+		var tot = 0;
+		for( k in 0...2000 ) {
+			var bytes = haxe.io.Bytes.ofString(str);
+			var str2 = bytes.toString();
+			if( str2 != str ) {
+				Benchs.result(-1);
+				return;
+			}
+			tot += bytes.length + str2.length;
+		}
+		Benchs.result(tot);
+	}
+
+}
@@ -273,6 +273,7 @@ HL_API int usprintf( uchar *out, int out_size, const uchar *fmt, ... );
 HL_API int uvszprintf( uchar *out, int out_size, const uchar *fmt, va_list arglist );
 HL_API void uprintf( const uchar *fmt, const uchar *str );
 #endif
+HL_API int ucmp_latin1( const uchar *a, const unsigned char *b, int len );
 C_FUNCTION_END
 
 #if defined(HL_VCC)
@@ -654,6 +655,7 @@ HL_API vbyte *hl_copy_bytes( const vbyte *byte, int size );
 HL_API int hl_utf8_length( const vbyte *s, int pos );
 HL_API int hl_from_utf8( uchar *out, int outLen, const char *str );
 HL_API char *hl_to_utf8( const uchar *bytes );
+HL_API vbyte *hl_utf16_to_utf8( vbyte *str, int len, int *size );
 HL_API uchar *hl_to_utf16( const char *str );
 HL_API uchar *hl_guid_str( int64 guid, uchar buf[14] );
 HL_API vdynamic *hl_virtual_make_value( vvirtual *v );
@@ -662,6 +664,7 @@ HL_API hl_obj_field *hl_obj_field_fetch( hl_type *t, int fid );
 HL_API int hl_hash( vbyte *name );
 HL_API int hl_hash_utf8( const char *str ); // no cache
 HL_API int hl_hash_gen( const uchar *name, bool cache_name );
+HL_API int hl_hash_latin1( const unsigned char *name, int len ); // no cache
 HL_API vbyte *hl_field_name( int hash );
 
 #define hl_error(msg, ...) hl_throw(hl_alloc_strbytes(USTR(msg), ## __VA_ARGS__))
@@ -759,6 +762,7 @@ typedef struct _hl_tls hl_tls;
 HL_API hl_thread *hl_thread_start( void *callback, void *param, bool withGC );
 HL_API hl_thread *hl_thread_current( void );
 HL_API void hl_thread_yield(void);
+HL_API int hl_thread_cpu_count( void );
 HL_API void hl_register_thread( void *stack_top );
 HL_API void hl_unregister_thread( void );
 
@@ -834,13 +838,22 @@ HL_API void hl_free_executable_memory( void *ptr, int size );
 typedef struct hl_buffer hl_buffer;
 
 HL_API hl_buffer *hl_alloc_buffer( void );
+HL_API hl_buffer *hl_alloc_buffer_utf8( void );
+HL_API void hl_buffer_reset( hl_buffer *b );
 HL_API void hl_buffer_val( hl_buffer *b, vdynamic *v );
 HL_API void hl_buffer_char( hl_buffer *b, uchar c );
 HL_API void hl_buffer_str( hl_buffer *b, const uchar *str );
 HL_API void hl_buffer_cstr( hl_buffer *b, const char *str );
 HL_API void hl_buffer_str_sub( hl_buffer *b, const uchar *str, int len );
+HL_API void hl_buffer_latin1( hl_buffer *b, const unsigned char *str, int len );
+HL_API void hl_buffer_int( hl_buffer *b, int v );
+HL_API void hl_buffer_float( hl_buffer *b, double v );
 HL_API int hl_buffer_length( hl_buffer *b );
 HL_API uchar *hl_buffer_content( hl_buffer *b, int *len );
+HL_API vbyte *hl_buffer_utf8_content( hl_buffer *b, int *len );
+HL_API int hl_format_float( double d, uchar *out );
+HL_API int hl_format_float_utf8( double d, char *out );
+HL_API int hl_format_int_utf8( int v, char *out );
 HL_API uchar *hl_to_string( vdynamic *v );
 HL_API const uchar *hl_type_str( hl_type *t );
 HL_API void hl_throw_buffer( hl_buffer *b );
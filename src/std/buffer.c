@@ -27,63 +27,164 @@
 #	define PR_I64 USTR("%lld")
 #endif
 
-typedef struct _stringitem {
-	uchar *str;
-	int size;
-	int len;
-	struct _stringitem *next;
-} * stringitem;
+#define BUF_INIT	64
 
+/*
+	Chars are stored contiguously in a single block, which doubles when full.
+	In UTF-8 mode, appended chars are encoded as they come and the block
+	holds bytes ready to be written, so totlen and size are in bytes.
+*/
 struct hl_buffer {
 	int totlen;
-	int blen;
-	stringitem data;
+	int size;
+	vbyte *data;
+	bool utf8;
+	uchar pending; // high surrogate waiting for the next char (UTF-8 mode)
 };
 
 HL_PRIM hl_buffer *hl_alloc_buffer() {
 	hl_buffer *b = (hl_buffer*)hl_gc_alloc_raw(sizeof(hl_buffer));
 	b->totlen = 0;
-	b->blen = 16;
+	b->size = 0;
 	b->data = NULL;
+	b->utf8 = false;
+	b->pending = 0;
 	return b;
 }
 
-static void buffer_append_new( hl_buffer *b, const uchar *s, int len ) {
-	int size;
-	stringitem it;
-	while( b->totlen >= (b->blen << 2) )
-		b->blen <<= 1;
-	size = (len < b->blen)?b->blen:len;
-	it = (stringitem)hl_gc_alloc_raw(sizeof(struct _stringitem));
-	it->str = (uchar*)hl_gc_alloc_noptr(size<<1);
-	memcpy(it->str,s,len<<1);
-	it->size = size;
-	it->len = len;
-	it->next = b->data;
-	b->data = it;
+HL_PRIM hl_buffer *hl_alloc_buffer_utf8() {
+	hl_buffer *b = hl_alloc_buffer();
+	b->utf8 = true;
+	return b;
+}
+
+// makes room for n more units and returns where they go
+static vbyte *buffer_reserve( hl_buffer *b, int n ) {
+	int shift = b->utf8 ? 0 : 1;
+	int need = b->totlen + n;
+	if( need > b->size ) {
+		int size = b->size ? b->size : BUF_INIT;
+		vbyte *data;
+		if( need < 0 || need > (0x7FFFFFFF >> shift) ) hl_error("Buffer too big");
+		while( size < need )
+			size = size > (0x3FFFFFFF >> shift) ? need : size << 1;
+		data = (vbyte*)hl_gc_alloc_noptr(size << shift);
+		if( b->totlen ) memcpy(data,b->data,b->totlen << shift);
+		b->data = data;
+		b->size = size;
+	}
+	return b->data + (b->totlen << shift);
+}
+
+HL_PRIM void hl_buffer_reset( hl_buffer *b ) {
+	b->totlen = 0;
+	b->pending = 0;
+}
+
+static int utf8_encode( vbyte *out, unsigned int c ) {
+	if( c < 0x80 ) {
+		out[0] = (vbyte)c;
+		return 1;
+	}
+	if( c < 0x800 ) {
+		out[0] = (vbyte)(0xC0 | (c >> 6));
+		out[1] = (vbyte)(0x80 | (c & 63));
+		return 2;
+	}
+	if( c < 0x10000 ) {
+		out[0] = (vbyte)(0xE0 | (c >> 12));
+		out[1] = (vbyte)(0x80 | ((c >> 6) & 63));
+		out[2] = (vbyte)(0x80 | (c & 63));
+		return 3;
+	}
+	out[0] = (vbyte)(0xF0 | (c >> 18));
+	out[1] = (vbyte)(0x80 | ((c >> 12) & 63));
+	out[2] = (vbyte)(0x80 | ((c >> 6) & 63));
+	out[3] = (vbyte)(0x80 | (c & 63));
+	return 4;
+}
+
+// a high surrogate left alone at the end of the buffer is written as U+FFFD
+static void buffer_flush_pending( hl_buffer *b ) {
+	if( b->pending ) {
+		b->pending = 0;
+		b->totlen += utf8_encode(buffer_reserve(b,3),0xFFFD);
+	}
+}
+
+static void buffer_utf8_chars( hl_buffer *b, const uchar *s, int len ) {
+	// a surrogate pending from a previous call can add a U+FFFD
+	vbyte *out = buffer_reserve(b,len * 3 + 3);
+	vbyte *start = out;
+	int i;
+	for(i=0;i<len;i++) {
+		unsigned int c = s[i];
+		if( c < 0x80 && !b->pending ) {
+			*out++ = (vbyte)c;
+			continue;
+		}
+		if( b->pending ) {
+			if( c >= 0xDC00 && c <= 0xDFFF ) {
+				out += utf8_encode(out,(((b->pending - 0xD800) << 10) | (c - 0xDC00)) + 0x10000);
+				b->pending = 0;
+				continue;
+			}
+			out += utf8_encode(out,0xFFFD);
+			b->pending = 0;
+		}
+		if( c >= 0xD800 && c <= 0xDBFF )
+			b->pending = (uchar)c;
+		else
+			out += utf8_encode(out,c >= 0xDC00 && c <= 0xDFFF ? 0xFFFD : c);
+	}
+	b->totlen += (int)(out - start);
 }
 
 HL_PRIM void hl_buffer_str_sub( hl_buffer *b, const uchar *s, int len ) {
-	stringitem it;
-	int offset = 0;
 	if( s == NULL || len <= 0 )
 		return;
+	if( b->utf8 ) {
+		buffer_utf8_chars(b,s,len);
+		return;
+	}
+	memcpy(buffer_reserve(b,len),s,len<<1);
 	b->totlen += len;
-	it = b->data;
-	if( it ) {
-		int free = it->size - it->len;
-		if( free >= len ) {
-			memcpy(it->str + it->len,s,len<<1);
-			it->len += len;
-			return;
-		} else {
-			memcpy(it->str + it->len,s,free<<1);
-			it->len += free;
-			offset = free;
-			len -= free;
+}
+
+// one byte per char, widened while copied
+HL_PRIM void hl_buffer_latin1( hl_buffer *b, const unsigned char *s, int len ) {
+	int i;
+	if( s == NULL || len <= 0 )
+		return;
+	if( b->utf8 ) {
+		vbyte *out, *start;
+		buffer_flush_pending(b);
+		out = start = buffer_reserve(b,len << 1);
+		for(i=0;i<len;i++) {
+			unsigned int c = s[i];
+			if( c < 0x80 )
+				*out++ = (vbyte)c;
+			else {
+				*out++ = (vbyte)(0xC0 | (c >> 6));
+				*out++ = (vbyte)(0x80 | (c & 63));
+			}
 		}
+		b->totlen += (int)(out - start);
+	} else {
+		uchar *out = (uchar*)buffer_reserve(b,len);
+		for(i=0;i<len;i++)
+			out[i] = s[i];
+		b->totlen += len;
 	}
-	buffer_append_new(b,s + offset,len);
+}
+
+static void buffer_ascii( hl_buffer *b, const char *s, int len ) {
+	if( b->utf8 ) {
+		buffer_flush_pending(b);
+		memcpy(buffer_reserve(b,len),s,len);
+		b->totlen += len;
+	} else
+		hl_buffer_latin1(b,(const unsigned char*)s,len);
 }
 
 HL_PRIM void hl_buffer_str( hl_buffer *b, const uchar *s ) {
@@ -91,43 +192,105 @@ HL_PRIM void hl_buffer_str( hl_buffer *b, const uchar *s ) {
 }
 
 HL_PRIM void hl_buffer_cstr( hl_buffer *b, const char *s ) {
-	if( s ) {
+	if( s == NULL ) {
+		hl_buffer_str_sub(b,USTR("null"),4);
+		return;
+	}
+	if( b->utf8 ) {
+		buffer_ascii(b,s,(int)strlen(s));
+	} else {
+		// decoded in place : hl_from_utf8 also writes a terminating zero
 		int len = (int)hl_utf8_length((vbyte*)s,0);
-		uchar *out = (uchar*)malloc(sizeof(uchar)*(len+1));
-		hl_from_utf8(out,len,s);
-		hl_buffer_str_sub(b,out,len);
-		free(out);
-	} else hl_buffer_str_sub(b,USTR("null"),4);
+		hl_from_utf8((uchar*)buffer_reserve(b,len + 1),len,s);
+		b->totlen += len;
+	}
 }
 
 HL_PRIM void hl_buffer_char( hl_buffer *b, uchar c ) {
-	stringitem it;
-	b->totlen++;
-	it = b->data;
-	if( it && it->len != it->size ) {
-		it->str[it->len++] = c;
+	if( b->utf8 ) {
+		if( c < 0x80 && !b->pending && b->totlen < b->size )
+			b->data[b->totlen++] = (vbyte)c;
+		else
+			buffer_utf8_chars(b,&c,1);
 		return;
 	}
-	buffer_append_new(b,(uchar*)&c,1);
+	if( b->totlen == b->size ) buffer_reserve(b,1);
+	((uchar*)b->data)[b->totlen++] = c;
+}
+
+HL_PRIM void hl_buffer_int( hl_buffer *b, int v ) {
+	char tmp[12];
+	buffer_ascii(b,tmp,hl_format_int_utf8(v,tmp));
+}
+
+HL_PRIM void hl_buffer_float( hl_buffer *b, double v ) {
+	char tmp[32];
+	buffer_ascii(b,tmp,hl_format_float_utf8(v,tmp));
 }
 
 HL_PRIM uchar *hl_buffer_content( hl_buffer *b, int *len ) {
-	uchar *buf = (uchar*)hl_gc_alloc_noptr((b->totlen+1)<<1);
-	stringitem it = b->data;
-	uchar *s = ((uchar*)buf) + b->totlen;
-	*s = 0;
-	while( it != NULL ) {
-		stringitem tmp;
-		s -= it->len;
-		memcpy(s,it->str,it->len<<1);
-		tmp = it->next;
-		it = tmp;
+	uchar *buf;
+	if( b->utf8 ) {
+		// decoded with bound checks since hl_buffer_cstr stores bytes as is
+		const vbyte *s, *end;
+		int n = 0, p = 0;
+		buffer_flush_pending(b);
+		s = b->data;
+		end = s + b->totlen;
+		while( s < end ) {
+			unsigned int c = *s;
+			if( (c & 0xC0) != 0x80 ) n += c >= 0xF0 ? 2 : 1;
+			s++;
+		}
+		buf = (uchar*)hl_gc_alloc_noptr((n + 1) << 1);
+		s = b->data;
+		while( s < end && p < n ) {
+			unsigned int c = *s++;
+			if( c >= 0xC0 ) {
+				int k = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : 1;
+				c &= 0x3F >> k;
+				while( k-- && s < end && (*s & 0xC0) == 0x80 )
+					c = (c << 6) | (*s++ & 0x3F);
+				if( c >= 0x10000 && p + 1 < n ) {
+					c -= 0x10000;
+					buf[p++] = (uchar)((c >> 10) + 0xD800);
+					c = (c & 0x3FF) | 0xDC00;
+				}
+			} else if( c >= 0x80 )
+				continue; // stray continuation byte
+			buf[p++] = (uchar)c;
+		}
+		buf[p] = 0;
+		if( len ) *len = p;
+		return buf;
+	}
+	buf = (uchar*)hl_gc_alloc_noptr((b->totlen+1)<<1);
+	if( b->totlen ) memcpy(buf,b->data,b->totlen<<1);
+	buf[b->totlen] = 0;
+	if( len ) *len = b->totlen;
+	return buf;
+}
+
+// a NUL-terminated UTF-8 copy, ready to be written to a socket or file
+HL_PRIM vbyte *hl_buffer_utf8_content( hl_buffer *b, int *len ) {
+	vbyte *buf;
+	if( !b->utf8 ) {
+		if( b->totlen == 0 ) {
+			if( len ) *len = 0;
+			return hl_copy_bytes((vbyte*)"",1);
+		}
+		return hl_utf16_to_utf8(b->data,b->totlen,len);
 	}
+	buffer_flush_pending(b);
+	buf = hl_alloc_bytes(b->totlen + 1);
+	if( b->totlen ) memcpy(buf,b->data,b->totlen);
+	buf[b->totlen] = 0;
 	if( len ) *len = b->totlen;
 	return buf;
 }
 
-int hl_buffer_length( hl_buffer *b ) {
+// in UTF-8 mode, the length is in bytes
+HL_PRIM int hl_buffer_length( hl_buffer *b ) {
 	return b->totlen;
 }
 
@@ -416,3 +579,18 @@ HL_PRIM uchar *hl_to_string( vdynamic *v ) {
 	hl_buffer_char(b,0);
 	return hl_buffer_content(b,NULL);
 }
+
+#define _BUFFER _ABSTRACT(hl_buffer)
+
+DEFINE_PRIM(_BUFFER,alloc_buffer,_NO_ARG);
+DEFINE_PRIM(_BUFFER,alloc_buffer_utf8,_NO_ARG);
+DEFINE_PRIM(_VOID,buffer_reset,_BUFFER);
+DEFINE_PRIM(_VOID,buffer_str_sub,_BUFFER _BYTES _I32);
+DEFINE_PRIM(_VOID,buffer_latin1,_BUFFER _BYTES _I32);
+DEFINE_PRIM(_VOID,buffer_char,_BUFFER _I16);
+DEFINE_PRIM(_VOID,buffer_int,_BUFFER _I32);
+DEFINE_PRIM(_VOID,buffer_float,_BUFFER _F64);
+DEFINE_PRIM(_VOID,buffer_val,_BUFFER _DYN);
+DEFINE_PRIM(_I32,buffer_length,_BUFFER);
+DEFINE_PRIM(_BYTES,buffer_content,_BUFFER _REF(_I32));
+DEFINE_PRIM(_BYTES,buffer_utf8_content,_BUFFER _REF(_I32));
@@ -49,99 +49,236 @@ HL_PRIM int hl_bytes_compare16( vbyte *a, vbyte *b, int len ) {
 	return 0;
 }
 
-typedef unsigned char byte;
-static void *
-memfind_rb (const void  *in_block,      /*  Block containing data            */
-            size_t       block_size,    /*  Size of block in bytes           */
-            const void  *in_pattern,    /*  Pattern to search for            */
-            size_t       pattern_size,  /*  Size of pattern block            */
-            size_t      *shift,         /*  Shift table (search buffer)      */
-            bool        *repeat_find)   /*  TRUE: search buffer already init */
-{
-    size_t
-        byte_nbr,                       /*  Distance through block           */
-        match_size;                     /*  Size of matched part             */
-    const byte
-        *match_base = NULL,             /*  Base of match of pattern         */
-        *match_ptr  = NULL,             /*  Point within current match       */
-        *limit      = NULL;             /*  Last potiental match point       */
-    const byte
-        *block   = (byte *) in_block,   /*  Concrete pointer to block data   */
-        *pattern = (byte *) in_pattern; /*  Concrete pointer to search value */
-
-    if (block == NULL || pattern == NULL || shift == NULL)
-        return (NULL);
-
-    /*  Pattern must be smaller or equal in size to string                   */
-    if (block_size < pattern_size)
-        return (NULL);                  /*  Otherwise it's not found         */
-
-    if (pattern_size == 0)              /*  Empty patterns match at start    */
-        return ((void *)block);
-
-    /*  Build the shift table unless we're continuing a previous search      */
-
-    /*  The shift table determines how far to shift before trying to match   */
-    /*  again, if a match at this point fails.  If the byte after where the  */
-    /*  end of our pattern falls is not in our pattern, then we start to     */
-    /*  match again after that byte; otherwise we line up the last occurence */
-    /*  of that byte in our pattern under that byte, and try match again.    */
-
-    if (!repeat_find || !*repeat_find)
-      {
-        for (byte_nbr = 0; byte_nbr < 256; byte_nbr++)
-            shift [byte_nbr] = pattern_size + 1;
-        for (byte_nbr = 0; byte_nbr < pattern_size; byte_nbr++)
-            shift [(byte) pattern [byte_nbr]] = pattern_size - byte_nbr;
-
-        if (repeat_find)
-            *repeat_find = true;
-      }
-
-    /*  Search for the block, each time jumping up by the amount             */
-    /*  computed in the shift table                                          */
-
-    limit = block + (block_size - pattern_size + 1);
-
-    for (match_base = block;
-         match_base < limit;
-         match_base += shift [*(match_base + pattern_size)])
-      {
-        match_ptr  = match_base;
-        match_size = 0;
-
-        /*  Compare pattern until it all matches, or we find a difference    */
-        while (*match_ptr++ == pattern [match_size++])
-          {
-            /*  If we found a match, return the start address                */
-            if (match_size >= pattern_size)
-              return ((void*)(match_base));
-
-          }
-      }
-    return NULL;
+// compare UCS-2 chars with one-byte (Latin-1) chars
+HL_PRIM int hl_bytes_compare_latin1( vbyte *a, vbyte *b, int len ) {
+	unsigned short *s1 = (unsigned short *)a;
+	int i;
+	for(i=0;i<len;i++)
+		if( s1[i] != b[i] )
+			return ((int)s1[i]) - ((int)b[i]);
+	return 0;
 }
 
-HL_PRIM int hl_bytes_find( vbyte *where, int pos, int len, vbyte *which, int wpos, int wlen ) {
-	size_t searchbuf [256];
-	bool repeat_find = false;
-	vbyte *found = (vbyte*)memfind_rb(where + pos,len,which+wpos,wlen,searchbuf,&repeat_find);
-	if( found == NULL ) return -1;
-	return (int)(size_t)(found - where);
+/*
+	Substring search : candidate positions are the ones where both the first
+	needle char and the char at its anchor offset match. With SSE2 they are
+	tested a block at a time, then confirmed with memcmp.
+*/
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define HL_BYTES_SSE2
+#endif
+
+#ifdef HL_BYTES_SSE2
+#ifdef HL_WIN
+#	include <intrin.h>
+static unsigned int __inline TRAILING_ZEROES( unsigned int x ) {
+	DWORD msb = 0;
+	if( _BitScanForward( &msb, x ) )
+		return msb;
+	return 32;
+}
+static unsigned int __inline LAST_BIT( unsigned int x ) {
+	DWORD msb = 0;
+	_BitScanReverse( &msb, x );
+	return msb;
+}
+#else
+static inline unsigned int TRAILING_ZEROES( unsigned int x ) {
+	return x ? __builtin_ctz(x) : 32;
+}
+static inline unsigned int LAST_BIT( unsigned int x ) {
+	return 31 - __builtin_clz(x);
+}
+#endif
+#endif
+
+// the last needle char that differs from the first one, so repeated chars don't make every position a candidate
+static int find_anchor( const vbyte *n, int nlen ) {
+	int a = nlen - 1;
+	while( a > 0 && n[a] == n[0] ) a--;
+	return a > 0 ? a : (nlen > 0 ? nlen - 1 : 0);
 }
 
-HL_PRIM int hl_bytes_rfind( vbyte *where, int len, vbyte *which, int wlen ) {
-	if( wlen > len ) return -1;
-	if( wlen == 0 ) return len; // at end
-	int pos = len - wlen;
-	while( pos >= 0 ) {
-		if( memcmp(where+pos,which,wlen) == 0 )
-			return pos;
-		pos--;
+static int find_anchor16( const uchar *n, int nlen ) {
+	int a = nlen - 1;
+	while( a > 0 && n[a] == n[0] ) a--;
+	return a > 0 ? a : (nlen > 0 ? nlen - 1 : 0);
+}
+
+static int find_bytes( const vbyte *h, int hlen, const vbyte *n, int nlen, int anchor ) {
+	int i = 0, last = hlen - nlen;
+	const vbyte *p;
+	if( last < 0 ) return -1;
+	if( nlen == 0 ) return 0;
+	if( nlen == 1 ) {
+		p = (const vbyte*)memchr(h,n[0],hlen);
+		return p ? (int)(p - h) : -1;
+	}
+#	ifdef HL_BYTES_SSE2
+	{
+		__m128i first = _mm_set1_epi8((char)n[0]);
+		__m128i second = _mm_set1_epi8((char)n[anchor]);
+		for(;i<=last-15;i+=16) {
+			__m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(h + i)),first);
+			__m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(h + i + anchor)),second);
+			unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_and_si128(a,b));
+			while( m ) {
+				int k = i + TRAILING_ZEROES(m);
+				if( memcmp(h + k + 1,n + 1,nlen - 1) == 0 )
+					return k;
+				m &= m - 1;
+			}
+		}
+	}
+#	endif
+	while( i <= last ) {
+		p = (const vbyte*)memchr(h + i,n[0],last - i + 1);
+		if( p == NULL ) break;
+		i = (int)(p - h);
+		if( p[anchor] == n[anchor] && memcmp(p + 1,n + 1,nlen - 1) == 0 )
+			return i;
+		i++;
+	}
+	return -1;
+}
+
+static int rfind_bytes( const vbyte *h, int hlen, const vbyte *n, int nlen, int anchor ) {
+	int i = hlen - nlen;
+	if( i < 0 ) return -1;
+	if( nlen == 0 ) return hlen; // at end
+#	ifdef HL_BYTES_SSE2
+	{
+		__m128i first = _mm_set1_epi8((char)n[0]);
+		__m128i second = _mm_set1_epi8((char)n[anchor]);
+		// blocks of candidates [i-15,i]
+		for(;i>=15;i-=16) {
+			const vbyte *s = h + i - 15;
+			__m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)s),first);
+			__m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + anchor)),second);
+			unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_and_si128(a,b));
+			while( m ) {
+				int k = LAST_BIT(m);
+				if( memcmp(s + k,n,nlen) == 0 )
+					return i - 15 + k;
+				m &= ~(1u << k);
+			}
+		}
+	}
+#	endif
+	for(;i>=0;i--)
+		if( h[i] == n[0] && memcmp(h + i,n,nlen) == 0 )
+			return i;
+	return -1;
+}
+
+// same on UCS-2 chars, offsets and lengths are in chars
+static int find_chars( const uchar *h, int hlen, const uchar *n, int nlen, int anchor ) {
+	int i = 0, last = hlen - nlen;
+	if( last < 0 ) return -1;
+	if( nlen == 0 ) return 0;
+#	ifdef HL_BYTES_SSE2
+	{
+		__m128i first = _mm_set1_epi16((short)n[0]);
+		__m128i second = _mm_set1_epi16((short)n[anchor]);
+		for(;i<=last-7;i+=8) {
+			__m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(h + i)),first);
+			__m128i b = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(h + i + anchor)),second);
+			unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_and_si128(a,b)) & 0x5555;
+			while( m ) {
+				int k = i + (TRAILING_ZEROES(m) >> 1);
+				if( memcmp(h + k + 1,n + 1,(nlen - 1) * sizeof(uchar)) == 0 )
+					return k;
+				m &= m - 1;
+			}
+		}
 	}
+#	endif
+	for(;i<=last;i++)
+		if( h[i] == n[0] && h[i + anchor] == n[anchor] && memcmp(h + i + 1,n + 1,(nlen - 1) * sizeof(uchar)) == 0 )
+			return i;
+	return -1;
+}
+
+static int rfind_chars( const uchar *h, int hlen, const uchar *n, int nlen, int anchor ) {
+	int i = hlen - nlen;
+	if( i < 0 ) return -1;
+	if( nlen == 0 ) return hlen;
+#	ifdef HL_BYTES_SSE2
+	{
+		__m128i first = _mm_set1_epi16((short)n[0]);
+		__m128i second = _mm_set1_epi16((short)n[anchor]);
+		for(;i>=7;i-=8) {
+			const uchar *s = h + i - 7;
+			__m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)s),first);
+			__m128i b = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(s + anchor)),second);
+			unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_and_si128(a,b)) & 0x5555;
+			while( m ) {
+				int k = LAST_BIT(m) >> 1;
+				if( memcmp(s + k,n,nlen * sizeof(uchar)) == 0 )
+					return i - 7 + k;
+				m &= ~(1u << (k << 1));
+			}
+		}
+	}
+#	endif
+	for(;i>=0;i--)
+		if( h[i] == n[0] && memcmp(h + i,n,nlen * sizeof(uchar)) == 0 )
+			return i;
 	return -1;
 }
 
+HL_PRIM int hl_bytes_find( vbyte *where, int pos, int len, vbyte *which, int wpos, int wlen ) {
+	int found;
+	if( where == NULL || which == NULL ) return -1;
+	which += wpos;
+	found = find_bytes(where + pos,len,which,wlen,find_anchor(which,wlen));
+	return found < 0 ? -1 : pos + found;
+}
+
+HL_PRIM int hl_bytes_rfind( vbyte *where, int len, vbyte *which, int wlen ) {
+	return rfind_bytes(where,len,which,wlen,find_anchor(which,wlen));
+}
+
+// UCS-2 search for String.indexOf / lastIndexOf : never matches at an odd byte offset
+HL_PRIM int hl_bytes_find16( vbyte *where, int pos, int len, vbyte *which, int wpos, int wlen ) {
+	const uchar *n = (uchar*)which + wpos;
+	int found = find_chars((uchar*)where + pos,len,n,wlen,find_anchor16(n,wlen));
+	return found < 0 ? -1 : pos + found;
+}
+
+HL_PRIM int hl_bytes_rfind16( vbyte *where, int len, vbyte *which, int wlen ) {
+	return rfind_chars((uchar*)where,len,(uchar*)which,wlen,find_anchor16((uchar*)which,wlen));
+}
+
+typedef struct {
+	int len;
+	int anchor;
+	vbyte needle[1];
+} hl_bytes_finder;
+
+/*
+	A needle copied and prepared once, for scanners that keep looking for the
+	same separator.
+*/
+HL_PRIM hl_bytes_finder *hl_bytes_finder_alloc( vbyte *which, int wpos, int wlen ) {
+	hl_bytes_finder *f = (hl_bytes_finder*)hl_gc_alloc_noptr(sizeof(hl_bytes_finder) + wlen);
+	f->len = wlen;
+	memcpy(f->needle,which + wpos,wlen);
+	f->anchor = find_anchor(f->needle,wlen);
+	return f;
+}
+
+HL_PRIM int hl_bytes_finder_find( hl_bytes_finder *f, vbyte *where, int pos, int len ) {
+	int found = find_bytes(where + pos,len,f->needle,f->len,f->anchor);
+	return found < 0 ? -1 : pos + found;
+}
+
+HL_PRIM int hl_bytes_finder_rfind( hl_bytes_finder *f, vbyte *where, int len ) {
+	return rfind_bytes(where,len,f->needle,f->len,f->anchor);
+}
+
 HL_PRIM void hl_bytes_fill( vbyte *bytes, int pos, int len, int value ) {
 	memset(bytes+pos,value,len);
 }
@@ -165,76 +302,405 @@ static int ms_gcd( int m, int n ) {
 #define TID(t)	t##_i64
 #include "sort.h"
 
+#define PAR_SORT_MIN			(1 << 20)
+#define PAR_SORT_MAX_THREADS	8
+
+typedef struct {
+	uint64 key;
+	int index;
+} rs_pair;
+
+static uint64 rs_f64_key( double d ) {
+	union { double d; uint64 i; } u;
+	// any NaN, whatever its sign bit, sorts last
+	if( d != d ) return ~(uint64)0;
+	u.d = d;
+	// negative numbers sort in reverse order of their bits
+	return (u.i >> 63) ? ~u.i : u.i | ((uint64)1 << 63);
+}
+
+#define TRADIX int
+#define TKEY unsigned int
+#define TKEYOF(e) ((unsigned int)(e) ^ 0x80000000u)
+#define TID(t) t##_i32
+#include "radix.h"
+#define TRADIX int64
+#define TKEY uint64
+#define TKEYOF(e) ((uint64)(e) ^ ((uint64)1 << 63))
+#define TID(t) t##_i64
+#include "radix.h"
+#define TRADIX double
+#define TKEY uint64
+#define TKEYOF(e) rs_f64_key(e)
+#define TID(t) t##_f64
+#include "radix.h"
+#define TRADIX rs_pair
+#define TKEY uint64
+#define TKEYOF(e) ((e).key)
+#define TID(t) t##_pair
+#include "radix.h"
+
+/*
+	A null comparator sorts in ascending numeric order without calling back
+	into Haxe code (NaN is greater than any number and -0 is lower than 0).
+*/
 HL_PRIM void hl_bsort_i32( vbyte *bytes, int pos, int len, vclosure *cmp ) {
 	m_sort_i32 m;
+	if( cmp == NULL ) {
+		radix_sort_i32((int*)(bytes + pos),len);
+		return;
+	}
 	m.arr = (int*)(bytes + pos);
 	m.c = cmp;
-	merge_sort_rec_i32(&m,0,len);
+	merge_sort_buf_i32(&m,(int*)hl_gc_alloc_noptr((len >> 1) * sizeof(int)),0,len);
 }
 
 HL_PRIM void hl_bsort_f64( vbyte *bytes, int pos, int len, vclosure *cmp ) {
 	m_sort_f64 m;
+	if( cmp == NULL ) {
+		radix_sort_f64((double*)(bytes + pos),len);
+		return;
+	}
 	m.arr = (double*)(bytes + pos);
 	m.c = cmp;
-	merge_sort_rec_f64(&m,0,len);
+	merge_sort_buf_f64(&m,(double*)hl_gc_alloc_noptr((len >> 1) * sizeof(double)),0,len);
 }
 
 HL_PRIM void hl_bsort_i64(vbyte* bytes, int pos, int len, vclosure* cmp) {
 	m_sort_i64 m;
+	if( cmp == NULL ) {
+		radix_sort_i64((int64*)(bytes + pos),len);
+		return;
+	}
 	m.arr = (int64*)(bytes + pos);
 	m.c = cmp;
-	merge_sort_rec_i64(&m, 0, len);
-}
-
-static inline bool is_space_char(uchar c) {
-	return c == 32 || (c > 8 && c < 14);
-}
-
-HL_PRIM double hl_parse_float( vbyte *bytes, int pos, int len ) {
-	const uchar *str = (uchar*)(bytes+pos);
-	uchar *end = NULL;
-	while( is_space_char(*str) ) str++;
-	double d = utod(str,&end);
-	if( end == str )
-		return hl_nan();
-	return d;
-}
-
-static inline bool has_hex_prefix( const uchar *c, int len, bool is_signed ) {
-	if (is_signed)
-		return len >= 3 && c[1] == '0' && (c[2] == 'x' || c[2] == 'X');
-	return len >= 2 && c[0] == '0' && (c[1] == 'x' || c[1] == 'X');
-}
-
-HL_PRIM vdynamic *hl_parse_int( vbyte *bytes, int pos, int len ) {
-	const uchar *c = (uchar*)(bytes + pos);
-	const uchar *start = c;
-	int h;
-	while( is_space_char(*c) ) c++;
-	uchar sign = c[0];
-	bool is_signed = sign == '-' || sign == '+';
-	if( has_hex_prefix(c,(int)(len+start-c),is_signed) ) {
-		h = 0;
-		c += is_signed ? 3 : 2;
-		while( *c ) {
-			uchar k = *c++;
-			if( k >= '0' && k <= '9' )
-				h = (h << 4) | (k - '0');
-			else if( k >= 'A' && k <= 'F' )
-				h = (h << 4) | ((k - 'A') + 10);
-			else if( k >= 'a' && k <= 'f' )
-				h = (h << 4) | ((k - 'a') + 10);
-			else
+	merge_sort_buf_i64(&m, (int64*)hl_gc_alloc_noptr((len >> 1) * sizeof(int64)), 0, len);
+}
+
+/*
+	Stable sort of objects by a numeric key, which is computed only once per
+	element instead of twice per comparison.
+*/
+HL_PRIM void hl_array_sort_keys( varray *a, int pos, int len, vclosure *key ) {
+	hl_trap_ctx trap;
+	vdynamic *exc;
+	rs_pair *pairs;
+	void **arr;
+	int i;
+	if( !hl_is_ptr(a->at) )
+		hl_error("Invalid array type");
+	if( pos < 0 || len < 0 || pos + len > a->size )
+		hl_error("Invalid array pos or length");
+	if( len < 2 ) return;
+	pairs = (rs_pair*)malloc(len * sizeof(rs_pair));
+	if( pairs == NULL ) hl_error("Out of memory");
+	arr = hl_aptr(a,void*) + pos;
+	hl_trap(trap, exc, on_exception);
+	for(i=0;i<len;i++) {
+		pairs[i].key = rs_f64_key(hl_call1(double,key,vdynamic*,(vdynamic*)arr[i]));
+		pairs[i].index = i;
+	}
+	hl_endtrap(trap);
+	radix_sort_pair(pairs,len);
+	// apply the permutation in place, following each cycle
+	for(i=0;i<len;i++) {
+		void *first;
+		int j = i;
+		if( pairs[i].index < 0 ) continue;
+		first = arr[i];
+		while( true ) {
+			int k = pairs[j].index;
+			pairs[j].index = -1;
+			if( k == i ) {
+				arr[j] = first;
 				break;
+			}
+			arr[j] = arr[k];
+			j = k;
+		}
+	}
+	free(pairs);
+	return;
+on_exception:
+	hl_endtrap(trap);
+	free(pairs);
+	hl_rethrow(exc);
+}
+
+// ----------------- CODECS
+
+/*
+	Base64, hex and percent encoding between bytes ranges. The output is
+	written at out + opos, which must be large enough : 4 * ((len + 2) / 3)
+	for base64, 2 * len for hex and 3 * len for percent encoding, len for
+	decoding. Decoders return the count of bytes written, or -1 on invalid
+	input.
+*/
+
+static const char base64_std[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char base64_url[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+#ifdef HL_BYTES_SSE2
+#define CHAR_RANGE(v,lo,hi)	_mm_and_si128(_mm_cmpgt_epi8(v,_mm_set1_epi8((lo) - 1)),_mm_cmpgt_epi8(_mm_set1_epi8((hi) + 1),v))
+
+// 16 sextets to their chars
+static __m128i base64_chars( __m128i v, bool url ) {
+	__m128i c = _mm_add_epi8(v,_mm_set1_epi8('A'));
+	c = _mm_add_epi8(c,_mm_and_si128(_mm_cmpgt_epi8(v,_mm_set1_epi8(25)),_mm_set1_epi8('a' - 26 - 'A')));
+	c = _mm_add_epi8(c,_mm_and_si128(_mm_cmpgt_epi8(v,_mm_set1_epi8(51)),_mm_set1_epi8('0' - 52 - ('a' - 26))));
+	c = _mm_add_epi8(c,_mm_and_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8(62)),_mm_set1_epi8((url ? '-' : '+') - ('0' + 10))));
+	c = _mm_add_epi8(c,_mm_and_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8(63)),_mm_set1_epi8((url ? '_' : '/') - ('0' + 11))));
+	return c;
+}
+#endif
+
+HL_PRIM int hl_base64_encode( vbyte *src, int pos, int len, vbyte *out, int opos, bool url, bool pad ) {
+	const char *chars = url ? base64_url : base64_std;
+	const vbyte *s = src + pos;
+	vbyte *o = out + opos;
+	int i = 0;
+#	ifdef HL_BYTES_SSE2
+	for(;i+12<=len;i+=12) {
+		// each 32-bit lane holds 3 bytes, split into 4 sextets in memory order
+		unsigned int w[4];
+		__m128i v, x;
+		int k;
+		for(k=0;k<4;k++)
+			w[k] = ((unsigned int)s[i + k * 3] << 16) | ((unsigned int)s[i + k * 3 + 1] << 8) | s[i + k * 3 + 2];
+		v = _mm_loadu_si128((__m128i*)w);
+		x = _mm_and_si128(_mm_srli_epi32(v,18),_mm_set1_epi32(63));
+		x = _mm_or_si128(x,_mm_and_si128(_mm_srli_epi32(v,4),_mm_set1_epi32(63 << 8)));
+		x = _mm_or_si128(x,_mm_and_si128(_mm_slli_epi32(v,10),_mm_set1_epi32(63 << 16)));
+		x = _mm_or_si128(x,_mm_and_si128(_mm_slli_epi32(v,24),_mm_set1_epi32(63 << 24)));
+		_mm_storeu_si128((__m128i*)o,base64_chars(x,url));
+		o += 16;
+	}
+#	endif
+	for(;i+3<=len;i+=3) {
+		unsigned int w = ((unsigned int)s[i] << 16) | ((unsigned int)s[i + 1] << 8) | s[i + 2];
+		o[0] = chars[w >> 18];
+		o[1] = chars[(w >> 12) & 63];
+		o[2] = chars[(w >> 6) & 63];
+		o[3] = chars[w & 63];
+		o += 4;
+	}
+	if( i < len ) {
+		unsigned int w = (unsigned int)s[i] << 16;
+		if( i + 1 < len ) w |= (unsigned int)s[i + 1] << 8;
+		*o++ = chars[w >> 18];
+		*o++ = chars[(w >> 12) & 63];
+		if( i + 1 < len )
+			*o++ = chars[(w >> 6) & 63];
+		else if( pad )
+			*o++ = '=';
+		if( pad ) *o++ = '=';
+	}
+	return (int)(o - (out + opos));
+}
+
+static int base64_value( unsigned int c, bool url ) {
+	if( c >= 'A' && c <= 'Z' ) return c - 'A';
+	if( c >= 'a' && c <= 'z' ) return c - 'a' + 26;
+	if( c >= '0' && c <= '9' ) return c - '0' + 52;
+	if( c == (url ? '-' : '+') ) return 62;
+	if( c == (url ? '_' : '/') ) return 63;
+	return -1;
+}
+
+// trailing '=' padding is optional
+HL_PRIM int hl_base64_decode( vbyte *src, int pos, int len, vbyte *out, int opos, bool url ) {
+	const vbyte *s = src + pos;
+	vbyte *o = out + opos;
+	int i = 0, k, rest;
+	if( len > 0 && s[len - 1] == '=' ) len--;
+	if( len > 0 && s[len - 1] == '=' ) len--;
+	if( (len & 3) == 1 )
+		return -1;
+#	ifdef HL_BYTES_SSE2
+	for(;i+16<=len;i+=16) {
+		__m128i c = _mm_loadu_si128((__m128i*)(s + i));
+		__m128i m, v, ok;
+		unsigned int w[4];
+		m = CHAR_RANGE(c,'A','Z');
+		v = _mm_and_si128(m,_mm_sub_epi8(c,_mm_set1_epi8('A')));
+		ok = m;
+		m = CHAR_RANGE(c,'a','z');
+		v = _mm_or_si128(v,_mm_and_si128(m,_mm_sub_epi8(c,_mm_set1_epi8('a' - 26))));
+		ok = _mm_or_si128(ok,m);
+		m = CHAR_RANGE(c,'0','9');
+		v = _mm_or_si128(v,_mm_and_si128(m,_mm_add_epi8(c,_mm_set1_epi8(52 - '0'))));
+		ok = _mm_or_si128(ok,m);
+		m = _mm_cmpeq_epi8(c,_mm_set1_epi8(url ? '-' : '+'));
+		v = _mm_or_si128(v,_mm_and_si128(m,_mm_set1_epi8(62)));
+		ok = _mm_or_si128(ok,m);
+		m = _mm_cmpeq_epi8(c,_mm_set1_epi8(url ? '_' : '/'));
+		v = _mm_or_si128(v,_mm_and_si128(m,_mm_set1_epi8(63)));
+		ok = _mm_or_si128(ok,m);
+		if( _mm_movemask_epi8(ok) != 0xFFFF )
+			return -1;
+		// join sextet pairs into 12 bits, then 12-bit pairs into 24 bits
+		v = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v,_mm_set1_epi16(0xFF)),6),_mm_srli_epi16(v,8));
+		v = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(v,_mm_set1_epi32(0xFFFF)),12),_mm_srli_epi32(v,16));
+		_mm_storeu_si128((__m128i*)w,v);
+		for(k=0;k<4;k++) {
+			o[0] = (vbyte)(w[k] >> 16);
+			o[1] = (vbyte)(w[k] >> 8);
+			o[2] = (vbyte)w[k];
+			o += 3;
+		}
+	}
+#	endif
+	for(;i<len;i+=4) {
+		unsigned int w = 0;
+		rest = len - i < 4 ? len - i : 4;
+		for(k=0;k<rest;k++) {
+			int v = base64_value(s[i + k],url);
+			if( v < 0 ) return -1;
+			w |= (unsigned int)v << (18 - k * 6);
 		}
-		if( sign == '-' ) h = -h;
-	} else {
-		uchar *end = NULL;
-		h = utoi(c,&end);
-		if( c == end )
-			return NULL;
+		*o++ = (vbyte)(w >> 16);
+		if( rest > 2 ) *o++ = (vbyte)(w >> 8);
+		if( rest > 3 ) *o++ = (vbyte)w;
 	}
-	return hl_make_dyn(&h,&hlt_i32);
+	return (int)(o - (out + opos));
+}
+
+HL_PRIM int hl_hex_encode( vbyte *src, int pos, int len, vbyte *out, int opos, bool upper ) {
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	const vbyte *s = src + pos;
+	vbyte *o = out + opos;
+	int i = 0;
+#	ifdef HL_BYTES_SSE2
+	for(;i+16<=len;i+=16) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		__m128i lo = _mm_and_si128(v,_mm_set1_epi8(15));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v,4),_mm_set1_epi8(15));
+		__m128i letter = _mm_set1_epi8(upper ? 'A' - '0' - 10 : 'a' - '0' - 10);
+		lo = _mm_add_epi8(_mm_add_epi8(lo,_mm_set1_epi8('0')),_mm_and_si128(_mm_cmpgt_epi8(lo,_mm_set1_epi8(9)),letter));
+		hi = _mm_add_epi8(_mm_add_epi8(hi,_mm_set1_epi8('0')),_mm_and_si128(_mm_cmpgt_epi8(hi,_mm_set1_epi8(9)),letter));
+		_mm_storeu_si128((__m128i*)(o + i * 2),_mm_unpacklo_epi8(hi,lo));
+		_mm_storeu_si128((__m128i*)(o + i * 2 + 16),_mm_unpackhi_epi8(hi,lo));
+	}
+#	endif
+	for(;i<len;i++) {
+		o[i * 2] = digits[s[i] >> 4];
+		o[i * 2 + 1] = digits[s[i] & 15];
+	}
+	return len * 2;
+}
+
+static int hex_value( unsigned int c ) {
+	if( c >= '0' && c <= '9' ) return c - '0';
+	c |= 0x20;
+	if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+	return -1;
+}
+
+HL_PRIM int hl_hex_decode( vbyte *src, int pos, int len, vbyte *out, int opos ) {
+	const vbyte *s = src + pos;
+	vbyte *o = out + opos;
+	int i = 0;
+	if( len & 1 )
+		return -1;
+#	ifdef HL_BYTES_SSE2
+	for(;i+32<=len;i+=32) {
+		__m128i n[2];
+		int k;
+		for(k=0;k<2;k++) {
+			__m128i c = _mm_loadu_si128((__m128i*)(s + i + k * 16));
+			__m128i l = _mm_or_si128(c,_mm_set1_epi8(0x20));
+			__m128i d = CHAR_RANGE(c,'0','9');
+			__m128i a = CHAR_RANGE(l,'a','f');
+			if( _mm_movemask_epi8(_mm_or_si128(d,a)) != 0xFFFF )
+				return -1;
+			n[k] = _mm_or_si128(_mm_and_si128(d,_mm_sub_epi8(c,_mm_set1_epi8('0'))),_mm_and_si128(a,_mm_sub_epi8(l,_mm_set1_epi8('a' - 10))));
+			// high nibble in the first byte of each pair
+			n[k] = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n[k],_mm_set1_epi16(0xFF)),4),_mm_srli_epi16(n[k],8));
+		}
+		_mm_storeu_si128((__m128i*)(o + (i >> 1)),_mm_packus_epi16(n[0],n[1]));
+	}
+#	endif
+	for(;i<len;i+=2) {
+		int hi = hex_value(s[i]), lo = hex_value(s[i + 1]);
+		if( hi < 0 || lo < 0 ) return -1;
+		o[i >> 1] = (vbyte)((hi << 4) | lo);
+	}
+	return len >> 1;
+}
+
+// same chars as url_encode are kept, bytes are expected to be UTF-8 already
+static bool percent_safe( unsigned int c ) {
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.';
+}
+
+HL_PRIM int hl_percent_encode( vbyte *src, int pos, int len, vbyte *out, int opos ) {
+	static const char digits[] = "0123456789ABCDEF";
+	const vbyte *s = src + pos;
+	vbyte *o = out + opos;
+	int i = 0;
+	while( i < len ) {
+#		ifdef HL_BYTES_SSE2
+		if( i + 16 <= len ) {
+			__m128i c = _mm_loadu_si128((__m128i*)(s + i));
+			__m128i l = _mm_or_si128(c,_mm_set1_epi8(0x20));
+			__m128i ok = _mm_or_si128(CHAR_RANGE(l,'a','z'),CHAR_RANGE(c,'0','9'));
+			ok = _mm_or_si128(ok,_mm_cmpeq_epi8(c,_mm_set1_epi8('_')));
+			ok = _mm_or_si128(ok,CHAR_RANGE(c,'-','.'));
+			if( _mm_movemask_epi8(ok) == 0xFFFF ) {
+				_mm_storeu_si128((__m128i*)o,c);
+				o += 16;
+				i += 16;
+				continue;
+			}
+		}
+#		endif
+		{
+			unsigned int c = s[i++];
+			if( percent_safe(c) )
+				*o++ = (vbyte)c;
+			else {
+				o[0] = '%';
+				o[1] = digits[c >> 4];
+				o[2] = digits[c & 15];
+				o += 3;
+			}
+		}
+	}
+	return (int)(o - (out + opos));
+}
+
+// '+' is a space and invalid escapes are kept as is, like url_decode
+HL_PRIM int hl_percent_decode( vbyte *src, int pos, int len, vbyte *out, int opos ) {
+	const vbyte *s = src + pos;
+	vbyte *o = out + opos;
+	int i = 0;
+	while( i < len ) {
+		unsigned int c;
+#		ifdef HL_BYTES_SSE2
+		if( i + 16 <= len ) {
+			__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+			__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('%')),_mm_cmpeq_epi8(v,_mm_set1_epi8('+')));
+			unsigned int bits = (unsigned int)_mm_movemask_epi8(m);
+			int n = bits ? TRAILING_ZEROES(bits) : 16;
+			_mm_storeu_si128((__m128i*)o,v);
+			o += n;
+			i += n;
+			if( n == 16 ) continue;
+		}
+#		endif
+		c = s[i++];
+		if( c == '+' )
+			c = ' ';
+		else if( c == '%' && i + 1 < len ) {
+			int hi = hex_value(s[i]), lo = hex_value(s[i + 1]);
+			if( hi >= 0 && lo >= 0 ) {
+				c = (hi << 4) | lo;
+				i += 2;
+			}
+		}
+		*o++ = (vbyte)c;
+	}
+	return (int)(o - (out + opos));
 }
 
 // pointer manipulation
@@ -280,19 +746,32 @@ HL_PRIM int hl_string_compare( vbyte *a, vbyte *b, int len ) {
 	return memcmp(a,b,len * sizeof(uchar));
 }
 
+#define _FINDER _ABSTRACT(hl_bytes_finder)
+
 DEFINE_PRIM(_BYTES,alloc_bytes,_I32);
 DEFINE_PRIM(_VOID,bytes_blit,_BYTES _I32 _BYTES _I32 _I32);
 DEFINE_PRIM(_I32,bytes_compare,_BYTES _I32 _BYTES _I32 _I32);
 DEFINE_PRIM(_I32,bytes_compare16,_BYTES _BYTES _I32);
+DEFINE_PRIM(_I32,bytes_compare_latin1,_BYTES _BYTES _I32);
 DEFINE_PRIM(_I32,string_compare,_BYTES _BYTES _I32);
 DEFINE_PRIM(_I32,bytes_find,_BYTES _I32 _I32 _BYTES _I32 _I32);
 DEFINE_PRIM(_I32,bytes_rfind,_BYTES _I32 _BYTES _I32);
+DEFINE_PRIM(_I32,bytes_find16,_BYTES _I32 _I32 _BYTES _I32 _I32);
+DEFINE_PRIM(_I32,bytes_rfind16,_BYTES _I32 _BYTES _I32);
+DEFINE_PRIM(_FINDER,bytes_finder_alloc,_BYTES _I32 _I32);
+DEFINE_PRIM(_I32,bytes_finder_find,_FINDER _BYTES _I32 _I32);
+DEFINE_PRIM(_I32,bytes_finder_rfind,_FINDER _BYTES _I32);
+DEFINE_PRIM(_I32,base64_encode,_BYTES _I32 _I32 _BYTES _I32 _BOOL _BOOL);
+DEFINE_PRIM(_I32,base64_decode,_BYTES _I32 _I32 _BYTES _I32 _BOOL);
+DEFINE_PRIM(_I32,hex_encode,_BYTES _I32 _I32 _BYTES _I32 _BOOL);
+DEFINE_PRIM(_I32,hex_decode,_BYTES _I32 _I32 _BYTES _I32);
+DEFINE_PRIM(_I32,percent_encode,_BYTES _I32 _I32 _BYTES _I32);
+DEFINE_PRIM(_I32,percent_decode,_BYTES _I32 _I32 _BYTES _I32);
 DEFINE_PRIM(_VOID,bytes_fill,_BYTES _I32 _I32 _I32);
-DEFINE_PRIM(_F64, parse_float,_BYTES _I32 _I32);
-DEFINE_PRIM(_NULL(_I32), parse_int, _BYTES _I32 _I32);
 DEFINE_PRIM(_VOID,bsort_i32,_BYTES _I32 _I32 _FUN(_I32,_I32 _I32));
 DEFINE_PRIM(_VOID,bsort_f64,_BYTES _I32 _I32 _FUN(_I32,_F64 _F64));
 DEFINE_PRIM(_VOID, bsort_i64, _BYTES _I32 _I32 _FUN(_I32, _I64 _I64));
+DEFINE_PRIM(_VOID, array_sort_keys, _ARR _I32 _I32 _FUN(_F64, _DYN));
 DEFINE_PRIM(_BYTES,bytes_offset, _BYTES _I32);
 DEFINE_PRIM(_I32,bytes_subtract, _BYTES _BYTES);
 DEFINE_PRIM(_I32,bytes_address, _BYTES _REF(_I32));
@@ -0,0 +1,326 @@
+
+#undef t_map
+#undef t_node
+#undef t_table
+#undef t_key
+#define t_key _MKEY_TYPE
+#define t_map _MNAME(_map)
+#define t_node _MNAME(_node)
+#define t_table _MNAME(_table)
+
+typedef struct _MNAME(_node) t_node;
+typedef struct _MNAME(_table) t_table;
+
+struct _MNAME(_node) {
+	t_node *next;
+	vdynamic *value;
+	t_key key;
+	unsigned int hash;
+};
+
+struct _MNAME(_table) {
+	t_node **buckets;
+	t_table *next;
+	int mask;
+};
+
+typedef struct {
+	t_table *table;
+	hl_mutex *resize_lock;
+	cm_stripe stripes[CM_STRIPES];
+} t_map;
+
+// bucket head of a table that has been migrated to table->next
+static t_node _MNAME(moved);
+
+static t_table *_MNAME(table_alloc)( int cap ) {
+	t_table *t = (t_table*)hl_gc_alloc_raw(sizeof(t_table));
+	t->buckets = (t_node**)hl_gc_alloc_raw(cap * sizeof(t_node*));
+	memset(t->buckets,0,cap * sizeof(t_node*));
+	t->next = NULL;
+	t->mask = cap - 1;
+	return t;
+}
+
+HL_PRIM t_map *_MNAME(alloc)() {
+	int i;
+	t_map *m = (t_map*)hl_gc_alloc_raw(sizeof(t_map));
+	memset(m,0,sizeof(t_map));
+	m->table = _MNAME(table_alloc)(CM_SIZE_INIT);
+	m->resize_lock = hl_mutex_alloc(true);
+	for(i=0;i<CM_STRIPES;i++)
+		m->stripes[i].lock = hl_mutex_alloc(true);
+	return m;
+}
+
+static t_node *_MNAME(find)( t_map *m, t_key key, unsigned int hash ) {
+	t_table *t = (t_table*)cm_load((void**)&m->table);
+	while( true ) {
+		t_node *n = (t_node*)cm_load((void**)&t->buckets[hash & t->mask]);
+		if( n == &_MNAME(moved) ) {
+			t = (t_table*)cm_load((void**)&t->next);
+			continue;
+		}
+		while( n ) {
+			if( n->hash == hash && _MMATCH(n) )
+				return n;
+			n = (t_node*)cm_load((void**)&n->next);
+		}
+		return NULL;
+	}
+}
+
+/*
+	Locks the stripe owning the key bucket and returns the table it lives in.
+	Since every table capacity is a multiple of CM_STRIPES, a key keeps the
+	same stripe when its bucket is migrated.
+*/
+static t_table *_MNAME(lock_bucket)( t_map *m, unsigned int hash, cm_stripe **s ) {
+	t_table *t = (t_table*)cm_load((void**)&m->table);
+	*s = &m->stripes[hash & (CM_STRIPES - 1)];
+	cm_lock((*s)->lock);
+	while( t->buckets[hash & t->mask] == &_MNAME(moved) )
+		t = t->next;
+	return t;
+}
+
+/*
+	Migrate all buckets to a new table, one stripe at a time. Readers keep
+	reading the old table and get forwarded bucket per bucket. When copy is
+	false the new table starts empty (clear).
+*/
+static void _MNAME(migrate)( t_map *m, t_table *old, int cap, bool copy ) {
+	t_table *nt = _MNAME(table_alloc)(cap);
+	int i, b;
+	old->next = nt;
+	for(i=0;i<CM_STRIPES;i++) {
+		cm_stripe *s = &m->stripes[i];
+		cm_lock(s->lock);
+		for(b=i;b<=old->mask;b+=CM_STRIPES) {
+			t_node *n = old->buckets[b];
+			// nodes are copied since readers might still be walking the old chain
+			while( copy && n ) {
+				t_node *c = (t_node*)hl_gc_alloc_raw(sizeof(t_node));
+				int idx = n->hash & nt->mask;
+				*c = *n;
+				c->next = nt->buckets[idx];
+				nt->buckets[idx] = c;
+				n = n->next;
+			}
+			cm_store((void**)&old->buckets[b],&_MNAME(moved));
+		}
+		if( !copy ) s->count = 0;
+		hl_mutex_release(s->lock);
+	}
+	cm_store((void**)&m->table,nt);
+}
+
+HL_PRIM int _MNAME(size)( t_map *m ) {
+	int i, size = 0;
+	for(i=0;i<CM_STRIPES;i++)
+		size += m->stripes[i].count;
+	return size;
+}
+
+static void _MNAME(grow)( t_map *m ) {
+	t_table *t;
+	// someone else is already resizing
+	if( !hl_mutex_try_acquire(m->resize_lock) )
+		return;
+	t = m->table;
+	if( _MNAME(size)(m) > ((t->mask + 1) >> 2) * 3 )
+		_MNAME(migrate)(m,t,(t->mask + 1) << 1,true);
+	hl_mutex_release(m->resize_lock);
+}
+
+static void _MNAME(insert)( t_map *m, t_table *t, cm_stripe *s, t_key key, unsigned int hash, vdynamic *value ) {
+	t_node **head = &t->buckets[hash & t->mask];
+	t_node *n = (t_node*)hl_gc_alloc_raw(sizeof(t_node));
+	bool grow;
+	n->key = key;
+	n->hash = hash;
+	n->value = value;
+	n->next = *head;
+	cm_store((void**)head,n);
+	s->count++;
+	grow = s->count > (((t->mask + 1) >> 2) * 3) / CM_STRIPES;
+	hl_mutex_release(s->lock);
+	if( grow ) _MNAME(grow)(m);
+}
+
+static t_node *_MNAME(find_locked)( t_table *t, t_key key, unsigned int hash ) {
+	t_node *n = t->buckets[hash & t->mask];
+	while( n ) {
+		if( n->hash == hash && _MMATCH(n) )
+			return n;
+		n = n->next;
+	}
+	return NULL;
+}
+
+HL_PRIM void _MNAME(set)( t_map *m, t_key key, vdynamic *value ) {
+	unsigned int hash;
+	cm_stripe *s;
+	t_table *t;
+	t_node *n;
+	key = _MFILTER(key);
+	hash = _MHASH(key);
+	t = _MNAME(lock_bucket)(m,hash,&s);
+	n = _MNAME(find_locked)(t,key,hash);
+	if( n ) {
+		cm_store((void**)&n->value,value);
+		hl_mutex_release(s->lock);
+		return;
+	}
+	_MNAME(insert)(m,t,s,key,hash,value);
+}
+
+// returns false if the key was already present, even with a null value
+HL_PRIM bool _MNAME(setifabsent)( t_map *m, t_key key, vdynamic *value ) {
+	unsigned int hash;
+	cm_stripe *s;
+	t_table *t;
+	t_node *n;
+	key = _MFILTER(key);
+	hash = _MHASH(key);
+	if( _MNAME(find)(m,key,hash) ) return false;
+	t = _MNAME(lock_bucket)(m,hash,&s);
+	n = _MNAME(find_locked)(t,key,hash);
+	if( n ) {
+		hl_mutex_release(s->lock);
+		return false;
+	}
+	_MNAME(insert)(m,t,s,key,hash,value);
+	return true;
+}
+
+HL_PRIM vdynamic *_MNAME(compute)( t_map *m, t_key key, vclosure *f ) {
+	unsigned int hash;
+	cm_stripe *s;
+	t_table *t;
+	t_node *n;
+	vdynamic *value;
+	bool isExc;
+	key = _MFILTER(key);
+	hash = _MHASH(key);
+	n = _MNAME(find)(m,key,hash);
+	if( n ) return (vdynamic*)cm_load((void**)&n->value);
+	/*
+		No lock is held while the closure runs so it can write to the map.
+		Two threads computing the same key both run it, the first insert wins
+		and its value is returned to both.
+	*/
+	value = hl_dyn_call_safe(f,NULL,0,&isExc);
+	if( isExc ) hl_rethrow(value);
+	t = _MNAME(lock_bucket)(m,hash,&s);
+	n = _MNAME(find_locked)(t,key,hash);
+	if( n ) {
+		hl_mutex_release(s->lock);
+		return n->value;
+	}
+	_MNAME(insert)(m,t,s,key,hash,value);
+	return value;
+}
+
+HL_PRIM bool _MNAME(exists)( t_map *m, t_key key ) {
+	key = _MFILTER(key);
+	return _MNAME(find)(m,key,_MHASH(key)) != NULL;
+}
+
+HL_PRIM vdynamic *_MNAME(get)( t_map *m, t_key key ) {
+	t_node *n;
+	key = _MFILTER(key);
+	n = _MNAME(find)(m,key,_MHASH(key));
+	return n ? (vdynamic*)cm_load((void**)&n->value) : NULL;
+}
+
+HL_PRIM bool _MNAME(remove)( t_map *m, t_key key ) {
+	unsigned int hash;
+	cm_stripe *s;
+	t_table *t;
+	t_node **prev, *n;
+	key = _MFILTER(key);
+	hash = _MHASH(key);
+	t = _MNAME(lock_bucket)(m,hash,&s);
+	prev = &t->buckets[hash & t->mask];
+	n = *prev;
+	while( n ) {
+		if( n->hash == hash && _MMATCH(n) ) {
+			// readers already on this node can still follow its next
+			cm_store((void**)prev,n->next);
+			s->count--;
+			hl_mutex_release(s->lock);
+			return true;
+		}
+		prev = &n->next;
+		n = n->next;
+	}
+	hl_mutex_release(s->lock);
+	return false;
+}
+
+static void _MNAME(lock_all)( t_map *m, bool lock ) {
+	int i;
+	if( lock ) {
+		hl_mutex_acquire(m->resize_lock);
+		for(i=0;i<CM_STRIPES;i++)
+			cm_lock(m->stripes[i].lock);
+	} else {
+		for(i=0;i<CM_STRIPES;i++)
+			hl_mutex_release(m->stripes[i].lock);
+		hl_mutex_release(m->resize_lock);
+	}
+}
+
+HL_PRIM varray *_MNAME(keys)( t_map *m ) {
+	varray *a;
+	t_key *keys;
+	t_table *t;
+	int i, p = 0;
+	_MNAME(lock_all)(m,true);
+	t = m->table;
+	a = hl_alloc_array(&hlt_key,_MNAME(size)(m));
+	keys = hl_aptr(a,t_key);
+	for(i=0;i<=t->mask;i++) {
+		t_node *n = t->buckets[i];
+		while( n ) {
+			keys[p++] = n->key;
+			n = n->next;
+		}
+	}
+	_MNAME(lock_all)(m,false);
+	return a;
+}
+
+HL_PRIM varray *_MNAME(values)( t_map *m ) {
+	varray *a;
+	vdynamic **values;
+	t_table *t;
+	int i, p = 0;
+	_MNAME(lock_all)(m,true);
+	t = m->table;
+	a = hl_alloc_array(&hlt_dyn,_MNAME(size)(m));
+	values = hl_aptr(a,vdynamic*);
+	for(i=0;i<=t->mask;i++) {
+		t_node *n = t->buckets[i];
+		while( n ) {
+			values[p++] = n->value;
+			n = n->next;
+		}
+	}
+	_MNAME(lock_all)(m,false);
+	return a;
+}
+
+HL_PRIM void _MNAME(clear)( t_map *m ) {
+	hl_mutex_acquire(m->resize_lock);
+	_MNAME(migrate)(m,m->table,CM_SIZE_INIT,false);
+	hl_mutex_release(m->resize_lock);
+}
+
+#undef hlt_key
+#undef _MKEY_TYPE
+#undef _MNAME
+#undef _MMATCH
+#undef _MHASH
+#undef _MFILTER
@@ -40,6 +40,12 @@
 #else
 #include <errno.h>
 #endif
+#if !defined(HL_WIN) && !defined(HL_CONSOLE)
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
 
 #ifdef HL_WIN_DESKTOP
 #	define SET_IS_STD(f,b) (f)->is_std = b
@@ -224,6 +230,13 @@ HL_PRIM bool hl_file_flush( hl_fdesc *f ) {
 	return ret == 0;
 }
 
+// underlying descriptor, with pending buffered writes flushed so direct accesses see them
+HL_PRIM int hl_file_fd( hl_fdesc *f ) {
+	if( !f || !f->f ) return -1;
+	fflush(f->f);
+	return fileno(f->f);
+}
+
 #define MAKE_STDIO(k) \
 	HL_PRIM hl_fdesc *hl_file_##k() { \
 		hl_fdesc *f; \
@@ -273,6 +286,167 @@ HL_PRIM vbyte *hl_file_contents( vbyte *name, int *size ) {
 	return content;
 }
 
+/*
+	Memory mapped files. The mapping lives outside of the GC heap, so its bytes
+	are never scanned nor moved, but they also become invalid after file_unmap :
+	there is no finalizer since the bytes pointer can outlive the mapping object.
+*/
+typedef struct {
+	vbyte *base;
+	vbyte *ptr;
+	int64 size;
+	int64 map_size;
+#	ifdef HL_WIN
+	HANDLE mapping;
+#	endif
+} hl_fmap;
+
+#define MAP_ADV_NORMAL		0
+#define MAP_ADV_RANDOM		1
+#define MAP_ADV_SEQUENTIAL	2
+#define MAP_ADV_WILLNEED	3
+#define MAP_ADV_DONTNEED	4
+
+HL_PRIM hl_fmap *hl_file_map( vbyte *name, bool write, double offset, double length ) {
+	int64 pos = (int64)offset, len = (int64)length, fsize, start;
+	hl_fmap *m;
+#	if defined(HL_CONSOLE)
+	return NULL;
+#	else
+#	ifdef HL_WIN
+	LARGE_INTEGER li;
+	SYSTEM_INFO si;
+	HANDLE h, mh;
+	vbyte *base;
+	if( pos < 0 ) return NULL;
+	h = CreateFileW((uchar*)name,write ? GENERIC_READ|GENERIC_WRITE : GENERIC_READ,FILE_SHARE_READ|FILE_SHARE_WRITE,NULL,write ? OPEN_ALWAYS : OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+	if( h == INVALID_HANDLE_VALUE ) return NULL;
+	if( !GetFileSizeEx(h,&li) ) {
+		CloseHandle(h);
+		return NULL;
+	}
+	fsize = li.QuadPart;
+#	else
+	struct stat st;
+	vbyte *base;
+	int fd;
+	if( pos < 0 ) return NULL;
+	fd = open((char*)name,(write ? O_RDWR|O_CREAT : O_RDONLY)|O_CLOEXEC,0666);
+	if( fd < 0 ) return NULL;
+	if( fstat(fd,&st) != 0 ) {
+		close(fd);
+		return NULL;
+	}
+	fsize = st.st_size;
+#	endif
+	if( len < 0 ) len = fsize > pos ? fsize - pos : 0;
+	// a writable mapping grows the file to the requested range
+	if( !write && pos + len > fsize ) len = fsize > pos ? fsize - pos : 0;
+	m = (hl_fmap*)hl_gc_alloc_noptr(sizeof(hl_fmap));
+	memset(m,0,sizeof(hl_fmap));
+	m->ptr = (vbyte*)"";
+	if( len == 0 ) {
+#		ifdef HL_WIN
+		CloseHandle(h);
+#		else
+		close(fd);
+#		endif
+		return m;
+	}
+#	ifdef HL_WIN
+	GetSystemInfo(&si);
+	start = pos - pos % si.dwAllocationGranularity;
+	li.QuadPart = pos + len;
+	mh = CreateFileMappingW(h,NULL,write ? PAGE_READWRITE : PAGE_READONLY,li.HighPart,li.LowPart,NULL);
+	CloseHandle(h);
+	if( mh == NULL ) return NULL;
+	base = (vbyte*)MapViewOfFile(mh,write ? FILE_MAP_WRITE : FILE_MAP_READ,(DWORD)(start >> 32),(DWORD)start,(SIZE_T)(pos + len - start));
+	if( base == NULL ) {
+		CloseHandle(mh);
+		return NULL;
+	}
+	m->mapping = mh;
+#	else
+	start = pos - pos % sysconf(_SC_PAGESIZE);
+	if( write && pos + len > fsize && ftruncate(fd,(off_t)(pos + len)) != 0 ) {
+		close(fd);
+		return NULL;
+	}
+	base = (vbyte*)mmap(NULL,(size_t)(pos + len - start),write ? PROT_READ|PROT_WRITE : PROT_READ,MAP_SHARED,fd,(off_t)start);
+	// the mapping keeps its own reference to the file
+	close(fd);
+	if( base == (vbyte*)MAP_FAILED ) return NULL;
+#	endif
+	m->base = base;
+	m->ptr = base + (pos - start);
+	m->size = len;
+	m->map_size = pos + len - start;
+	return m;
+#	endif
+}
+
+HL_PRIM vbyte *hl_file_map_bytes( hl_fmap *m ) {
+	return m ? m->ptr : NULL;
+}
+
+HL_PRIM double hl_file_map_size( hl_fmap *m ) {
+	return m ? (double)m->size : 0.;
+}
+
+HL_PRIM bool hl_file_map_advise( hl_fmap *m, int advice, double pos, double len ) {
+	int64 p = (int64)pos, l = (int64)len, start;
+	if( !m || !m->base || p < 0 || p > m->size ) return false;
+	if( l < 0 || p + l > m->size ) l = m->size - p;
+#	if defined(HL_WIN) || defined(HL_CONSOLE)
+	return false;
+#	else
+	// madvise wants a page aligned address
+	p += m->ptr - m->base;
+	start = p - p % sysconf(_SC_PAGESIZE);
+	{
+		int adv;
+		switch( advice ) {
+		case MAP_ADV_NORMAL: adv = MADV_NORMAL; break;
+		case MAP_ADV_RANDOM: adv = MADV_RANDOM; break;
+		case MAP_ADV_SEQUENTIAL: adv = MADV_SEQUENTIAL; break;
+		case MAP_ADV_WILLNEED: adv = MADV_WILLNEED; break;
+		case MAP_ADV_DONTNEED: adv = MADV_DONTNEED; break;
+		default: return false;
+		}
+		return madvise(m->base + start,(size_t)(p + l - start),adv) == 0;
+	}
+#	endif
+}
+
+HL_PRIM bool hl_file_map_sync( hl_fmap *m, bool async ) {
+	bool ret;
+	if( !m ) return false;
+	if( !m->base ) return true;
+	hl_blocking(true);
+#	if defined(HL_CONSOLE)
+	ret = false;
+#	elif defined(HL_WIN)
+	ret = FlushViewOfFile(m->base,(SIZE_T)m->map_size) != 0;
+#	else
+	ret = msync(m->base,(size_t)m->map_size,async ? MS_ASYNC : MS_SYNC) == 0;
+#	endif
+	hl_blocking(false);
+	return ret;
+}
+
+HL_PRIM void hl_file_unmap( hl_fmap *m ) {
+	if( !m || !m->base ) return;
+#	if defined(HL_WIN)
+	UnmapViewOfFile(m->base);
+	CloseHandle(m->mapping);
+#	elif !defined(HL_CONSOLE)
+	munmap(m->base,(size_t)m->map_size);
+#	endif
+	m->base = NULL;
+	m->ptr = NULL;
+	m->size = 0;
+}
+
 #define _FILE _ABSTRACT(hl_fdesc)
 DEFINE_PRIM(_FILE, file_open, _BYTES _I32 _BOOL);
 DEFINE_PRIM(_VOID, file_close, _FILE);
@@ -292,4 +466,13 @@ DEFINE_PRIM(_FILE, file_stderr, _NO_ARG);
 DEFINE_PRIM(_BYTES, file_contents, _BYTES _REF(_I32));
 DEFINE_PRIM(_BOOL, file_is_locked, _BYTES);
 DEFINE_PRIM(_I32, file_error_code, _NO_ARG);
+DEFINE_PRIM(_I32, file_fd, _FILE);
+
+#define _FMAP _ABSTRACT(hl_fmap)
+DEFINE_PRIM(_FMAP, file_map, _BYTES _BOOL _F64 _F64);
+DEFINE_PRIM(_BYTES, file_map_bytes, _FMAP);
+DEFINE_PRIM(_F64, file_map_size, _FMAP);
+DEFINE_PRIM(_BOOL, file_map_advise, _FMAP _I32 _F64 _F64);
+DEFINE_PRIM(_BOOL, file_map_sync, _FMAP _BOOL);
+DEFINE_PRIM(_VOID, file_unmap, _FMAP);
 
@@ -24,117 +24,89 @@
 #	pragma warning(disable:4034) // sizeof(void) == 0
 #endif
 
-#define H_SIZE_INIT 3
-
-// successive primes that double every time
-static int H_PRIMES[] = {
-	7,17,37,79,163,331,673,1361,2729,5471,10949,21911,43853,87613,175229,350459,700919,1401857,2803727,5607457,11214943,22429903,44859823,89719661,179424673,373587883,776531401,1611623773
-};
-
-// ----- FREE LIST ---------------------------------
+#ifdef HL_WIN
+#	include <intrin.h>
+static unsigned int __inline TRAILING_ZEROES( unsigned int x ) {
+	DWORD msb = 0;
+	if( _BitScanForward( &msb, x ) )
+		return msb;
+	return 32;
+}
+#else
+static inline unsigned int TRAILING_ZEROES( unsigned int x ) {
+	return x ? __builtin_ctz(x) : 32;
+}
+#endif
 
-typedef struct {
-	int pos;
-	int count;
-} hl_free_bucket;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define HL_MAP_SSE2
+#endif
 
-typedef struct {
-	hl_free_bucket *buckets;
-	int head;
-	int nbuckets;
-} hl_free_list;
-
-static void hl_freelist_resize( hl_free_list *f, int newsize ) {
-	hl_free_bucket *buckets = (hl_free_bucket*)hl_gc_alloc_noptr(sizeof(hl_free_bucket)*newsize);
-	memcpy(buckets,f->buckets,f->head * sizeof(hl_free_bucket));
-	f->buckets = buckets;
-	f->nbuckets = newsize;
+/*
+	Maps are open-addressing tables with a power-of-two capacity and one
+	control byte per slot : either H_EMPTY or the top 7 bits of the key hash.
+	Lookups scan H_GROUP control bytes at once starting at the home slot,
+	then only compare the keys whose control byte matches. Probing is linear
+	so removal can shift back the following entries instead of leaving
+	tombstones. The first H_GROUP control bytes are mirrored after the last
+	slot so a group can always be loaded without wrapping.
+*/
+
+#define H_SIZE_INIT 8
+#define H_GROUP		16
+#define H_EMPTY		0x80
+#define H_H2(hash)	((unsigned char)((hash) >> 25))
+
+static HL_INLINE unsigned int hl_map_match( const unsigned char *ctrl, unsigned char h2 ) {
+#	ifdef HL_MAP_SSE2
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(g,_mm_set1_epi8((char)h2)));
+#	else
+	unsigned int bits = 0;
+	int i;
+	for(i=0;i<H_GROUP;i++)
+		if( ctrl[i] == h2 ) bits |= 1 << i;
+	return bits;
+#	endif
 }
 
-static void hl_freelist_init( hl_free_list *f ) {
-	memset(f,0,sizeof(hl_free_list));
+static HL_INLINE unsigned int hl_map_match_empty( const unsigned char *ctrl ) {
+#	ifdef HL_MAP_SSE2
+	return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#	else
+	unsigned int bits = 0;
+	int i;
+	for(i=0;i<H_GROUP;i++)
+		if( ctrl[i] & H_EMPTY ) bits |= 1 << i;
+	return bits;
+#	endif
 }
 
-static void hl_freelist_add_range( hl_free_list *f, int pos, int count ) {
-	hl_free_bucket *b = f->buckets;
-	hl_free_bucket *prev = NULL;
-	if( !b ) {
-		// special handling for countinuous space
-		if( f->nbuckets == 0 ) {
-			f->head = pos;
-			f->nbuckets = count;
-			return;
-		} else if( f->head + f->nbuckets == pos ) {
-			f->nbuckets += count;
-			return;
-		} else if( pos + count == f->head ) {
-			f->head -= count;
-			f->nbuckets += count;
-			return;
-		} else {
-			int cur_pos = f->head, cur_count = f->nbuckets;
-			f->head = 0;
-			f->nbuckets = 0;
-			hl_freelist_resize(f,2);
-			if( cur_count ) hl_freelist_add_range(f,cur_pos,cur_count);
-			b = f->buckets;
-		}
-	}
-	while( b < f->buckets + f->head ) {
-		if( b->pos > pos ) break;
-		prev = b;
-		b++;
-	}
-	if( b < f->buckets + f->head && b->pos == pos + count ) {
-		b->pos -= count;
-		b->count += count;
-		// merge
-		if( prev && prev->pos + prev->count == b->pos ) {
-			prev->count += b->count;
-			memmove(b,b+1,((f->buckets + f->head) - (b+1)) * sizeof(hl_free_bucket));
-			f->head--;
-		}
-		return;
-	}
-	if( prev && prev->pos + prev->count == pos ) {
-		prev->count += count;
-		return;
-	}
-	// insert
-	if( f->head == f->nbuckets ) {
-		int pos = (int)(b - f->buckets);
-		hl_freelist_resize(f,((f->nbuckets * 3) + 1) >> 1);
-		b = f->buckets + pos;
-	}
-	memmove(b+1,b,((f->buckets + f->head) - b) * sizeof(hl_free_bucket));
-	b->pos = pos;
-	b->count = count;
-	f->head++;
+static HL_INLINE void hl_map_set_ctrl( unsigned char *ctrl, int mask, int pos, unsigned char v ) {
+	// keep mirrors in sync (several copies when capacity < H_GROUP)
+	int p;
+	for(p=pos;p<mask+1+H_GROUP;p+=mask+1)
+		ctrl[p] = v;
 }
 
-static void hl_freelist_add( hl_free_list *f, int pos ) {
-	hl_freelist_add_range(f,pos,1);
+// integer keys and pointers need mixing since we index with the low bits
+static HL_INLINE unsigned int hl_map_mix32( unsigned int h ) {
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+	return h;
 }
 
-static int hl_freelist_get( hl_free_list *f ) {
-	hl_free_bucket *b;
-	int p;
-	if( !f->buckets ) {
-		if( f->nbuckets == 0 ) return -1;
-		f->nbuckets--;
-		return f->head++;
-	}
-	if( f->head == 0 )
-		return -1;
-	b = f->buckets + f->head - 1;
-	b->count--;
-	p = b->pos + b->count;
-	if( b->count == 0 ) {
-		f->head--;
-		if( f->head < (f->nbuckets>>1) )
-			hl_freelist_resize(f,f->nbuckets>>1);
-	}
-	return p;
+static HL_INLINE unsigned int hl_map_mix64( uint64 h ) {
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return (unsigned int)h;
 }
 
 #define _MVAL_TYPE vdynamic*
@@ -151,13 +123,14 @@ typedef struct {
 
 #define hlt_key		hlt_i32
 #define hl_hifilter(key) key
-#define hl_hihash(h)	((unsigned)(h))
+#define hl_hihash(h)	hl_map_mix32((unsigned)(h))
 #define _MKEY_TYPE	int
 #define _MNAME(n)	hl_hi##n
 #define _MMATCH(c)	m->entries[c].key == key
 #define _MKEY(m,c)	m->entries[c].key
 #define	_MSET(c)	m->entries[c].key = key
 #define _MERASE(c)
+#define _MKEYHASH(m,c)	hl_hihash(m->entries[c].key)
 
 #include "maps.h"
 
@@ -174,13 +147,14 @@ typedef struct {
 
 #define hlt_key		hlt_i64
 #define hl_hi64filter(key) key
-#define hl_hi64hash(h)	(((unsigned int)h) ^ ((unsigned int)(h>>32)))
+#define hl_hi64hash(h)	hl_map_mix64((uint64)(h))
 #define _MKEY_TYPE	int64
 #define _MNAME(n)	hl_hi64##n
 #define _MMATCH(c)	m->entries[c].key == key
 #define _MKEY(m,c)	m->entries[c].key
 #define	_MSET(c)	m->entries[c].key = key
 #define _MERASE(c)
+#define _MKEYHASH(m,c)	hl_hi64hash(m->entries[c].key)
 
 #include "maps.h"
 
@@ -197,16 +171,50 @@ typedef struct {
 
 #define hlt_key		hlt_bytes
 #define hl_hbfilter(key) key
-#define hl_hbhash(key)	((unsigned)hl_hash_gen(key,false))
+#define hl_hbhash(key)	hl_map_mix32((unsigned)hl_hash_gen(key,false))
 #define _MKEY_TYPE	uchar*
 #define _MNAME(n)	hl_hb##n
 #define _MMATCH(c)	m->entries[c].hash == hash && ucmp(m->values[c].key,key) == 0
 #define _MKEY(m,c)	m->values[c].key
 #define	_MSET(c)	m->entries[c].hash = hash; m->values[c].key = key
 #define _MERASE(c)  m->values[c].key = NULL
+#define _MKEYHASH(m,c)	m->entries[c].hash
 
 #include "maps.h"
 
+// lookup with a one-byte-per-char (Latin-1) key, without widening it
+static int hl_hbfind_latin1( hl_hb_map *m, const unsigned char *key, int len ) {
+	unsigned int hash;
+	unsigned char h2;
+	int pos;
+	if( !m->values ) return -1;
+	hash = hl_map_mix32((unsigned)hl_hash_latin1(key,len));
+	h2 = H_H2(hash);
+	pos = hash & m->mask;
+	while( true ) {
+		unsigned int empty = hl_map_match_empty(m->ctrl + pos);
+		unsigned int bits = hl_map_match(m->ctrl + pos, h2);
+		if( empty ) bits &= empty ^ (empty - 1);
+		while( bits ) {
+			int c = (pos + TRAILING_ZEROES(bits)) & m->mask;
+			if( m->entries[c].hash == hash && ucmp_latin1(m->values[c].key,key,len) == 0 )
+				return c;
+			bits &= bits - 1;
+		}
+		if( empty ) return -1;
+		pos = (pos + H_GROUP) & m->mask;
+	}
+}
+
+HL_PRIM bool hl_hbexists_latin1( hl_hb_map *m, vbyte *key, int len ) {
+	return hl_hbfind_latin1(m,key,len) >= 0;
+}
+
+HL_PRIM vdynamic *hl_hbget_latin1( hl_hb_map *m, vbyte *key, int len ) {
+	int c = hl_hbfind_latin1(m,key,len);
+	return c < 0 ? NULL : m->values[c].value;
+}
+
 // ----- OBJECT MAP ---------------------------------
 
 typedef void hl_ho_entry;
@@ -238,13 +246,14 @@ static vdynamic *hl_hofilter( vdynamic *key ) {
 }
 
 #define hlt_key		hlt_dyn
-#define hl_hohash(key)	((unsigned int)(int_val)(key))
+#define hl_hohash(key)	hl_map_mix64((uint64)(int_val)(key))
 #define _MKEY_TYPE	vdynamic*
 #define _MNAME(n)	hl_ho##n
 #define _MMATCH(c)	m->values[c].key == key
 #define _MKEY(m,c)	m->values[c].key
 #define	_MSET(c)	m->values[c].key = key
 #define _MERASE(c)  m->values[c].key = NULL
+#define _MKEYHASH(m,c)	hl_hohash(m->values[c].key)
 
 #include "maps.h"
 
@@ -261,17 +270,104 @@ typedef struct {
 	int value;
 } hl_mlookup__value;
 
-#define hl_mlookup_hash(h) ((unsigned int)(int_val)(h))
+#define hl_mlookup_hash(h) hl_map_mix64((uint64)(int_val)(h))
 #define _MKEY_TYPE	void*
 #define _MNAME(n)	hl_mlookup_##n
 #define _MMATCH(c)	m->entries[c].key == key
 #define _MKEY(m,c)	m->entries[c].key
 #define	_MSET(c)	m->entries[c].key = key
 #define _MERASE(c)
+#define _MKEYHASH(m,c)	hl_mlookup_hash(m->entries[c].key)
 #define _MNO_EXPORTS
 
 #include "maps.h"
 
+// ----- CONCURRENT MAPS ---------------------------------
+
+/*
+	Thread-safe maps : reads are lock-free, writers lock one of CM_STRIPES
+	mutexes chosen from the key hash. Nodes are GC memory so a removed or
+	migrated node stays valid for readers that are still walking it.
+*/
+
+#define CM_STRIPES		64
+#define CM_SIZE_INIT	CM_STRIPES
+
+typedef struct {
+	hl_mutex *lock;
+	int count;
+	// keep each stripe on its own cache line
+	char __pad[64 - sizeof(void*) - sizeof(int)];
+} cm_stripe;
+
+#if defined(HL_VCC)
+// volatile accesses have acquire/release semantics with MSVC
+static HL_INLINE void *cm_load( void **p ) {
+	return *(void * volatile *)p;
+}
+static HL_INLINE void cm_store( void **p, void *v ) {
+	*(void * volatile *)p = v;
+}
+#else
+static HL_INLINE void *cm_load( void **p ) {
+	return __atomic_load_n(p,__ATOMIC_ACQUIRE);
+}
+static HL_INLINE void cm_store( void **p, void *v ) {
+	__atomic_store_n(p,v,__ATOMIC_RELEASE);
+}
+#endif
+
+static HL_INLINE void cm_lock( hl_mutex *l ) {
+	// avoid entering blocking mode when uncontended
+	if( !hl_mutex_try_acquire(l) )
+		hl_mutex_acquire(l);
+}
+
+#define hlt_key		hlt_i32
+#define _MKEY_TYPE	int
+#define _MNAME(n)	hl_chi##n
+#define _MFILTER(key)	key
+#define _MHASH(key)	hl_hihash(key)
+#define _MMATCH(n)	n->key == key
+
+#include "cmaps.h"
+
+#define hlt_key		hlt_bytes
+#define _MKEY_TYPE	uchar*
+#define _MNAME(n)	hl_chb##n
+#define _MFILTER(key)	key
+#define _MHASH(key)	hl_hbhash(key)
+#define _MMATCH(n)	ucmp(n->key,key) == 0
+
+#include "cmaps.h"
+
+HL_PRIM vdynamic *hl_chbget_latin1( hl_chb_map *m, vbyte *key, int len ) {
+	unsigned int hash = hl_map_mix32((unsigned)hl_hash_latin1(key,len));
+	hl_chb_table *t = (hl_chb_table*)cm_load((void**)&m->table);
+	while( true ) {
+		hl_chb_node *n = (hl_chb_node*)cm_load((void**)&t->buckets[hash & t->mask]);
+		if( n == &hl_chbmoved ) {
+			t = (hl_chb_table*)cm_load((void**)&t->next);
+			continue;
+		}
+		while( n ) {
+			if( n->hash == hash && ucmp_latin1(n->key,key,len) == 0 )
+				return (vdynamic*)cm_load((void**)&n->value);
+			n = (hl_chb_node*)cm_load((void**)&n->next);
+		}
+		return NULL;
+	}
+}
+
+#define hlt_key		hlt_dyn
+#define _MKEY_TYPE	vdynamic*
+#define _MNAME(n)	hl_cho##n
+#define _MFILTER(key)	hl_hofilter(key)
+#define _MHASH(key)	hl_hohash(key)
+#define _MMATCH(n)	n->key == key
+
+#include "cmaps.h"
+
 /// ----------------------------------------------
 
 #define _IMAP _ABSTRACT(hl_int_map)
@@ -301,6 +397,8 @@ DEFINE_PRIM( _BMAP, hballoc, _NO_ARG );
 DEFINE_PRIM( _VOID, hbset, _BMAP _BYTES _DYN );
 DEFINE_PRIM( _BOOL, hbexists, _BMAP _BYTES );
 DEFINE_PRIM( _DYN, hbget, _BMAP _BYTES );
+DEFINE_PRIM( _BOOL, hbexists_latin1, _BMAP _BYTES _I32 );
+DEFINE_PRIM( _DYN, hbget_latin1, _BMAP _BYTES _I32 );
 DEFINE_PRIM( _BOOL, hbremove, _BMAP _BYTES );
 DEFINE_PRIM( _ARR, hbkeys, _BMAP );
 DEFINE_PRIM( _ARR, hbvalues, _BMAP );
@@ -317,3 +415,43 @@ DEFINE_PRIM( _ARR, hokeys, _OMAP );
 DEFINE_PRIM( _ARR, hovalues, _OMAP );
 DEFINE_PRIM( _VOID, hoclear, _OMAP );
 DEFINE_PRIM( _I32, hosize, _OMAP );
+
+#define _CIMAP _ABSTRACT(hl_cint_map)
+DEFINE_PRIM( _CIMAP, chialloc, _NO_ARG );
+DEFINE_PRIM( _VOID, chiset, _CIMAP _I32 _DYN );
+DEFINE_PRIM( _BOOL, chisetifabsent, _CIMAP _I32 _DYN );
+DEFINE_PRIM( _DYN, chicompute, _CIMAP _I32 _FUN(_DYN,_NO_ARG) );
+DEFINE_PRIM( _BOOL, chiexists, _CIMAP _I32 );
+DEFINE_PRIM( _DYN, chiget, _CIMAP _I32 );
+DEFINE_PRIM( _BOOL, chiremove, _CIMAP _I32 );
+DEFINE_PRIM( _ARR, chikeys, _CIMAP );
+DEFINE_PRIM( _ARR, chivalues, _CIMAP );
+DEFINE_PRIM( _VOID, chiclear, _CIMAP );
+DEFINE_PRIM( _I32, chisize, _CIMAP );
+
+#define _CBMAP _ABSTRACT(hl_cbytes_map)
+DEFINE_PRIM( _CBMAP, chballoc, _NO_ARG );
+DEFINE_PRIM( _VOID, chbset, _CBMAP _BYTES _DYN );
+DEFINE_PRIM( _BOOL, chbsetifabsent, _CBMAP _BYTES _DYN );
+DEFINE_PRIM( _DYN, chbcompute, _CBMAP _BYTES _FUN(_DYN,_NO_ARG) );
+DEFINE_PRIM( _BOOL, chbexists, _CBMAP _BYTES );
+DEFINE_PRIM( _DYN, chbget, _CBMAP _BYTES );
+DEFINE_PRIM( _DYN, chbget_latin1, _CBMAP _BYTES _I32 );
+DEFINE_PRIM( _BOOL, chbremove, _CBMAP _BYTES );
+DEFINE_PRIM( _ARR, chbkeys, _CBMAP );
+DEFINE_PRIM( _ARR, chbvalues, _CBMAP );
+DEFINE_PRIM( _VOID, chbclear, _CBMAP );
+DEFINE_PRIM( _I32, chbsize, _CBMAP );
+
+#define _COMAP _ABSTRACT(hl_cobj_map)
+DEFINE_PRIM( _COMAP, choalloc, _NO_ARG );
+DEFINE_PRIM( _VOID, choset, _COMAP _DYN _DYN );
+DEFINE_PRIM( _BOOL, chosetifabsent, _COMAP _DYN _DYN );
+DEFINE_PRIM( _DYN, chocompute, _COMAP _DYN _FUN(_DYN,_NO_ARG) );
+DEFINE_PRIM( _BOOL, choexists, _COMAP _DYN );
+DEFINE_PRIM( _DYN, choget, _COMAP _DYN );
+DEFINE_PRIM( _BOOL, choremove, _COMAP _DYN );
+DEFINE_PRIM( _ARR, chokeys, _COMAP );
+DEFINE_PRIM( _ARR, chovalues, _COMAP );
+DEFINE_PRIM( _VOID, choclear, _COMAP );
+DEFINE_PRIM( _I32, chosize, _COMAP );
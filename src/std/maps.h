@@ -7,9 +7,7 @@
 #define t_map _MNAME(_map)
 #define t_entry _MNAME(_entry)
 #define t_value _MNAME(_value)
-#define _MLIMIT 128
-#define _MINDEX(m,ckey) ((m)->maxentries < _MLIMIT ? (int)((signed char*)(m)->cells)[ckey] : ((int*)(m)->cells)[ckey])
-#define _MNEXT(m,ckey) ((m)->maxentries < _MLIMIT ? (int)((signed char*)(m)->nexts)[ckey] : ((int*)(m)->nexts)[ckey])
+#define _MENTRY_COPY(dst,dc,src,sc) memcpy((char*)(dst)->entries + (dc) * sizeof(t_entry), (char*)(src)->entries + (sc) * sizeof(t_entry), sizeof(t_entry))
 #ifdef _MNO_EXPORTS
 #define _MSTATIC
 #else
@@ -17,12 +15,10 @@
 #endif
 
 typedef struct {
-	void *cells;
-	void *nexts;
+	unsigned char *ctrl;
 	t_entry *entries;
 	t_value *values;
-	hl_free_list lfree;
-	int ncells;
+	int mask;
 	int nentries;
 	int maxentries;
 } t_map;
@@ -36,103 +32,109 @@ t_map *_MNAME(alloc)() {
 	return m;
 }
 
-_MSTATIC _MVAL_TYPE *_MNAME(find)( t_map *m, t_key key ) {
-	int c, ckey;
+static int _MNAME(find_index)( t_map *m, t_key key ) {
 	unsigned int hash;
-
-	if( !m->values ) return NULL;
+	unsigned char h2;
+	int pos;
+	if( !m->values ) return -1;
 	hash = _MNAME(hash)(key);
-	ckey = hash % ((unsigned)m->ncells);
-	c = _MINDEX(m,ckey);
-	while( c >= 0 ) {
-		if( _MMATCH(c) )
-			return &m->values[c].value;
-		c = _MNEXT(m,c);
+	h2 = H_H2(hash);
+	pos = hash & m->mask;
+	while( true ) {
+		unsigned int empty = hl_map_match_empty(m->ctrl + pos);
+		unsigned int bits = hl_map_match(m->ctrl + pos, h2);
+		// slots after the first empty one are not part of our probe sequence
+		if( empty ) bits &= empty ^ (empty - 1);
+		while( bits ) {
+			int c = (pos + TRAILING_ZEROES(bits)) & m->mask;
+			if( _MMATCH(c) )
+				return c;
+			bits &= bits - 1;
+		}
+		if( empty ) return -1;
+		pos = (pos + H_GROUP) & m->mask;
 	}
-	return NULL;
 }
 
-static void _MNAME(resize)( t_map *m );
+_MSTATIC _MVAL_TYPE *_MNAME(find)( t_map *m, t_key key ) {
+	int c = _MNAME(find_index)(m,key);
+	return c < 0 ? NULL : &m->values[c].value;
+}
+
+static int _MNAME(find_empty)( t_map *m, unsigned int hash ) {
+	int pos = hash & m->mask;
+	while( true ) {
+		unsigned int empty = hl_map_match_empty(m->ctrl + pos);
+		if( empty ) return (pos + TRAILING_ZEROES(empty)) & m->mask;
+		pos = (pos + H_GROUP) & m->mask;
+	}
+}
+
+static void _MNAME(resize)( t_map *m ) {
+	// save
+	t_map old = *m;
+	int i;
+	int cap = m->values ? (m->mask + 1) << 1 : H_SIZE_INIT;
+	int csize = cap + H_GROUP;
+
+	m->ctrl = (unsigned char*)hl_gc_alloc_noptr(csize + cap * sizeof(t_entry));
+	m->entries = (t_entry*)(m->ctrl + csize);
+	m->values = (t_value*)hl_gc_alloc_raw(cap * sizeof(t_value));
+	m->mask = cap - 1;
+	// max load factor 3/4
+	m->maxentries = cap - (cap >> 2);
+	memset(m->ctrl,H_EMPTY,csize);
+	memset(m->values,0,cap * sizeof(t_value));
+
+	if( !old.values ) return;
+	for(i=0;i<=old.mask;i++) {
+		unsigned int hash;
+		int c;
+		if( old.ctrl[i] & H_EMPTY ) continue;
+		hash = _MKEYHASH((&old),i);
+		c = _MNAME(find_empty)(m,hash);
+		hl_map_set_ctrl(m->ctrl,m->mask,c,H_H2(hash));
+		_MENTRY_COPY(m,c,&old,i);
+		m->values[c] = old.values[i];
+	}
+}
 
 _MSTATIC void _MNAME(set_impl)( t_map *m, t_key key, _MVAL_TYPE value ) {
-	int c, ckey = 0;
 	unsigned int hash = _MNAME(hash)(key);
+	unsigned char h2 = H_H2(hash);
+	int c = -1;
 	if( m->values ) {
-		ckey = hash % ((unsigned)m->ncells);
-		c = _MINDEX(m,ckey);
-		while( c >= 0 ) {
-			if( _MMATCH(c) ) {
-				m->values[c].value = value;
-				return;
+		int pos = hash & m->mask;
+		while( true ) {
+			unsigned int empty = hl_map_match_empty(m->ctrl + pos);
+			unsigned int bits = hl_map_match(m->ctrl + pos, h2);
+			if( empty ) bits &= empty ^ (empty - 1);
+			while( bits ) {
+				c = (pos + TRAILING_ZEROES(bits)) & m->mask;
+				if( _MMATCH(c) ) {
+					m->values[c].value = value;
+					return;
+				}
+				bits &= bits - 1;
 			}
-			c = _MNEXT(m,c);
+			if( empty ) {
+				// first free slot of the probe sequence
+				c = m->nentries < m->maxentries ? (pos + TRAILING_ZEROES(empty)) & m->mask : -1;
+				break;
+			}
+			pos = (pos + H_GROUP) & m->mask;
 		}
 	}
-	c = hl_freelist_get(&m->lfree);
 	if( c < 0 ) {
 		_MNAME(resize)(m);
-		ckey = hash % ((unsigned)m->ncells);
-		c = hl_freelist_get(&m->lfree);
+		c = _MNAME(find_empty)(m,hash);
 	}
+	hl_map_set_ctrl(m->ctrl,m->mask,c,h2);
 	_MSET(c);
-	if( m->maxentries < _MLIMIT ) {
-		((signed char*)m->nexts)[c] = ((signed char*)m->cells)[ckey];
-		((signed char*)m->cells)[ckey] = (signed char)c;
-	} else {
-		((int*)m->nexts)[c] = ((int*)m->cells)[ckey];
-		((int*)m->cells)[ckey] = c;
-	}
 	m->values[c].value = value;
 	m->nentries++;
 }
 
-static void _MNAME(resize)( t_map *m ) {
-	// save
-	t_map old = *m;
-
-	if( m->nentries != m->maxentries ) hl_error("assert");
-
-	// resize
-	int i = 0;
-	int nentries = m->maxentries ? ((m->maxentries * 3) + 1) >> 1 : H_SIZE_INIT;
-	int ncells = nentries >> 2;
-
-	while( H_PRIMES[i] < ncells ) i++;
-	ncells = H_PRIMES[i];
-
-	int ksize = nentries < _MLIMIT ? 1 : sizeof(int);
-	m->entries = (t_entry*)hl_gc_alloc_noptr(nentries * sizeof(t_entry));
-	m->values = (t_value*)hl_gc_alloc_raw(nentries * sizeof(t_value));
-	m->maxentries = nentries;
-
-	if( old.ncells == ncells && (nentries < _MLIMIT || old.maxentries >= _MLIMIT) ) {
-		// simply expand
-		m->nexts = hl_gc_alloc_noptr(nentries * ksize);
-		memcpy(m->entries,old.entries,old.maxentries * sizeof(t_entry));
-		memcpy(m->values,old.values,old.maxentries * sizeof(t_value));
-		memcpy(m->nexts,old.nexts,old.maxentries * ksize);
-		memset(m->values + old.maxentries, 0, (nentries - old.maxentries) * sizeof(t_value));
-		hl_freelist_add_range(&m->lfree,old.maxentries,m->maxentries - old.maxentries);
-	} else {
-		// expand and remap
-		m->cells = hl_gc_alloc_noptr((ncells + nentries) * ksize);
-		m->nexts = (signed char*)m->cells + ncells * ksize;
-		m->ncells = ncells;
-		m->nentries = 0;
-		memset(m->cells,0xFF,ncells * ksize);
-		memset(m->values, 0, nentries * sizeof(t_value));
-		hl_freelist_init(&m->lfree);
-		hl_freelist_add_range(&m->lfree,0,m->maxentries);
-		for(i=0;i<old.ncells;i++) {
-			int c = old.maxentries < _MLIMIT ? ((signed char*)old.cells)[i] : ((int*)old.cells)[i];
-			while( c >= 0 ) {
-				_MNAME(set_impl)(m,_MKEY((&old),c),old.values[c].value);
-				c = _MNEXT(&old,c);
-			}
-		}
-	}
-}
-
 #ifndef _MNO_EXPORTS
 
 HL_PRIM void _MNAME(set)( t_map *m, t_key key, _MVAL_TYPE value ) {
@@ -150,36 +152,28 @@ HL_PRIM vdynamic* _MNAME(get)( t_map *m, t_key key ) {
 }
 
 HL_PRIM bool _MNAME(remove)( t_map *m, t_key key ) {
-	int c, prev = -1, ckey;
-	unsigned int hash;
-	if( !m->cells ) return false;
-	key = _MNAME(filter)(key);
-	hash = _MNAME(hash)(key);
-	ckey = hash % ((unsigned)m->ncells);
-	c = _MINDEX(m,ckey);
-	while( c >= 0 ) {
-		if( _MMATCH(c) ) {
-			hl_freelist_add(&m->lfree,c);
-			m->nentries--;
-			_MERASE(c);
-			m->values[c].value = NULL;
-			if( m->maxentries < _MLIMIT ) {
-				if( prev >= 0 )
-					((signed char*)m->nexts)[prev] = ((signed char*)m->nexts)[c];
-				else
-					((signed char*)m->cells)[ckey] = ((signed char*)m->nexts)[c];
-			} else {
-				if( prev >= 0 )
-					((int*)m->nexts)[prev] = ((int*)m->nexts)[c];
-				else
-					((int*)m->cells)[ckey] = ((int*)m->nexts)[c];
-			}
-			return true;
+	int c = _MNAME(find_index)(m,_MNAME(filter)(key));
+	int next;
+	if( c < 0 ) return false;
+	m->nentries--;
+	// shift back the following entries of the cluster so we don't need tombstones
+	next = c;
+	while( true ) {
+		int home;
+		next = (next + 1) & m->mask;
+		if( m->ctrl[next] & H_EMPTY ) break;
+		home = _MKEYHASH(m,next) & m->mask;
+		if( ((c - home) & m->mask) < ((next - home) & m->mask) ) {
+			hl_map_set_ctrl(m->ctrl,m->mask,c,m->ctrl[next]);
+			_MENTRY_COPY(m,c,m,next);
+			m->values[c] = m->values[next];
+			c = next;
 		}
-		prev = c;
-		c = _MNEXT(m,c);
 	}
-	return false;
+	hl_map_set_ctrl(m->ctrl,m->mask,c,H_EMPTY);
+	_MERASE(c);
+	m->values[c].value = NULL;
+	return true;
 }
 
 HL_PRIM varray* _MNAME(keys)( t_map *m ) {
@@ -187,13 +181,9 @@ HL_PRIM varray* _MNAME(keys)( t_map *m ) {
 	t_key *keys = hl_aptr(a,t_key);
 	int p = 0;
 	int i;
-	for(i=0;i<m->ncells;i++) {
-		int c = _MINDEX(m,i);
-		while( c >= 0 ) {
-			keys[p++] = _MKEY(m,c);
-			c = _MNEXT(m,c);
-		}
-	}
+	for(i=0;p<m->nentries;i++)
+		if( !(m->ctrl[i] & H_EMPTY) )
+			keys[p++] = _MKEY(m,i);
 	return a;
 }
 
@@ -202,13 +192,9 @@ HL_PRIM varray* _MNAME(values)( t_map *m ) {
 	vdynamic **values = hl_aptr(a,vdynamic*);
 	int p = 0;
 	int i;
-	for(i=0;i<m->ncells;i++) {
-		int c = _MINDEX(m,i);
-		while( c >= 0 ) {
-			values[p++] = m->values[c].value;
-			c = _MNEXT(m,c);
-		}
-	}
+	for(i=0;p<m->nentries;i++)
+		if( !(m->ctrl[i] & H_EMPTY) )
+			values[p++] = m->values[i].value;
 	return a;
 }
 
@@ -230,7 +216,6 @@ HL_PRIM int _MNAME(size)( t_map *m ) {
 #undef _MKEY
 #undef _MSET
 #undef _MERASE
-#undef _MOLD_KEY
-#undef _MINDEX
-#undef _MNEXT
+#undef _MKEYHASH
+#undef _MENTRY_COPY
 #undef _MSTATIC
@@ -98,6 +98,16 @@ HL_PRIM int hl_hash_utf8( const char *name ) {
 	return h;
 }
 
+// same as hl_hash_gen(name,false) on the widened string
+HL_PRIM int hl_hash_latin1( const unsigned char *name, int len ) {
+	int h = 0;
+	int i;
+	for(i=0;i<len && name[i];i++)
+		h = 223 * h + (unsigned)name[i];
+	h %= 0x1FFFFF7B;
+	return h;
+}
+
 HL_PRIM int hl_hash_gen( const uchar *name, bool cache_name ) {
 	int h = 0;
 	const uchar *oname = name;
@@ -1347,5 +1357,6 @@ DEFINE_PRIM(_ARR, obj_fields, _DYN);
 DEFINE_PRIM(_DYN, obj_copy, _DYN);
 DEFINE_PRIM(_DYN, get_virtual_value, _DYN);
 DEFINE_PRIM(_I32, hash, _BYTES);
+DEFINE_PRIM(_I32, hash_latin1, _BYTES _I32);
 DEFINE_PRIM(_BYTES, field_name, _I32);
 
@@ -0,0 +1,193 @@
+/*
+	LSD radix sort, one byte of the key per pass. Included by bytes.c with
+	TRADIX the element type, TKEY the unsigned type of its key, TKEYOF(e) the
+	key of an element (whose unsigned order is the sort order) and TID(name)
+	giving the suffixed name. Passes where all keys share the same byte are
+	skipped. Large arrays are split in chunks sorted by native threads, then
+	merged pairwise with each merge itself split between the threads.
+*/
+#define rs_sort TID(rs_sort)
+#define rs_merge TID(rs_merge)
+#define rs_corank TID(rs_corank)
+#define rs_job TID(rs_job)
+#define rs_job_run TID(rs_job_run)
+#define rs_job_thread TID(rs_job_thread)
+#define rs_run TID(rs_run)
+#define rs_parallel TID(rs_parallel)
+#define radix_sort TID(radix_sort)
+
+static void rs_sort( TRADIX *a, TRADIX *tmp, int n ) {
+	int counts[sizeof(TKEY)][256];
+	TRADIX *src = a, *dst = tmp, *t;
+	int pass, i;
+	if( n < 2 ) return;
+	memset(counts,0,sizeof(counts));
+	for(i=0;i<n;i++) {
+		TKEY k = TKEYOF(a[i]);
+		for(pass=0;pass<(int)sizeof(TKEY);pass++)
+			counts[pass][(k >> (pass << 3)) & 0xFF]++;
+	}
+	for(pass=0;pass<(int)sizeof(TKEY);pass++) {
+		int *c = counts[pass];
+		int shift = pass << 3, sum = 0;
+		if( c[(TKEYOF(src[0]) >> shift) & 0xFF] == n )
+			continue;
+		for(i=0;i<256;i++) {
+			int v = c[i];
+			c[i] = sum;
+			sum += v;
+		}
+		for(i=0;i<n;i++) {
+			TRADIX e = src[i];
+			dst[c[(TKEYOF(e) >> shift) & 0xFF]++] = e;
+		}
+		t = src;
+		src = dst;
+		dst = t;
+	}
+	if( src != a ) memcpy(a,src,n * sizeof(TRADIX));
+}
+
+// stable : on equal keys, elements of a come first
+static void rs_merge( TRADIX *a, int na, TRADIX *b, int nb, TRADIX *out ) {
+	TRADIX *ea = a + na, *eb = b + nb;
+	while( a < ea && b < eb ) {
+		if( TKEYOF(*b) < TKEYOF(*a) )
+			*out++ = *b++;
+		else
+			*out++ = *a++;
+	}
+	while( a < ea ) *out++ = *a++;
+	while( b < eb ) *out++ = *b++;
+}
+
+// how many of the first k merged elements come from a
+static int rs_corank( TRADIX *a, int na, TRADIX *b, int nb, int k ) {
+	int lo = k > nb ? k - nb : 0;
+	int hi = k < na ? k : na;
+	while( lo < hi ) {
+		int i = (lo + hi) >> 1;
+		if( TKEYOF(a[i]) <= TKEYOF(b[k - i - 1]) )
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	return lo;
+}
+
+typedef struct {
+	TRADIX *a;
+	TRADIX *b;
+	TRADIX *out;
+	int na;
+	int nb;
+	hl_semaphore *done;
+} rs_job;
+
+static void rs_job_run( rs_job *j ) {
+	if( j->b )
+		rs_merge(j->a,j->na,j->b,j->nb,j->out);
+	else
+		rs_sort(j->a,j->out,j->na);
+}
+
+static void rs_job_thread( rs_job *j ) {
+	rs_job_run(j);
+	hl_semaphore_release(j->done);
+}
+
+static void rs_run( rs_job *jobs, int count, hl_semaphore *done ) {
+	int i, started = 0;
+	for(i=1;i<count;i++) {
+		jobs[i].done = done;
+		if( hl_thread_start(rs_job_thread,&jobs[i],false) )
+			started++;
+		else
+			rs_job_run(&jobs[i]);
+	}
+	rs_job_run(&jobs[0]);
+	while( started-- > 0 )
+		hl_semaphore_acquire(done);
+}
+
+static void rs_parallel( TRADIX *a, TRADIX *tmp, int n, int nthreads, hl_semaphore *done ) {
+	rs_job jobs[PAR_SORT_MAX_THREADS];
+	int bounds[PAR_SORT_MAX_THREADS + 1];
+	TRADIX *src = a, *dst = tmp, *t;
+	int i, width;
+	for(i=0;i<=nthreads;i++)
+		bounds[i] = (int)(((int64)n * i) / nthreads);
+	for(i=0;i<nthreads;i++) {
+		rs_job *j = &jobs[i];
+		j->a = a + bounds[i];
+		j->b = NULL;
+		j->out = tmp + bounds[i];
+		j->na = bounds[i + 1] - bounds[i];
+	}
+	rs_run(jobs,nthreads,done);
+	for(width=1;width<nthreads;width<<=1) {
+		int count = 0, g, k;
+		for(g=0;g<nthreads;g+=width<<1) {
+			int right = g + width < nthreads ? g + width : nthreads;
+			int last = g + (width << 1) < nthreads ? g + (width << 1) : nthreads;
+			int lo = bounds[g], mid = bounds[right], hi = bounds[last];
+			int pieces = last - g;
+			for(k=0;k<pieces;k++) {
+				rs_job *j = &jobs[count++];
+				int k0 = (int)(((int64)(hi - lo) * k) / pieces);
+				int k1 = (int)(((int64)(hi - lo) * (k + 1)) / pieces);
+				int i0 = rs_corank(src + lo,mid - lo,src + mid,hi - mid,k0);
+				int i1 = rs_corank(src + lo,mid - lo,src + mid,hi - mid,k1);
+				j->a = src + lo + i0;
+				j->na = i1 - i0;
+				j->b = src + mid + (k0 - i0);
+				j->nb = (k1 - i1) - (k0 - i0);
+				j->out = dst + lo + k0;
+			}
+		}
+		rs_run(jobs,count,done);
+		t = src;
+		src = dst;
+		dst = t;
+	}
+	if( src != a ) memcpy(a,src,n * sizeof(TRADIX));
+}
+
+/*
+	Only reads and writes the array content, so the GC can run meanwhile :
+	the array must not contain GC pointers.
+*/
+static void radix_sort( TRADIX *a, int n ) {
+	hl_semaphore *done = NULL;
+	TRADIX *tmp;
+	int nthreads = 1;
+	if( n < 2 ) return;
+	if( n >= PAR_SORT_MIN ) {
+		nthreads = hl_thread_cpu_count();
+		if( nthreads > PAR_SORT_MAX_THREADS ) nthreads = PAR_SORT_MAX_THREADS;
+		if( nthreads > 1 ) done = hl_semaphore_alloc(0);
+	}
+	tmp = (TRADIX*)malloc(n * sizeof(TRADIX));
+	if( tmp == NULL ) hl_error("Out of memory");
+	hl_blocking(true);
+	if( nthreads > 1 )
+		rs_parallel(a,tmp,n,nthreads,done);
+	else
+		rs_sort(a,tmp,n);
+	hl_blocking(false);
+	free(tmp);
+}
+
+#undef rs_sort
+#undef rs_merge
+#undef rs_corank
+#undef rs_job
+#undef rs_job_run
+#undef rs_job_thread
+#undef rs_run
+#undef rs_parallel
+#undef radix_sort
+#undef TRADIX
+#undef TKEY
+#undef TKEYOF
+#undef TID
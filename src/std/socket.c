@@ -28,6 +28,7 @@
 #	include <hl.h>
 #	undef _GUID
 #	include <winsock2.h>
+#	include <io.h>
 #	define FDSIZE(n)	(sizeof(void*) + (n) * sizeof(SOCKET))
 #	define SHUT_WR		SD_SEND
 #	define SHUT_RD		SD_RECEIVE
@@ -44,6 +45,7 @@
 #	ifndef _GNU_SOURCE
 #	define _GNU_SOURCE
 #	endif
+#	define _FILE_OFFSET_BITS 64
 #	include <string.h>
 #	include <sys/types.h>
 #	include <sys/socket.h>
@@ -65,12 +67,21 @@
 	typedef unsigned int _sockaddr;
 #endif
 
+#include <hl.h>
+
 #ifdef HL_LINUX
 #	include <linux/version.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,5,44)
 #	include <sys/epoll.h>
 #	define HAS_EPOLL
 #endif
+#	define HAS_MMSG
+#	define HAS_SENDFILE
+#	include <sys/sendfile.h>
+#	include <linux/errqueue.h>
+#	if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#		define HAS_ZEROCOPY
+#	endif
 #endif
 
 #ifndef HAS_EPOLL
@@ -78,16 +89,29 @@
 #	define EPOLLOUT 0x004
 #endif
 
-#include <hl.h>
-
 #if defined(HL_WIN) || defined(HL_MAC) || defined(HL_IOS) || defined(HL_TVOS)
 #	define MSG_NOSIGNAL 0
 #endif
 
 typedef struct _hl_socket {
 	SOCKET sock;
+#ifdef HAS_SENDFILE
+	// recv_file pipe, created on first use, and the bytes it still holds
+	int pipe[2];
+	int pending;
+#endif
 } hl_socket;
 
+static hl_socket *alloc_socket( SOCKET s ) {
+	hl_socket *hs = (hl_socket*)hl_gc_alloc_noptr(sizeof(hl_socket));
+	hs->sock = s;
+#ifdef HAS_SENDFILE
+	hs->pipe[0] = hs->pipe[1] = -1;
+	hs->pending = 0;
+#endif
+	return hs;
+}
+
 static int block_error() {
 #ifdef HL_WIN
 	int err = WSAGetLastError();
@@ -128,11 +152,7 @@ HL_PRIM hl_socket *hl_socket_new( bool udp ) {
 		if( old >= 0 ) fcntl(s,F_SETFD,old|FD_CLOEXEC);
 	}
 #	endif
-	{
-		hl_socket *hs = hl_gc_alloc_noptr(sizeof(hl_socket));
-		hs->sock = s;
-		return hs;
-	}
+	return alloc_socket(s);
 }
 
 HL_PRIM bool hl_socket_set_broadcast( hl_socket *s, bool b ) {
@@ -146,6 +166,14 @@ HL_PRIM void hl_socket_close( hl_socket *s ) {
 	if( !s ) return;
 	closesocket(s->sock);
 	s->sock = INVALID_SOCKET;
+#ifdef HAS_SENDFILE
+	if( s->pipe[0] >= 0 ) {
+		close(s->pipe[0]);
+		close(s->pipe[1]);
+		s->pipe[0] = s->pipe[1] = -1;
+		s->pending = 0;
+	}
+#endif
 }
 
 HL_PRIM int hl_socket_send_char( hl_socket *s, int c ) {
@@ -292,16 +320,13 @@ HL_PRIM hl_socket *hl_socket_accept( hl_socket *s ) {
 	struct sockaddr_in addr;
 	_sockaddr addrlen = sizeof(addr);
 	SOCKET nsock;
-	hl_socket *hs;
 	if( !s ) return NULL;
 	hl_blocking(true);
 	nsock = accept(s->sock,(struct sockaddr*)&addr,&addrlen);
 	hl_blocking(false);
 	if( nsock == INVALID_SOCKET )
 		return NULL;
-	hs = (hl_socket*)hl_gc_alloc_noptr(sizeof(hl_socket));
-	hs->sock = nsock;
-	return hs;
+	return alloc_socket(nsock);
 }
 
 HL_PRIM bool hl_socket_peer( hl_socket *s, int *host, int *port ) {
@@ -377,6 +402,27 @@ HL_PRIM bool hl_socket_set_fast_send( hl_socket *s, bool b ) {
 	return setsockopt(s->sock,IPPROTO_TCP,TCP_NODELAY,(char*)&fast,sizeof(fast)) == 0;
 }
 
+HL_PRIM bool hl_socket_set_cork( hl_socket *s, bool b ) {
+	int cork = b;
+	if( !s ) return false;
+#if defined(TCP_CORK)
+	return setsockopt(s->sock,IPPROTO_TCP,TCP_CORK,(char*)&cork,sizeof(cork)) == 0;
+#elif defined(TCP_NOPUSH)
+	return setsockopt(s->sock,IPPROTO_TCP,TCP_NOPUSH,(char*)&cork,sizeof(cork)) == 0;
+#else
+	return false;
+#endif
+}
+
+HL_PRIM bool hl_socket_set_busy_poll( hl_socket *s, int usec ) {
+	if( !s ) return false;
+#ifdef SO_BUSY_POLL
+	return setsockopt(s->sock,SOL_SOCKET,SO_BUSY_POLL,(char*)&usec,sizeof(usec)) == 0;
+#else
+	return false;
+#endif
+}
+
 HL_PRIM int hl_socket_send_to( hl_socket *s, char *data, int len, int host, int port ) {
 	struct sockaddr_in addr;
 	if( !s ) return -2;
@@ -410,6 +456,306 @@ HL_PRIM int hl_socket_recv_from( hl_socket *s, char *data, int len, int *host, i
 	return len;
 }
 
+// ----------------- VECTORED / BATCHED I/O
+
+#define HL_IOV_MAX	64
+
+#ifdef HL_WIN
+typedef WSABUF hl_iovec;
+#	define IOV_SET(v,b,l)	(v).buf = (char*)(b); (v).len = (ULONG)(l)
+#else
+typedef struct iovec hl_iovec;
+#	define IOV_SET(v,b,l)	(v).iov_base = (b); (v).iov_len = (size_t)(l)
+#endif
+
+/*
+	bufs is an array of bytes and ranges holds a (pos,len) pair of ints for
+	each of them. At most HL_IOV_MAX buffers are handled per call, the result
+	being the number of bytes transferred as for send/recv. A count <= 0 or a
+	negative pos/len is an error (-2).
+*/
+static int make_iovec( hl_iovec *iov, varray *bufs, int *ranges, int count ) {
+	int i;
+	if( count <= 0 ) return -1;
+	if( count > bufs->size ) count = bufs->size;
+	if( count > HL_IOV_MAX ) count = HL_IOV_MAX;
+	for(i=0;i<count;i++) {
+		vbyte *b = hl_aptr(bufs,vbyte*)[i];
+		int pos = ranges[i<<1], len = ranges[(i<<1)+1];
+		if( pos < 0 || len < 0 ) return -1;
+		IOV_SET(iov[i], b + pos, len);
+	}
+	return count;
+}
+
+HL_PRIM int hl_socket_send_vec( hl_socket *s, varray *bufs, vbyte *ranges, int count ) {
+	hl_iovec iov[HL_IOV_MAX];
+#ifdef HL_WIN
+	DWORD r;
+#else
+	struct msghdr msg;
+	int r;
+#endif
+	if( !s || !bufs ) return -2;
+	count = make_iovec(iov,bufs,(int*)ranges,count);
+	if( count <= 0 ) return -2;
+#ifdef HL_WIN
+	if( WSASend(s->sock,iov,count,&r,0,NULL,NULL) == SOCKET_ERROR )
+		return block_error();
+#else
+	memset(&msg,0,sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	// sendmsg rather than writev for MSG_NOSIGNAL
+	r = sendmsg(s->sock,&msg,MSG_NOSIGNAL);
+	if( r == SOCKET_ERROR )
+		return block_error();
+#endif
+	return (int)r;
+}
+
+HL_PRIM int hl_socket_recv_vec( hl_socket *s, varray *bufs, vbyte *ranges, int count ) {
+	hl_iovec iov[HL_IOV_MAX];
+#ifdef HL_WIN
+	DWORD r, flags = 0;
+	int ret;
+#else
+	struct msghdr msg;
+	int r;
+#endif
+	if( !s || !bufs ) return -2;
+	count = make_iovec(iov,bufs,(int*)ranges,count);
+	if( count <= 0 ) return -2;
+#ifdef HL_WIN
+	hl_blocking(true);
+	ret = WSARecv(s->sock,iov,count,&r,&flags,NULL,NULL);
+	hl_blocking(false);
+	if( ret == SOCKET_ERROR )
+		return block_error();
+#else
+	memset(&msg,0,sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	hl_blocking(true);
+	r = recvmsg(s->sock,&msg,MSG_NOSIGNAL);
+	hl_blocking(false);
+	if( r == SOCKET_ERROR )
+		return block_error();
+#endif
+	return (int)r;
+}
+
+/*
+	Preallocated set of datagram slots of a fixed size, sent or received with
+	a single sendmmsg/recvmmsg call when available. A slot with a zero port is
+	sent without address (connected socket).
+*/
+typedef struct {
+	int count;
+	int size;
+	vbyte *data;
+	int *lens;
+	struct sockaddr_in *addrs;
+#ifdef HAS_MMSG
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+#endif
+} hl_socket_batch;
+
+HL_PRIM hl_socket_batch *hl_socket_batch_alloc( int count, int size ) {
+	hl_socket_batch *b;
+	if( count <= 0 || size <= 0 ) return NULL;
+	// each per datagram array must fit in a single allocation
+	if( count > 0x7FFFFFFF / size || count > 0x7FFFFFFF / (int)sizeof(struct sockaddr_in) ) return NULL;
+#ifdef HAS_MMSG
+	if( count > 0x7FFFFFFF / (int)sizeof(struct mmsghdr) ) return NULL;
+#endif
+	b = (hl_socket_batch*)hl_gc_alloc_raw(sizeof(hl_socket_batch));
+	b->count = count;
+	b->size = size;
+	b->data = (vbyte*)hl_gc_alloc_noptr(count * size);
+	b->lens = (int*)hl_gc_alloc_noptr(count * sizeof(int));
+	b->addrs = (struct sockaddr_in*)hl_gc_alloc_noptr(count * sizeof(struct sockaddr_in));
+	memset(b->lens,0,count * sizeof(int));
+	memset(b->addrs,0,count * sizeof(struct sockaddr_in));
+#ifdef HAS_MMSG
+	// only points into data/addrs which are kept alive by the batch itself
+	b->msgs = (struct mmsghdr*)hl_gc_alloc_noptr(count * sizeof(struct mmsghdr));
+	b->iov = (struct iovec*)hl_gc_alloc_noptr(count * sizeof(struct iovec));
+	memset(b->msgs,0,count * sizeof(struct mmsghdr));
+	{
+		int i;
+		for(i=0;i<count;i++) {
+			b->iov[i].iov_base = b->data + i * size;
+			b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+			b->msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+#endif
+	return b;
+}
+
+HL_PRIM vbyte *hl_socket_batch_data( hl_socket_batch *b, int i ) {
+	if( !b || i < 0 || i >= b->count ) return NULL;
+	return b->data + i * b->size;
+}
+
+HL_PRIM bool hl_socket_batch_set( hl_socket_batch *b, int i, int len, int host, int port ) {
+	struct sockaddr_in *addr;
+	if( !b || i < 0 || i >= b->count || len < 0 || len > b->size ) return false;
+	addr = &b->addrs[i];
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons((unsigned short)port);
+	*(int*)&addr->sin_addr.s_addr = host;
+	b->lens[i] = len;
+	return true;
+}
+
+HL_PRIM int hl_socket_batch_get( hl_socket_batch *b, int i, int *host, int *port ) {
+	if( !b || i < 0 || i >= b->count ) return -1;
+	*host = *(int*)&b->addrs[i].sin_addr;
+	*port = ntohs(b->addrs[i].sin_port);
+	return b->lens[i];
+}
+
+HL_PRIM int hl_socket_send_batch( hl_socket *s, hl_socket_batch *b, int count ) {
+	int i, r;
+	if( !s || !b || count <= 0 ) return -2;
+	if( count > b->count ) count = b->count;
+#ifdef HAS_MMSG
+	for(i=0;i<count;i++) {
+		struct msghdr *m = &b->msgs[i].msg_hdr;
+		bool addr = b->addrs[i].sin_port != 0;
+		m->msg_name = addr ? &b->addrs[i] : NULL;
+		m->msg_namelen = addr ? sizeof(struct sockaddr_in) : 0;
+		b->iov[i].iov_len = b->lens[i];
+	}
+	r = sendmmsg(s->sock,b->msgs,count,MSG_NOSIGNAL);
+	if( r == SOCKET_ERROR )
+		return block_error();
+	return r;
+#else
+	for(i=0;i<count;i++) {
+		char *data = (char*)b->data + i * b->size;
+		if( b->addrs[i].sin_port )
+			r = sendto(s->sock,data,b->lens[i],MSG_NOSIGNAL,(struct sockaddr*)&b->addrs[i],sizeof(struct sockaddr_in));
+		else
+			r = send(s->sock,data,b->lens[i],MSG_NOSIGNAL);
+		if( r == SOCKET_ERROR )
+			return i ? i : block_error();
+	}
+	return count;
+#endif
+}
+
+/*
+	Blocks (when the socket is blocking) until at least one datagram is
+	received, then returns as many as are already available.
+*/
+HL_PRIM int hl_socket_recv_batch( hl_socket *s, hl_socket_batch *b, int count ) {
+	int i, r;
+	if( !s || !b || count <= 0 ) return -2;
+	if( count > b->count ) count = b->count;
+#ifdef HAS_MMSG
+	for(i=0;i<count;i++) {
+		struct msghdr *m = &b->msgs[i].msg_hdr;
+		m->msg_name = &b->addrs[i];
+		m->msg_namelen = sizeof(struct sockaddr_in);
+		b->iov[i].iov_len = b->size;
+	}
+	hl_blocking(true);
+	r = recvmmsg(s->sock,b->msgs,count,MSG_WAITFORONE,NULL);
+	hl_blocking(false);
+	if( r == SOCKET_ERROR )
+		return block_error();
+	for(i=0;i<r;i++)
+		b->lens[i] = b->msgs[i].msg_len;
+	return r;
+#else
+	for(i=0;i<count;i++) {
+		socklen_t slen = sizeof(struct sockaddr_in);
+		int flags = MSG_NOSIGNAL;
+		if( i ) {
+#			ifdef MSG_DONTWAIT
+			flags |= MSG_DONTWAIT;
+#			else
+			break;
+#			endif
+		}
+		if( !i ) hl_blocking(true);
+		r = recvfrom(s->sock,(char*)b->data + i * b->size,b->size,flags,(struct sockaddr*)&b->addrs[i],&slen);
+		if( !i ) hl_blocking(false);
+		if( r == SOCKET_ERROR ) {
+#			ifdef HL_WIN
+			if( WSAGetLastError() == WSAECONNRESET ) r = 0; else
+#			endif
+			return i ? i : block_error();
+		}
+		b->lens[i] = r;
+	}
+	return i;
+#endif
+}
+
+// ----------------- ZERO COPY SEND
+
+/*
+	With MSG_ZEROCOPY the kernel keeps referencing the buffer after send returns :
+	it must be kept alive and left untouched until its send counter has been
+	reported as completed by socket_zerocopy_done. Each successful zero copy send
+	gets the next counter value, starting at 0.
+*/
+HL_PRIM bool hl_socket_set_zerocopy( hl_socket *s, bool b ) {
+#ifdef HAS_ZEROCOPY
+	int v = b;
+	if( !s ) return false;
+	return setsockopt(s->sock,SOL_SOCKET,SO_ZEROCOPY,(char*)&v,sizeof(v)) == 0;
+#else
+	return false;
+#endif
+}
+
+HL_PRIM int hl_socket_send_zerocopy( hl_socket *s, vbyte *buf, int pos, int len ) {
+#ifdef HAS_ZEROCOPY
+	int r;
+	if( !s )
+		return -2;
+	r = send(s->sock, (char*)buf + pos, len, MSG_NOSIGNAL | MSG_ZEROCOPY);
+	if( r == SOCKET_ERROR )
+		return block_error();
+	return r;
+#else
+	return hl_socket_send(s,buf,pos,len);
+#endif
+}
+
+HL_PRIM bool hl_socket_zerocopy_done( hl_socket *s, int *lo, int *hi ) {
+#ifdef HAS_ZEROCOPY
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	char control[128];
+	if( !s ) return false;
+	memset(&msg,0,sizeof(msg));
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if( recvmsg(s->sock,&msg,MSG_ERRQUEUE) == SOCKET_ERROR )
+		return false;
+	for(cm=CMSG_FIRSTHDR(&msg);cm;cm=CMSG_NXTHDR(&msg,cm)) {
+		struct sock_extended_err *e = (struct sock_extended_err*)CMSG_DATA(cm);
+		if( (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR) ) {
+			if( e->ee_errno != 0 || e->ee_origin != SO_EE_ORIGIN_ZEROCOPY )
+				continue;
+			*lo = (int)e->ee_info;
+			*hi = (int)e->ee_data;
+			return true;
+		}
+	}
+	return false;
+#else
+	return false;
+#endif
+}
+
 HL_PRIM int hl_socket_fd_size( int size ) {
 	if( size > FD_SETSIZE )
 		return -1;
@@ -487,6 +833,420 @@ HL_PRIM bool hl_socket_select( varray *ra, varray *wa, varray *ea, char *tmp, in
 	return true;
 }
 
+// ----------------- FILE TRANSFER
+
+/*
+	Transfer a file range from/to a socket without going through a GC buffer.
+	The file offset is explicit and the file position is left untouched.
+	Returns the number of bytes transferred (0 at end of file), -1 if the socket
+	would block and -2 on error.
+*/
+
+typedef struct _hl_fdesc hl_fdesc;
+HL_API int hl_file_fd( hl_fdesc *f );
+
+#define FILE_CHUNK	16384
+
+#ifdef HL_WIN
+// an OVERLAPPED offset still moves the pointer of a synchronous handle, so it is restored
+static int file_pio( int fd, char *buf, int len, int64 pos, bool write ) {
+	HANDLE h = (HANDLE)_get_osfhandle(fd);
+	LARGE_INTEGER zero, cur;
+	OVERLAPPED o;
+	DWORD r;
+	BOOL ok;
+	zero.QuadPart = 0;
+	if( !SetFilePointerEx(h,zero,&cur,FILE_CURRENT) )
+		return -1;
+	memset(&o,0,sizeof(o));
+	o.Offset = (DWORD)pos;
+	o.OffsetHigh = (DWORD)(pos >> 32);
+	ok = write ? WriteFile(h,buf,len,&r,&o) : ReadFile(h,buf,len,&r,&o);
+	if( !ok && !write && GetLastError() == ERROR_HANDLE_EOF ) {
+		ok = TRUE;
+		r = 0;
+	}
+	SetFilePointerEx(h,cur,NULL,FILE_BEGIN);
+	return ok ? (int)r : -1;
+}
+#	define file_pread(fd,buf,len,pos)		file_pio(fd,buf,len,pos,false)
+#	define file_pwrite(fd,buf,len,pos)	file_pio(fd,(char*)(buf),len,pos,true)
+#else
+#	define file_pread(fd,buf,len,pos)		(int)pread(fd,buf,len,(off_t)(pos))
+#	define file_pwrite(fd,buf,len,pos)	(int)pwrite(fd,buf,len,(off_t)(pos))
+#endif
+
+HL_PRIM int hl_socket_send_file( hl_socket *s, hl_fdesc *f, double pos, int len ) {
+	int fd = hl_file_fd(f);
+	int r;
+#ifndef HAS_SENDFILE
+	char buf[FILE_CHUNK];
+#endif
+	if( !s || fd < 0 || pos < 0 || len < 0 ) return -2;
+	hl_blocking(true);
+#ifdef HAS_SENDFILE
+	{
+		off_t off = (off_t)pos;
+		r = (int)sendfile(s->sock,fd,&off,len);
+	}
+#else
+	if( len > FILE_CHUNK ) len = FILE_CHUNK;
+	r = file_pread(fd,buf,len,(int64)pos);
+	if( r > 0 )
+		r = send(s->sock,buf,r,MSG_NOSIGNAL);
+	else if( r < 0 ) {
+		hl_blocking(false);
+		return -2;
+	}
+#endif
+	hl_blocking(false);
+	if( r == SOCKET_ERROR )
+		return block_error();
+	return r;
+}
+
+/*
+	On Linux, bytes already taken from the socket but not written to the file
+	(short write) stay in the socket pipe and are written first by the next
+	call, before anything else is read.
+*/
+HL_PRIM int hl_socket_recv_file( hl_socket *s, hl_fdesc *f, double pos, int len ) {
+	int fd = hl_file_fd(f);
+	int r = 0;
+#ifdef HAS_SENDFILE
+	int total = 0;
+	loff_t off = (loff_t)pos;
+#else
+	char buf[FILE_CHUNK];
+#endif
+	if( !s || fd < 0 || pos < 0 || len < 0 ) return -2;
+	hl_blocking(true);
+#ifdef HAS_SENDFILE
+	// splice socket -> pipe -> file, the data stays in kernel pages
+	if( s->pipe[0] < 0 && pipe(s->pipe) != 0 ) {
+		s->pipe[0] = s->pipe[1] = -1;
+		hl_blocking(false);
+		return -2;
+	}
+	if( s->pending == 0 ) {
+		r = (int)splice(s->sock,NULL,s->pipe[1],NULL,len,SPLICE_F_MOVE);
+		if( r > 0 ) s->pending = r;
+	}
+	if( s->pending > 0 ) {
+		int want = s->pending < len ? s->pending : len;
+		while( total < want ) {
+			int w = (int)splice(s->pipe[0],NULL,fd,&off,want - total,SPLICE_F_MOVE);
+			if( w <= 0 ) break;
+			total += w;
+		}
+		s->pending -= total;
+		r = total || !want ? total : -2;
+	}
+#else
+	if( len > FILE_CHUNK ) len = FILE_CHUNK;
+	r = recv(s->sock,buf,len,MSG_NOSIGNAL);
+	if( r > 0 && file_pwrite(fd,buf,r,(int64)pos) != r )
+		r = -2;
+#endif
+	hl_blocking(false);
+	if( r == SOCKET_ERROR )
+		return block_error();
+	return r;
+}
+
+// ----------------- POLLER
+
+/*
+	Persistent poller : sockets are registered once with an int user data and
+	each wait fills a preallocated buffer with (data,events) pairs. Uses epoll
+	on Linux and poll() elsewhere, where POLLER_EDGE has no effect : level
+	triggered notifications are a superset of edge triggered ones so code that
+	reads/writes until EAGAIN works the same. In that case add/modify/remove
+	must not be called while another thread is waiting on the same poller.
+*/
+
+#define POLLER_READ		1
+#define POLLER_WRITE	2
+#define POLLER_EDGE		4
+#define POLLER_ONESHOT	8
+// reported only
+#define POLLER_ERROR	16
+#define POLLER_HUP		32
+
+#ifdef HL_WIN
+#	define poll(fds,n,t)	WSAPoll(fds,n,t)
+#endif
+
+typedef struct _hl_poller hl_poller;
+struct _hl_poller {
+#ifdef HAS_EPOLL
+	int epfd;
+	int max_events;
+	struct epoll_event *events;
+#else
+	struct pollfd *fds;
+	int *data;
+	int *flags;
+	int count;
+	int size;
+	int cursor;
+	// open addressing socket -> fds index + 1
+	int *slots;
+	int slot_mask;
+#endif
+};
+
+#ifdef HAS_EPOLL
+
+static int poller_epoll_flags( int flags ) {
+	int ev = EPOLLRDHUP;
+	if( flags & POLLER_READ ) ev |= EPOLLIN;
+	if( flags & POLLER_WRITE ) ev |= EPOLLOUT;
+	if( flags & POLLER_EDGE ) ev |= EPOLLET;
+	if( flags & POLLER_ONESHOT ) ev |= EPOLLONESHOT;
+	return ev;
+}
+
+static bool poller_ctl( hl_poller *p, int op, hl_socket *s, int flags, int data ) {
+	struct epoll_event ev;
+	if( !p || !s ) return false;
+	ev.events = poller_epoll_flags(flags);
+	ev.data.u64 = 0;
+	ev.data.fd = data;
+	return epoll_ctl(p->epfd,op,s->sock,&ev) == 0;
+}
+
+HL_PRIM hl_poller *hl_poller_alloc( int size_hint ) {
+	hl_poller *p;
+	int fd = epoll_create1(EPOLL_CLOEXEC);
+	if( fd < 0 )
+		return NULL;
+	p = (hl_poller*)hl_gc_alloc_raw(sizeof(hl_poller));
+	p->epfd = fd;
+	p->max_events = 0;
+	p->events = NULL;
+	return p;
+}
+
+HL_PRIM bool hl_poller_add( hl_poller *p, hl_socket *s, int flags, int data ) {
+	return poller_ctl(p,EPOLL_CTL_ADD,s,flags,data);
+}
+
+HL_PRIM bool hl_poller_modify( hl_poller *p, hl_socket *s, int flags, int data ) {
+	return poller_ctl(p,EPOLL_CTL_MOD,s,flags,data);
+}
+
+HL_PRIM bool hl_poller_remove( hl_poller *p, hl_socket *s ) {
+	return poller_ctl(p,EPOLL_CTL_DEL,s,0,0);
+}
+
+static int poller_wait( hl_poller *p, int *out, int max, int ms ) {
+	int i, n;
+	if( max > p->max_events ) {
+		p->events = (struct epoll_event*)hl_gc_alloc_noptr(max * sizeof(struct epoll_event));
+		p->max_events = max;
+	}
+	hl_blocking(true);
+	n = epoll_wait(p->epfd,p->events,max,ms);
+	hl_blocking(false);
+	if( n < 0 )
+		return errno == EINTR ? 0 : -1;
+	for(i=0;i<n;i++) {
+		int ev = p->events[i].events;
+		int r = 0;
+		if( ev & EPOLLIN ) r |= POLLER_READ;
+		if( ev & EPOLLOUT ) r |= POLLER_WRITE;
+		if( ev & EPOLLERR ) r |= POLLER_ERROR;
+		if( ev & (EPOLLHUP | EPOLLRDHUP) ) r |= POLLER_HUP;
+		*out++ = p->events[i].data.fd;
+		*out++ = r;
+	}
+	return n;
+}
+
+HL_PRIM void hl_poller_close( hl_poller *p ) {
+	if( !p || p->epfd < 0 ) return;
+	close(p->epfd);
+	p->epfd = -1;
+}
+
+#else
+
+static int poller_slot( hl_poller *p, SOCKET s ) {
+	unsigned int h = (unsigned int)s * 0x9E3779B1u;
+	return (int)(h ^ (h >> 15)) & p->slot_mask;
+}
+
+static int poller_find( hl_poller *p, SOCKET s ) {
+	int i = poller_slot(p,s);
+	while( true ) {
+		int k = p->slots[i];
+		if( k == 0 || p->fds[k-1].fd == s ) return i;
+		i = (i + 1) & p->slot_mask;
+	}
+}
+
+static void poller_rehash( hl_poller *p, int nslots ) {
+	int i;
+	p->slots = (int*)hl_gc_alloc_noptr(nslots * sizeof(int));
+	p->slot_mask = nslots - 1;
+	memset(p->slots,0,nslots * sizeof(int));
+	for(i=0;i<p->count;i++)
+		p->slots[poller_find(p,p->fds[i].fd)] = i + 1;
+}
+
+static short poller_poll_flags( int flags ) {
+	short ev = 0;
+	if( flags & POLLER_READ ) ev |= POLLIN;
+	if( flags & POLLER_WRITE ) ev |= POLLOUT;
+	return ev;
+}
+
+HL_PRIM hl_poller *hl_poller_alloc( int size_hint ) {
+	hl_poller *p = (hl_poller*)hl_gc_alloc_raw(sizeof(hl_poller));
+	int size = 16;
+	while( size < size_hint ) size <<= 1;
+	p->fds = (struct pollfd*)hl_gc_alloc_noptr(size * sizeof(struct pollfd));
+	p->data = (int*)hl_gc_alloc_noptr(size * sizeof(int));
+	p->flags = (int*)hl_gc_alloc_noptr(size * sizeof(int));
+	p->count = 0;
+	p->size = size;
+	p->cursor = 0;
+	poller_rehash(p,size << 1);
+	return p;
+}
+
+HL_PRIM bool hl_poller_add( hl_poller *p, hl_socket *s, int flags, int data ) {
+	int slot;
+	if( !p || !s || !p->fds ) return false;
+	if( p->count == p->size ) {
+		int nsize = p->size << 1;
+		struct pollfd *fds = (struct pollfd*)hl_gc_alloc_noptr(nsize * sizeof(struct pollfd));
+		int *ndata = (int*)hl_gc_alloc_noptr(nsize * sizeof(int));
+		int *nflags = (int*)hl_gc_alloc_noptr(nsize * sizeof(int));
+		memcpy(fds,p->fds,p->count * sizeof(struct pollfd));
+		memcpy(ndata,p->data,p->count * sizeof(int));
+		memcpy(nflags,p->flags,p->count * sizeof(int));
+		p->fds = fds;
+		p->data = ndata;
+		p->flags = nflags;
+		p->size = nsize;
+		poller_rehash(p,nsize << 1);
+	}
+	slot = poller_find(p,s->sock);
+	if( p->slots[slot] ) return false;
+	p->fds[p->count].fd = s->sock;
+	p->fds[p->count].events = poller_poll_flags(flags);
+	p->fds[p->count].revents = 0;
+	p->data[p->count] = data;
+	p->flags[p->count] = flags;
+	p->slots[slot] = ++p->count;
+	return true;
+}
+
+HL_PRIM bool hl_poller_modify( hl_poller *p, hl_socket *s, int flags, int data ) {
+	int k;
+	if( !p || !s || !p->fds ) return false;
+	k = p->slots[poller_find(p,s->sock)];
+	if( !k ) return false;
+	p->fds[k-1].events = poller_poll_flags(flags);
+	p->data[k-1] = data;
+	p->flags[k-1] = flags;
+	return true;
+}
+
+HL_PRIM bool hl_poller_remove( hl_poller *p, hl_socket *s ) {
+	int i, j, k, last;
+	if( !p || !s || !p->fds ) return false;
+	i = poller_find(p,s->sock);
+	k = p->slots[i];
+	if( !k ) return false;
+	// backward shift deletion
+	j = i;
+	while( true ) {
+		int h;
+		j = (j + 1) & p->slot_mask;
+		if( p->slots[j] == 0 ) break;
+		h = poller_slot(p,p->fds[p->slots[j]-1].fd);
+		if( ((j - h) & p->slot_mask) >= ((j - i) & p->slot_mask) ) {
+			p->slots[i] = p->slots[j];
+			i = j;
+		}
+	}
+	p->slots[i] = 0;
+	// move the last entry in the freed index
+	last = --p->count;
+	if( k - 1 != last ) {
+		p->slots[poller_find(p,p->fds[last].fd)] = k;
+		p->fds[k-1] = p->fds[last];
+		p->data[k-1] = p->data[last];
+		p->flags[k-1] = p->flags[last];
+	}
+	return true;
+}
+
+static int poller_wait( hl_poller *p, int *out, int max, int ms ) {
+	int i, n, pos, count = 0;
+	if( !p->fds ) return -1;
+	hl_blocking(true);
+	n = poll(p->fds,p->count,ms);
+	hl_blocking(false);
+	if( n < 0 ) {
+#		ifndef HL_WIN
+		if( errno == EINTR ) return 0;
+#		endif
+		return -1;
+	}
+	// start after the last reported socket so none of them can be starved
+	pos = p->cursor;
+	for(i=0;i<p->count && n > 0 && count < max;i++) {
+		struct pollfd *f;
+		int r = 0;
+		if( pos >= p->count ) pos = 0;
+		f = &p->fds[pos];
+		if( f->revents ) {
+			if( f->revents & POLLIN ) r |= POLLER_READ;
+			if( f->revents & POLLOUT ) r |= POLLER_WRITE;
+			if( f->revents & (POLLERR | POLLNVAL) ) r |= POLLER_ERROR;
+			if( f->revents & POLLHUP ) r |= POLLER_HUP;
+			*out++ = p->data[pos];
+			*out++ = r;
+			count++;
+			n--;
+			if( p->flags[pos] & POLLER_ONESHOT ) f->events = 0;
+			f->revents = 0;
+		}
+		pos++;
+	}
+	p->cursor = pos;
+	return count;
+}
+
+HL_PRIM void hl_poller_close( hl_poller *p ) {
+	if( !p ) return;
+	p->fds = NULL;
+	p->data = NULL;
+	p->flags = NULL;
+	p->slots = NULL;
+	p->count = 0;
+}
+
+#endif
+
+HL_PRIM int hl_poller_wait( hl_poller *p, vbyte *events, int max, double timeout ) {
+	int ms;
+	if( !p || max <= 0 ) return -1;
+	if( timeout < 0 )
+		ms = -1;
+	else {
+		// round up so that a small timeout does not turn into busy polling
+		double t = timeout * 1000.;
+		ms = (int)t;
+		if( ms < t ) ms++;
+	}
+	return poller_wait(p,(int*)events,max,ms);
+}
+
 #define _SOCK	_ABSTRACT(hl_socket)
 DEFINE_PRIM(_VOID,socket_init,_NO_ARG);
 DEFINE_PRIM(_SOCK,socket_new,_BOOL);
@@ -510,8 +1270,33 @@ DEFINE_PRIM(_BOOL,socket_set_timeout,_SOCK _F64);
 DEFINE_PRIM(_BOOL,socket_shutdown,_SOCK _BOOL _BOOL);
 DEFINE_PRIM(_BOOL,socket_set_blocking,_SOCK _BOOL);
 DEFINE_PRIM(_BOOL,socket_set_fast_send,_SOCK _BOOL);
+DEFINE_PRIM(_BOOL,socket_set_cork,_SOCK _BOOL);
+DEFINE_PRIM(_BOOL,socket_set_busy_poll,_SOCK _I32);
 
 DEFINE_PRIM(_I32, socket_send_to, _SOCK _BYTES _I32 _I32 _I32);
 DEFINE_PRIM(_I32, socket_recv_from, _SOCK _BYTES _I32 _REF(_I32) _REF(_I32));
+DEFINE_PRIM(_I32, socket_send_vec, _SOCK _ARR _BYTES _I32);
+DEFINE_PRIM(_I32, socket_recv_vec, _SOCK _ARR _BYTES _I32);
+DEFINE_PRIM(_BOOL, socket_set_zerocopy, _SOCK _BOOL);
+DEFINE_PRIM(_I32, socket_send_zerocopy, _SOCK _BYTES _I32 _I32);
+DEFINE_PRIM(_BOOL, socket_zerocopy_done, _SOCK _REF(_I32) _REF(_I32));
+
+#define _BATCH	_ABSTRACT(hl_socket_batch)
+DEFINE_PRIM(_BATCH, socket_batch_alloc, _I32 _I32);
+DEFINE_PRIM(_BYTES, socket_batch_data, _BATCH _I32);
+DEFINE_PRIM(_BOOL, socket_batch_set, _BATCH _I32 _I32 _I32 _I32);
+DEFINE_PRIM(_I32, socket_batch_get, _BATCH _I32 _REF(_I32) _REF(_I32));
+DEFINE_PRIM(_I32, socket_send_batch, _SOCK _BATCH _I32);
+DEFINE_PRIM(_I32, socket_recv_batch, _SOCK _BATCH _I32);
+DEFINE_PRIM(_I32, socket_send_file, _SOCK _ABSTRACT(hl_fdesc) _F64 _I32);
+DEFINE_PRIM(_I32, socket_recv_file, _SOCK _ABSTRACT(hl_fdesc) _F64 _I32);
 DEFINE_PRIM(_I32, socket_fd_size, _I32 );
 DEFINE_PRIM(_BOOL, socket_select, _ARR _ARR _ARR _BYTES _I32 _F64);
+
+#define _POLLER	_ABSTRACT(hl_poller)
+DEFINE_PRIM(_POLLER, poller_alloc, _I32);
+DEFINE_PRIM(_BOOL, poller_add, _POLLER _SOCK _I32 _I32);
+DEFINE_PRIM(_BOOL, poller_modify, _POLLER _SOCK _I32 _I32);
+DEFINE_PRIM(_BOOL, poller_remove, _POLLER _SOCK);
+DEFINE_PRIM(_I32, poller_wait, _POLLER _BYTES _I32 _F64);
+DEFINE_PRIM(_VOID, poller_close, _POLLER);
@@ -6,6 +6,7 @@
 #define ms_rotate TID(ms_rotate)
 #define ms_do_merge TID(ms_do_merge)
 #define merge_sort_rec TID(merge_sort_rec)
+#define merge_sort_buf TID(merge_sort_buf)
 
 typedef struct {
 	TSORT *arr;
@@ -118,6 +119,39 @@ static void merge_sort_rec( m_sort *m, int from, int to ) {
 	ms_do_merge(m, from, middle, to, middle-from, to - middle);
 }
 
+/*
+	Same order as merge_sort_rec, but merges through a buffer of half the
+	range size, which takes O(n log n) compares and moves instead of O(n log² n).
+*/
+static void merge_sort_buf( m_sort *m, TSORT *tmp, int from, int to ) {
+	int middle, i, j, k, len;
+	if( to - from < 12 ) {
+		merge_sort_rec(m, from, to);
+		return;
+	}
+	middle = (from + to)>>1;
+	merge_sort_buf(m, tmp, from, middle);
+	merge_sort_buf(m, tmp, middle, to);
+	if( ms_compare(m, middle, middle - 1) >= 0 )
+		return; // already in order
+	len = middle - from;
+	memcpy(tmp, m->arr + from, len * sizeof(TSORT));
+	i = 0;
+	j = middle;
+	k = from;
+	while( i < len && j < to ) {
+		TSORT v = m->arr[j];
+		int c = m->c->hasValue ? ((int(*)(void*,TSORT,TSORT))m->c->fun)(m->c->value,v,tmp[i]) : ((int(*)(TSORT,TSORT))m->c->fun)(v,tmp[i]);
+		if( c < 0 ) {
+			m->arr[k++] = v;
+			j++;
+		} else
+			m->arr[k++] = tmp[i++];
+	}
+	while( i < len )
+		m->arr[k++] = tmp[i++];
+}
+
 #undef ms_compare
 #undef ms_swap
 #undef ms_lower
@@ -125,6 +159,7 @@ static void merge_sort_rec( m_sort *m, int from, int to ) {
 #undef ms_rotate
 #undef ms_do_merge
 #undef merge_sort_rec
+#undef merge_sort_buf
 #undef m_sort
 #undef TSORT
 #undef TID
@@ -21,40 +21,673 @@
  */
 #include <hl.h>
 
+/*
+	UTF-8 / UTF-16 conversions first try to handle a whole block of ASCII
+	chars with SSE2 (16 bytes) or AVX2 (32 bytes, when the CPU supports it)
+	and only decode one char at a time when a block contains something else.
+	NUL-terminated input can be read a block ahead as long as the block does
+	not cross a page boundary, since then it cannot reach unmapped memory.
+*/
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define HL_UTF_SSE2
+#	if defined(HL_GCC) && (defined(__x86_64__) || defined(__i386__))
+#		include <immintrin.h>
+#		define HL_UTF_AVX2
+#		define UTF_AVX2_FUN __attribute__((target("avx2")))
+#	elif defined(HL_VCC) && defined(_M_X64)
+#		include <immintrin.h>
+#		define HL_UTF_AVX2
+#		define UTF_AVX2_FUN
+#	endif
+#endif
+
+#ifdef HL_UTF_SSE2
+
+#ifdef HL_WIN
+#	include <intrin.h>
+static unsigned int __inline TRAILING_ZEROES( unsigned int x ) {
+	DWORD msb = 0;
+	if( _BitScanForward( &msb, x ) )
+		return msb;
+	return 32;
+}
+#else
+static inline unsigned int TRAILING_ZEROES( unsigned int x ) {
+	return x ? __builtin_ctz(x) : 32;
+}
+#endif
+
+#define UTF_PAGE_SAFE(p,n)	((((int_val)(p)) & 4095) <= 4096 - (n))
+
+#ifdef HL_UTF_AVX2
+static int utf_avx2 = -1;
+
+static bool utf_has_avx2() {
+	if( utf_avx2 < 0 ) {
+#		ifdef HL_VCC
+		int info[4];
+		bool ok = false;
+		__cpuid(info,1);
+		// OSXSAVE + AVX, and the OS saves the YMM registers
+		if( (info[2] & (3 << 27)) == (3 << 27) && (_xgetbv(0) & 6) == 6 ) {
+			__cpuidex(info,7,0);
+			ok = (info[1] & (1 << 5)) != 0;
+		}
+		utf_avx2 = ok;
+#		else
+		__builtin_cpu_init();
+		utf_avx2 = __builtin_cpu_supports("avx2") != 0;
+#		endif
+	}
+	return utf_avx2 != 0;
+}
+
+UTF_AVX2_FUN static int utf8_ascii_avx2( uchar *out, const unsigned char *s ) {
+	__m256i v = _mm256_loadu_si256((const __m256i*)s);
+	unsigned int bad = (unsigned int)(_mm256_movemask_epi8(v) | _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,_mm256_setzero_si256())));
+	if( out ) {
+		_mm256_storeu_si256((__m256i*)out,_mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+		_mm256_storeu_si256((__m256i*)(out + 16),_mm256_cvtepu8_epi16(_mm256_extracti128_si256(v,1)));
+	}
+	return bad ? TRAILING_ZEROES(bad) : 32;
+}
+
+UTF_AVX2_FUN static int utf16_ascii_avx2( vbyte *out, const uchar *s ) {
+	__m256i v = _mm256_loadu_si256((const __m256i*)s);
+	__m256i ascii = _mm256_cmpeq_epi16(_mm256_and_si256(v,_mm256_set1_epi16((short)0xFF80)),_mm256_setzero_si256());
+	__m256i zero = _mm256_cmpeq_epi16(v,_mm256_setzero_si256());
+	unsigned int bad = (unsigned int)_mm256_movemask_epi8(_mm256_andnot_si256(zero,ascii)) ^ 0xFFFFFFFF;
+	if( out ) {
+		__m128i p = _mm_packus_epi16(_mm256_castsi256_si128(v),_mm256_extracti128_si256(v,1));
+		_mm_storeu_si128((__m128i*)out,p);
+	}
+	return bad ? TRAILING_ZEROES(bad) >> 1 : 16;
+}
+#endif
+
+/*
+	Count the non-zero ASCII bytes at the start of the next block of s and,
+	when out is not NULL, widen the whole block into out. Returns -1 if the
+	block can't be read safely.
+*/
+static int utf8_ascii_block( uchar *out, const unsigned char *s, const unsigned char *end ) {
+	__m128i v;
+	unsigned int bad;
+#	ifdef HL_UTF_AVX2
+	if( (end ? end - s >= 32 : UTF_PAGE_SAFE(s,32)) && utf_has_avx2() )
+		return utf8_ascii_avx2(out,s);
+#	endif
+	if( end ? end - s < 16 : !UTF_PAGE_SAFE(s,16) )
+		return -1;
+	v = _mm_loadu_si128((const __m128i*)s);
+	bad = (unsigned int)(_mm_movemask_epi8(v) | _mm_movemask_epi8(_mm_cmpeq_epi8(v,_mm_setzero_si128())));
+	if( out ) {
+		_mm_storeu_si128((__m128i*)out,_mm_unpacklo_epi8(v,_mm_setzero_si128()));
+		_mm_storeu_si128((__m128i*)(out + 8),_mm_unpackhi_epi8(v,_mm_setzero_si128()));
+	}
+	return bad ? TRAILING_ZEROES(bad) : 16;
+}
+
+// same for UTF-16 chars, narrowed into out
+static int utf16_ascii_block( vbyte *out, const uchar *s, const uchar *end ) {
+	__m128i v, ascii, zero;
+	unsigned int bad;
+#	ifdef HL_UTF_AVX2
+	if( (end ? end - s >= 16 : UTF_PAGE_SAFE(s,32)) && utf_has_avx2() )
+		return utf16_ascii_avx2(out,s);
+#	endif
+	if( end ? end - s < 8 : !UTF_PAGE_SAFE(s,16) )
+		return -1;
+	v = _mm_loadu_si128((const __m128i*)s);
+	ascii = _mm_cmpeq_epi16(_mm_and_si128(v,_mm_set1_epi16((short)0xFF80)),_mm_setzero_si128());
+	zero = _mm_cmpeq_epi16(v,_mm_setzero_si128());
+	bad = (unsigned int)_mm_movemask_epi8(_mm_andnot_si128(zero,ascii)) ^ 0xFFFF;
+	if( out ) _mm_storel_epi64((__m128i*)out,_mm_packus_epi16(v,v));
+	return bad ? TRAILING_ZEROES(bad) >> 1 : 8;
+}
+
+#endif
+
+// ----------------- NUMBERS
+
+/*
+	Floats are written with the shortest digits that read back to the same
+	value (Ryu) and read with the Eisel-Lemire algorithm, which is exact
+	except in rare cases that are left to strtod. Both use the table of
+	128-bit powers of five.
+*/
+
+#include <float.h>
+#include <math.h>
+#include "pow5.h"
+
+#if defined(HL_VCC) && defined(_M_X64)
+#	include <intrin.h>
+#endif
+
+static uint64 umul128( uint64 a, uint64 b, uint64 *hi ) {
+#if defined(HL_64) && defined(__SIZEOF_INT128__)
+	unsigned __int128 r = (unsigned __int128)a * b;
+	*hi = (uint64)(r >> 64);
+	return (uint64)r;
+#elif defined(HL_VCC) && defined(_M_X64)
+	return _umul128(a,b,hi);
+#else
+	uint64 a0 = (unsigned int)a, a1 = a >> 32, b0 = (unsigned int)b, b1 = b >> 32;
+	uint64 p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0;
+	uint64 mid = (p00 >> 32) + (unsigned int)p01 + (unsigned int)p10;
+	*hi = a1 * b1 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+	return (mid << 32) | (unsigned int)p00;
+#endif
+}
+
+static int leading_zeroes64( uint64 x ) {
+#if defined(HL_VCC) && defined(_M_X64)
+	unsigned long r;
+	_BitScanReverse64(&r,x);
+	return 63 - (int)r;
+#elif defined(HL_GCC)
+	return __builtin_clzll(x);
+#else
+	int n = 0;
+	while( !(x & ((uint64)1 << 63)) ) {
+		x <<= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+// floor(q * log2(10))
+#define LOG2_POW10(q)	(((q) * 217706) >> 16)
+
+static int pow5_bits( int e ) {
+	return (int)(((unsigned int)e * 1217359) >> 19) + 1;
+}
+
+static int log10_pow2( int e ) {
+	return (int)(((unsigned int)e * 78913) >> 18);
+}
+
+static int log10_pow5( int e ) {
+	return (int)(((unsigned int)e * 732923) >> 20);
+}
+
+static bool multiple_of_pow5( uint64 v, int p ) {
+	int n = 0;
+	while( v % 5 == 0 ) {
+		v /= 5;
+		n++;
+	}
+	return n >= p;
+}
+
+/*
+	Ryu multipliers on 125 bits { low, high } : 5^i truncated, or
+	2^k / 5^i rounded up, taken from the 128-bit table.
+*/
+static void ryu_pow5( int i, bool inv, uint64 *mul ) {
+	const uint64 *p = pow5_128[(inv ? -i : i) - POW5_MIN];
+	if( inv && i == 0 ) {
+		mul[0] = 1;
+		mul[1] = (uint64)1 << 61;
+		return;
+	}
+	mul[0] = (p[1] >> 3) | (p[0] << 61);
+	mul[1] = p[0] >> 3;
+	if( inv && ++mul[0] == 0 ) mul[1]++;
+}
+
+static uint64 mul_shift64( uint64 m, const uint64 *mul, int j ) {
+	uint64 h0, h1, l1, sum;
+	int shift = j - 64;
+	umul128(m,mul[0],&h0);
+	l1 = umul128(m,mul[1],&h1);
+	sum = h0 + l1;
+	if( sum < h0 ) h1++;
+	return (h1 << (64 - shift)) | (sum >> shift);
+}
+
+/*
+	Writes the shortest digits of d > 0 that read back as d (Ryu),
+	returns their count and sets *K so that d = digits * 10^K
+*/
+static int ryu_digits( double d, char *buf, int *K ) {
+	union { double d; uint64 i; } u;
+	uint64 m2, mv, vr, vp, vm, mul[2], output;
+	int e2, e10, removed = 0, n = 0, i;
+	unsigned int be, mm_shift, last = 0;
+	bool accept, vm_zeros = false, vr_zeros = false;
+	char tmp[20];
+	u.d = d;
+	be = (unsigned int)((u.i >> 52) & 0x7FF);
+	m2 = u.i & (((uint64)1 << 52) - 1);
+	mm_shift = m2 != 0 || be <= 1;
+	if( be == 0 )
+		e2 = 1 - 1023 - 52 - 2;
+	else {
+		e2 = (int)be - 1023 - 52 - 2;
+		m2 |= (uint64)1 << 52;
+	}
+	accept = (m2 & 1) == 0;
+	mv = m2 << 2;
+	// the interval of decimals that read back as d
+	if( e2 >= 0 ) {
+		int q = log10_pow2(e2) - (e2 > 3);
+		int j = -e2 + q + 125 + pow5_bits(q) - 1;
+		ryu_pow5(q,true,mul);
+		e10 = q;
+		vr = mul_shift64(mv,mul,j);
+		vp = mul_shift64(mv + 2,mul,j);
+		vm = mul_shift64(mv - 1 - mm_shift,mul,j);
+		if( q <= 21 ) {
+			if( mv % 5 == 0 )
+				vr_zeros = multiple_of_pow5(mv,q);
+			else if( accept )
+				vm_zeros = multiple_of_pow5(mv - 1 - mm_shift,q);
+			else
+				vp -= multiple_of_pow5(mv + 2,q);
+		}
+	} else {
+		int q = log10_pow5(-e2) - (-e2 > 1);
+		int k = -e2 - q;
+		int j = q - (pow5_bits(k) - 125);
+		ryu_pow5(k,false,mul);
+		e10 = q + e2;
+		vr = mul_shift64(mv,mul,j);
+		vp = mul_shift64(mv + 2,mul,j);
+		vm = mul_shift64(mv - 1 - mm_shift,mul,j);
+		if( q <= 1 ) {
+			vr_zeros = true;
+			if( accept )
+				vm_zeros = mm_shift == 1;
+			else
+				vp--;
+		} else if( q < 63 )
+			vr_zeros = (mv & (((uint64)1 << q) - 1)) == 0;
+	}
+	// remove digits while the interval still holds a decimal
+	if( vm_zeros || vr_zeros ) {
+		while( vp / 10 > vm / 10 ) {
+			vm_zeros &= vm % 10 == 0;
+			vr_zeros &= last == 0;
+			last = (unsigned int)(vr % 10);
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		if( vm_zeros ) {
+			while( vm % 10 == 0 ) {
+				vr_zeros &= last == 0;
+				last = (unsigned int)(vr % 10);
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				removed++;
+			}
+		}
+		// round to even when exactly halfway
+		if( vr_zeros && last == 5 && vr % 2 == 0 )
+			last = 4;
+		output = vr + ((vr == vm && (!accept || !vm_zeros)) || last >= 5);
+	} else {
+		bool round_up = false;
+		while( vp / 10 > vm / 10 ) {
+			round_up = vr % 10 >= 5;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		output = vr + (vr == vm || round_up);
+	}
+	*K = e10 + removed;
+	do {
+		tmp[n++] = (char)('0' + output % 10);
+		output /= 10;
+	} while( output );
+	for(i=0;i<n;i++)
+		buf[i] = tmp[n - 1 - i];
+	return n;
+}
+
+// formats as Std.string does into out (at least 32 chars), returns the length
+HL_PRIM int hl_format_float_utf8( double d, char *out ) {
+	union { double d; uint64 i; } u;
+	char digits[20];
+	int n, K, X, i, p = 0;
+	if( d != d ) {
+		memcpy(out,"NaN",3);
+		return 3;
+	}
+	u.d = d;
+	if( u.i >> 63 ) {
+		out[p++] = '-';
+		d = -d;
+	}
+	if( d == 0 ) {
+		out[p++] = '0';
+		return p;
+	}
+	if( d > DBL_MAX ) {
+		memcpy(out + p,"inf",3);
+		return p + 3;
+	}
+	n = ryu_digits(d,digits,&K);
+	while( n > 1 && digits[n - 1] == '0' ) {
+		n--;
+		K++;
+	}
+	// same layout as %.15g : exponent of the first digit decides
+	X = n + K - 1;
+	if( X < -4 || X >= 15 ) {
+		out[p++] = digits[0];
+		if( n > 1 ) {
+			out[p++] = '.';
+			memcpy(out + p,digits + 1,n - 1);
+			p += n - 1;
+		}
+		out[p++] = 'e';
+		out[p++] = X < 0 ? '-' : '+';
+		if( X < 0 ) X = -X;
+		if( X >= 100 ) {
+			out[p++] = (char)('0' + X / 100);
+			X %= 100;
+		}
+		out[p++] = (char)('0' + X / 10);
+		out[p++] = (char)('0' + X % 10);
+	} else if( X < 0 ) {
+		out[p++] = '0';
+		out[p++] = '.';
+		for(i=X+1;i<0;i++)
+			out[p++] = '0';
+		memcpy(out + p,digits,n);
+		p += n;
+	} else if( n <= X + 1 ) {
+		memcpy(out + p,digits,n);
+		p += n;
+		for(i=n;i<=X;i++)
+			out[p++] = '0';
+	} else {
+		memcpy(out + p,digits,X + 1);
+		p += X + 1;
+		out[p++] = '.';
+		memcpy(out + p,digits + X + 1,n - X - 1);
+		p += n - X - 1;
+	}
+	return p;
+}
+
+HL_PRIM int hl_format_float( double d, uchar *out ) {
+	char tmp[32];
+	int i, k = hl_format_float_utf8(d,tmp);
+	for(i=0;i<k;i++)
+		out[i] = tmp[i];
+	return k;
+}
+
+// at least 11 chars
+HL_PRIM int hl_format_int_utf8( int v, char *out ) {
+	char tmp[12];
+	char *p = tmp + 12;
+	int len;
+	unsigned int u = v < 0 ? 0u - (unsigned int)v : (unsigned int)v;
+	do {
+		*--p = (char)('0' + u % 10);
+		u /= 10;
+	} while( u );
+	if( v < 0 ) *--p = '-';
+	len = (int)(tmp + 12 - p);
+	memcpy(out,p,len);
+	return len;
+}
+
 HL_PRIM vbyte *hl_itos( int i, int *len ) {
-	uchar tmp[24];
-	int k = (int)usprintf(tmp,24,USTR("%d"),i);
+	char tmp[12];
+	int k = hl_format_int_utf8(i,tmp);
+	uchar *out = (uchar*)hl_gc_alloc_noptr((k + 1) << 1);
+	for(i=0;i<k;i++)
+		out[i] = tmp[i];
+	out[k] = 0;
 	*len = k;
-	return hl_copy_bytes((vbyte*)tmp,(k + 1)<<1);
+	return (vbyte*)out;
 }
 
 HL_PRIM vbyte *hl_ftos( double d, int *len ) {
-	uchar tmp[24];
-	int k;
-	if( d != d ) {
-		*len = 3;
-		return hl_copy_bytes((vbyte*)USTR("NaN"),8);
-	}
-	// don't use the last digit (eg 5.1 = 5.09999..996)
-	// also cut one more digit for some numbers (eg 86.57 and 85.18) <- to fix since we lose one PI digit
-	k = (int)usprintf(tmp,24,USTR("%.15g"),d);
-#	if defined(HL_WIN) && _MSC_VER <= 1800
-	// fix for window : 1e-5 is printed as 1e-005 whereas it's 1e-05 on other platforms
-	// note : this is VS2013 std bug, VS2015 works correctly
-	{
-		int i;
-		for(i=0;i<k;i++)
-			if( tmp[i] == 'e' ) {
-				if( tmp[i+1] == '+' || tmp[i+1] == '-' ) i++;
-				if( tmp[i+1] != '0' || tmp[i+2] != '0' ) break;
-				memmove(tmp+i+1,tmp+i+2,(k-(i+1))*2);
-				k--;
-				break;
+	char tmp[32];
+	int i, k = hl_format_float_utf8(d,tmp);
+	uchar *out = (uchar*)hl_gc_alloc_noptr((k + 1) << 1);
+	for(i=0;i<k;i++)
+		out[i] = tmp[i];
+	out[k] = 0;
+	*len = k;
+	return (vbyte*)out;
+}
+
+// write into a bytes output (for instance a JSON encoder), returns the byte count
+HL_PRIM int hl_bytes_write_float( vbyte *out, int pos, double d ) {
+	return hl_format_float_utf8(d,(char*)out + pos);
+}
+
+HL_PRIM int hl_bytes_write_int( vbyte *out, int pos, int v ) {
+	return hl_format_int_utf8(v,(char*)out + pos);
+}
+
+static bool eisel_lemire( uint64 w, int q, bool neg, double *out ) {
+	union { double d; uint64 i; } u;
+	const uint64 *p = pow5_128[q - POW5_MIN];
+	uint64 hi, lo, mant;
+	int lz = leading_zeroes64(w), upper, e2;
+	w <<= lz;
+	lo = umul128(w,p[0],&hi);
+	// the truncated low half of the power might carry into the result bits
+	if( (hi & 0x1FF) == 0x1FF && lo + w < lo )
+		return false;
+	upper = (int)(hi >> 63);
+	mant = hi >> (upper + 9);
+	lz += 1 ^ upper;
+	// might be exactly halfway between two doubles
+	if( (hi & 0x1FF) == 0 && (mant & 1) )
+		return false;
+	mant += mant & 1;
+	mant >>= 1;
+	if( mant >= ((uint64)1 << 53) ) {
+		mant = (uint64)1 << 52;
+		lz--;
+	}
+	e2 = LOG2_POW10(q) + 1024 + 63 - lz;
+	// subnormals and overflows
+	if( e2 < 1 || e2 > 2046 )
+		return false;
+	u.i = (mant & ~((uint64)1 << 52)) | ((uint64)e2 << 52) | ((uint64)neg << 63);
+	*out = u.d;
+	return true;
+}
+
+static const double pow10_exact[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define NCHAR(i)	(ucs2 ? ((const uchar*)s)[i] : (unsigned int)s[i])
+#define IS_DIGIT(c)	((c) >= '0' && (c) <= '9')
+
+/*
+	Reads a float like strtod (sign, digits with an optional dot, optional
+	exponent) from at most len UCS-2 or one-byte chars. Returns the count
+	of chars read, 0 if there is no number.
+*/
+static int parse_double( const vbyte *s, int len, bool ucs2, double *out ) {
+	uint64 m = 0;
+	int i = 0, ndigits = 0, nsig = 0, e10 = 0;
+	bool neg = false, truncated = false;
+	unsigned int c;
+	if( len > 0 && ((c = NCHAR(0)) == '-' || c == '+') ) {
+		neg = c == '-';
+		i++;
+	}
+	while( i < len && IS_DIGIT(c = NCHAR(i)) ) {
+		if( nsig < 19 ) {
+			m = m * 10 + (c - '0');
+			if( m ) nsig++;
+		} else {
+			e10++;
+			if( c != '0' ) truncated = true;
+		}
+		ndigits++;
+		i++;
+	}
+	if( i < len && NCHAR(i) == '.' ) {
+		i++;
+		while( i < len && IS_DIGIT(c = NCHAR(i)) ) {
+			if( nsig < 19 ) {
+				m = m * 10 + (c - '0');
+				if( m ) nsig++;
+				e10--;
+			} else if( c != '0' )
+				truncated = true;
+			ndigits++;
+			i++;
+		}
+	}
+	if( ndigits == 0 )
+		return 0;
+	if( i < len && (NCHAR(i) | 0x20) == 'e' ) {
+		int j = i + 1, e = 0;
+		bool eneg = false;
+		if( j < len && ((c = NCHAR(j)) == '-' || c == '+') ) {
+			eneg = c == '-';
+			j++;
+		}
+		if( j < len && IS_DIGIT(NCHAR(j)) ) {
+			while( j < len && IS_DIGIT(c = NCHAR(j)) ) {
+				if( e < 100000 ) e = e * 10 + (c - '0');
+				j++;
 			}
+			e10 += eneg ? -e : e;
+			i = j;
+		}
+	}
+	if( m == 0 ) {
+		*out = neg ? -0. : 0.;
+		return i;
+	}
+#	if !defined(FLT_EVAL_METHOD) || FLT_EVAL_METHOD == 0
+	// exact operands : a single correctly rounded operation
+	if( !truncated && m <= ((uint64)1 << 53) && e10 >= -22 && e10 <= 22 ) {
+		double d = (double)(int64)m;
+		d = e10 < 0 ? d / pow10_exact[-e10] : d * pow10_exact[e10];
+		*out = neg ? -d : d;
+		return i;
 	}
 #	endif
-	*len = k;
-	return hl_copy_bytes((vbyte*)tmp,(k + 1) << 1);
+	if( e10 < POW5_MIN ) {
+		*out = neg ? -0. : 0.;
+		return i;
+	}
+	if( e10 > POW5_MAX ) {
+		*out = neg ? -HUGE_VAL : HUGE_VAL;
+		return i;
+	}
+	{
+		double d, d2;
+		// with more than 19 digits, the value is between m and m+1
+		if( eisel_lemire(m,e10,neg,&d) && (!truncated || (m + 1 != 0 && eisel_lemire(m + 1,e10,neg,&d2) && d == d2)) ) {
+			*out = d;
+			return i;
+		}
+	}
+	{
+		char tmp[64];
+		char *buf = i < 64 ? tmp : (char*)malloc(i + 1);
+		int k;
+		if( buf == NULL ) hl_error("Out of memory");
+		for(k=0;k<i;k++)
+			buf[k] = (char)NCHAR(k);
+		buf[i] = 0;
+		*out = strtod(buf,NULL);
+		if( buf != tmp ) free(buf);
+	}
+	return i;
+}
+
+static inline bool is_space_char(uchar c) {
+	return c == 32 || (c > 8 && c < 14);
+}
+
+HL_PRIM double hl_parse_float( vbyte *bytes, int pos, int len ) {
+	const uchar *str = (uchar*)(bytes+pos);
+	double d;
+	while( len > 0 && is_space_char(*str) ) {
+		str++;
+		len--;
+	}
+	if( !parse_double((vbyte*)str,len,true,&d) )
+		return hl_nan();
+	return d;
+}
+
+HL_PRIM double hl_parse_float_utf8( vbyte *bytes, int pos, int len ) {
+	const vbyte *str = bytes + pos;
+	double d;
+	while( len > 0 && is_space_char(*str) ) {
+		str++;
+		len--;
+	}
+	if( !parse_double(str,len,false,&d) )
+		return hl_nan();
+	return d;
+}
+
+static inline bool has_hex_prefix( const uchar *c, int len, bool is_signed ) {
+	if (is_signed)
+		return len >= 3 && c[1] == '0' && (c[2] == 'x' || c[2] == 'X');
+	return len >= 2 && c[0] == '0' && (c[1] == 'x' || c[1] == 'X');
+}
+
+HL_PRIM vdynamic *hl_parse_int( vbyte *bytes, int pos, int len ) {
+	const uchar *c = (uchar*)(bytes + pos);
+	const uchar *start = c;
+	int h;
+	while( is_space_char(*c) ) c++;
+	uchar sign = c[0];
+	bool is_signed = sign == '-' || sign == '+';
+	if( has_hex_prefix(c,(int)(len+start-c),is_signed) ) {
+		h = 0;
+		c += is_signed ? 3 : 2;
+		while( *c ) {
+			uchar k = *c++;
+			if( k >= '0' && k <= '9' )
+				h = (h << 4) | (k - '0');
+			else if( k >= 'A' && k <= 'F' )
+				h = (h << 4) | ((k - 'A') + 10);
+			else if( k >= 'a' && k <= 'f' )
+				h = (h << 4) | ((k - 'a') + 10);
+			else
+				break;
+		}
+		if( sign == '-' ) h = -h;
+	} else {
+		const uchar *d = c + (is_signed ? 1 : 0);
+		int n = 0;
+		h = 0;
+		// up to 9 digits can't overflow, longer numbers keep the strtol behavior
+		while( n < 9 && IS_DIGIT(d[n]) ) {
+			h = h * 10 + (d[n] - '0');
+			n++;
+		}
+		if( n == 0 )
+			return NULL;
+		if( n == 9 && IS_DIGIT(d[9]) ) {
+			uchar *end = NULL;
+			h = utoi(c,&end);
+		} else if( sign == '-' )
+			h = -h;
+	}
+	return hl_make_dyn(&h,&hlt_i32);
 }
 
 HL_PRIM vbyte *hl_value_to_string( vdynamic *d, int *len ) {
@@ -85,14 +718,25 @@ HL_PRIM int hl_utf8_length( const vbyte *s, int pos ) {
 	s += pos;
 	while( true ) {
 		unsigned char c = (unsigned)*s;
-		len++;
 		if( c < 0x80 ) {
-			if( c == 0 ) {
-				len--;
+			if( c == 0 )
 				break;
+#			ifdef HL_UTF_SSE2
+			{
+				int n = utf8_ascii_block(NULL,s,NULL);
+				if( n > 0 ) {
+					len += n;
+					s += n;
+					continue;
+				}
 			}
+#			endif
+			len++;
 			s++;
-		} else if( c < 0xC0 )
+			continue;
+		}
+		len++;
+		if( c < 0xC0 )
 			return len - 1;
 		else if( c < 0xE0 ) {
 			if( (s[1]&0x80) == 0 ) return len - 1;
@@ -114,6 +758,18 @@ HL_PRIM int hl_from_utf8( uchar *out, int outLen, const char *str ) {
 	int p = 0;
 	unsigned int c, c2, c3;
 	while( p++ < outLen ) {
+#		ifdef HL_UTF_SSE2
+		// room for a full block
+		if( outLen - p >= 31 ) {
+			int n = utf8_ascii_block(out,(const unsigned char*)str,NULL);
+			if( n > 0 ) {
+				out += n;
+				str += n;
+				p += n - 1;
+				continue;
+			}
+		}
+#		endif
 		c = *(unsigned char *)str++;
 		if( c < 0x80 ) {
 			if( c == 0 ) break;
@@ -139,6 +795,47 @@ HL_PRIM int hl_from_utf8( uchar *out, int outLen, const char *str ) {
 	return --p;
 }
 
+/*
+	Tells if len bytes are well-formed UTF-8 : no truncated sequence,
+	overlong encoding, surrogate or code point above 0x10FFFF.
+*/
+HL_PRIM bool hl_utf8_validate( vbyte *str, int pos, int len ) {
+	const unsigned char *s = str + pos, *end = s + len;
+	while( s < end ) {
+		unsigned int c = *s, c2;
+		if( c < 0x80 ) {
+#			ifdef HL_UTF_SSE2
+			// zero bytes end a block but are valid
+			int n = utf8_ascii_block(NULL,s,end);
+			if( n > 0 ) {
+				s += n;
+				continue;
+			}
+#			endif
+			s++;
+			continue;
+		}
+		if( c < 0xC2 || c > 0xF4 )
+			return false;
+		if( end - s < (c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4) )
+			return false;
+		c2 = s[1];
+		if( c < 0xE0 ) {
+			if( (c2 & 0xC0) != 0x80 ) return false;
+			s += 2;
+		} else if( c < 0xF0 ) {
+			if( (c2 & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80 ) return false;
+			if( (c == 0xE0 && c2 < 0xA0) || (c == 0xED && c2 >= 0xA0) ) return false;
+			s += 3;
+		} else {
+			if( (c2 & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80 || (s[3] & 0xC0) != 0x80 ) return false;
+			if( (c == 0xF0 && c2 < 0x90) || (c == 0xF4 && c2 >= 0x90) ) return false;
+			s += 4;
+		}
+	}
+	return true;
+}
+
 HL_PRIM uchar *hl_to_utf16( const char *str ) {
 	int len = hl_utf8_length((vbyte*)str,0);
 	uchar *out = (uchar*)hl_gc_alloc_noptr((len + 1) * sizeof(uchar));
@@ -194,6 +891,38 @@ HL_PRIM vbyte* hl_ucs2_lower( vbyte *str, int pos, int len ) {
 	return (vbyte*)out;
 }
 
+/*
+	Strings where all chars are below 256 can be kept with one byte per char
+	(Latin-1), in half the memory. The *_latin1 primitives take them as is and
+	behave as if they were given the widened UCS-2 string.
+*/
+HL_PRIM vbyte *hl_ucs2_to_latin1( vbyte *str, int pos, int len ) {
+	uchar *cstr = (uchar*)(str + pos);
+	vbyte *out;
+	int i;
+	for(i=0;i<len;i++)
+		if( cstr[i] > 0xFF )
+			return NULL;
+	out = (vbyte*)hl_gc_alloc_noptr(len + 1);
+	for(i=0;i<len;i++)
+		out[i] = (vbyte)cstr[i];
+	out[len] = 0;
+	return out;
+}
+
+HL_PRIM vbyte *hl_latin1_to_ucs2( vbyte *str, int pos, int len ) {
+	uchar *out = (uchar*)hl_gc_alloc_noptr((len + 1) * sizeof(uchar));
+	int i;
+	str += pos;
+	for(i=0;i<len;i++)
+		out[i] = str[i];
+	out[len] = 0;
+	return (vbyte*)out;
+}
+
+// a high surrogate followed by a low one, lone surrogates are encoded as U+FFFD
+#define IS_SURROGATE_PAIR(c,end) ((c)[0] >= 0xD800 && (c)[0] <= 0xDBFF && (c) + 1 != (end) && (c)[1] >= 0xDC00 && (c)[1] <= 0xDFFF)
+
 HL_PRIM vbyte *hl_utf16_to_utf8( vbyte *str, int len, int *size ) {
 	vbyte *out;
 	uchar *c = (uchar*)str;
@@ -203,11 +932,19 @@ HL_PRIM vbyte *hl_utf16_to_utf8( vbyte *str, int len, int *size ) {
 	while( c != end ) {
 		unsigned int v = (unsigned int)*c;
 		if( v == 0 && end == NULL ) break;
-		if( v < 0x80 )
+		if( v < 0x80 ) {
+#			ifdef HL_UTF_SSE2
+			int n = utf16_ascii_block(NULL,c,end);
+			if( n > 0 ) {
+				utf8bytes += n;
+				c += n;
+				continue;
+			}
+#			endif
 			utf8bytes++;
-		else if( v < 0x800 )
+		} else if( v < 0x800 )
 			utf8bytes += 2;
-		else if( v >= 0xD800 && v <= 0xDFFF ) {
+		else if( IS_SURROGATE_PAIR(c,end) ) {
 			utf8bytes += 4;
 			c++;
 		} else
@@ -219,24 +956,37 @@ HL_PRIM vbyte *hl_utf16_to_utf8( vbyte *str, int len, int *size ) {
 	while( c != end ) {
 		unsigned int v = (unsigned int)*c;
 		if( v < 0x80 ) {
+#			ifdef HL_UTF_SSE2
+			// the block is narrowed as a whole : only when there is room for it
+			if( v && utf8bytes - p >= 16 ) {
+				int n = utf16_ascii_block(out + p,c,end);
+				if( n > 0 ) {
+					p += n;
+					c += n;
+					continue;
+				}
+			}
+#			endif
 			out[p++] = (vbyte)v;
 			if( v == 0 && end == NULL ) break;
 		} else if( v < 0x800 ) {
 			out[p++] = (vbyte)(0xC0|(v>>6));
 			out[p++] = (vbyte)(0x80|(v&63));
-		} else if( v >= 0xD800 && v <= 0xDFFF ) {
+		} else if( IS_SURROGATE_PAIR(c,end) ) {
 			int k = ((((int)v - 0xD800) << 10) | (((int)*++c) - 0xDC00)) + 0x10000;
 			out[p++] = (vbyte)(0xF0|(k>>18));
 			out[p++] = (vbyte)(0x80 | ((k >> 12) & 63));
 			out[p++] = (vbyte)(0x80 | ((k >> 6) & 63));
 			out[p++] = (vbyte)(0x80 | (k & 63));
 		} else {
+			if( v >= 0xD800 && v <= 0xDFFF ) v = 0xFFFD;
 			out[p++] = (vbyte)(0xE0|(v>>12));
 			out[p++] = (vbyte)(0x80|((v>>6)&63));
 			out[p++] = (vbyte)(0x80|(v&63));
 		}
 		c++;
 	}
+	if( end ) out[p] = 0;
 	if( size ) *size = utf8bytes;
 	return out;
 }
@@ -253,6 +1003,26 @@ static void hl_buffer_hex( hl_buffer *b, int c ) {
 	hl_buffer_char(b,hex[c&0xF]);
 }
 
+static void hl_buffer_url_char( hl_buffer *b, unsigned int c ) {
+	if( (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' )
+		hl_buffer_char(b,(uchar)c);
+	else if( c < 0x80 ) {
+		hl_buffer_hex(b,c);
+	} else if( c < 0x800 ) {
+		hl_buffer_hex(b, 0xC0|(c>>6));
+		hl_buffer_hex(b, 0x80|(c&63));
+	} else if( c < 0x10000 ) {
+		hl_buffer_hex(b, 0xE0|(c>>12));
+		hl_buffer_hex(b, 0x80|((c>>6)&63));
+		hl_buffer_hex(b, 0x80|(c&63));
+	} else {
+		hl_buffer_hex(b, 0xF0|(c>>18));
+		hl_buffer_hex(b, 0x80|((c >> 12) & 63));
+		hl_buffer_hex(b, 0x80|((c >> 6) & 63));
+		hl_buffer_hex(b, 0x80|(c & 63));
+	}
+}
+
 HL_PRIM vbyte *hl_url_encode( vbyte *str, int *len ) {
 	hl_buffer *b = hl_alloc_buffer();
 	uchar *cstr = (uchar*)str;
@@ -260,38 +1030,27 @@ HL_PRIM vbyte *hl_url_encode( vbyte *str, int *len ) {
 	while( true ) {
 		unsigned int c = (unsigned)*cstr++;
 		if( c == 0 ) break;
-		if( (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' )
-			hl_buffer_char(b,(uchar)c);
-		else {
-			if( c < 0x80 ) {
-				hl_buffer_hex(b,c);
-			} else if( c < 0x800 ) {
-				hl_buffer_hex(b, 0xC0|(c>>6));
-				hl_buffer_hex(b, 0x80|(c&63));
-			} else if( c >= 0xD800 && c <= 0xDBFF ) {
-				sur = (unsigned)*cstr;
-				if( sur >= 0xDC00 && sur < 0xDFFF ) {
-					cstr++;
-					c = ((((int)c - 0xD800) << 10) | ((int)sur - 0xDC00)) + 0x10000;
-					hl_buffer_hex(b, 0xF0|(c>>18));
-					hl_buffer_hex(b, 0x80|((c >> 12) & 63));
-					hl_buffer_hex(b, 0x80|((c >> 6) & 63));
-					hl_buffer_hex(b, 0x80|(c & 63));
-				} else {
-					hl_buffer_hex(b, 0xE0|(c>>12));
-					hl_buffer_hex(b, 0x80|((c>>6)&63));
-					hl_buffer_hex(b, 0x80|(c&63));
-				}
-			} else {
-				hl_buffer_hex(b, 0xE0|(c>>12));
-				hl_buffer_hex(b, 0x80|((c>>6)&63));
-				hl_buffer_hex(b, 0x80|(c&63));
+		if( c >= 0xD800 && c <= 0xDBFF ) {
+			sur = (unsigned)*cstr;
+			if( sur >= 0xDC00 && sur < 0xDFFF ) {
+				cstr++;
+				c = ((((int)c - 0xD800) << 10) | ((int)sur - 0xDC00)) + 0x10000;
 			}
 		}
+		hl_buffer_url_char(b,c);
 	}
 	return (vbyte*)hl_buffer_content(b,len);
 }
 
+HL_PRIM vbyte *hl_url_encode_latin1( vbyte *str, int pos, int len, int *outLen ) {
+	hl_buffer *b = hl_alloc_buffer();
+	int i;
+	str += pos;
+	for(i=0;i<len;i++)
+		hl_buffer_url_char(b,str[i]);
+	return (vbyte*)hl_buffer_content(b,outLen);
+}
+
 static uchar decode_hex_char( uchar c ) {
 	if( c >= '0' && c <= '9' )
 		c -= '0';
@@ -372,12 +1131,21 @@ HL_PRIM vbyte *hl_url_decode( vbyte *str, int *len ) {
 
 DEFINE_PRIM(_BYTES,itos,_I32 _REF(_I32));
 DEFINE_PRIM(_BYTES,ftos,_F64 _REF(_I32));
+DEFINE_PRIM(_I32,bytes_write_float,_BYTES _I32 _F64);
+DEFINE_PRIM(_I32,bytes_write_int,_BYTES _I32 _I32);
+DEFINE_PRIM(_F64,parse_float,_BYTES _I32 _I32);
+DEFINE_PRIM(_F64,parse_float_utf8,_BYTES _I32 _I32);
+DEFINE_PRIM(_NULL(_I32),parse_int,_BYTES _I32 _I32);
 DEFINE_PRIM(_BYTES,value_to_string,_DYN _REF(_I32));
 DEFINE_PRIM(_I32,ucs2length,_BYTES _I32);
 DEFINE_PRIM(_BYTES,utf8_to_utf16,_BYTES _I32 _REF(_I32));
 DEFINE_PRIM(_BYTES,utf16_to_utf8,_BYTES _I32 _REF(_I32));
+DEFINE_PRIM(_BOOL,utf8_validate,_BYTES _I32 _I32);
 DEFINE_PRIM(_BYTES,ucs2_upper,_BYTES _I32 _I32);
 DEFINE_PRIM(_BYTES,ucs2_lower,_BYTES _I32 _I32);
 DEFINE_PRIM(_BYTES,url_encode,_BYTES _REF(_I32));
+DEFINE_PRIM(_BYTES,url_encode_latin1,_BYTES _I32 _I32 _REF(_I32));
+DEFINE_PRIM(_BYTES,ucs2_to_latin1,_BYTES _I32 _I32);
+DEFINE_PRIM(_BYTES,latin1_to_ucs2,_BYTES _I32 _I32);
 DEFINE_PRIM(_BYTES,url_decode,_BYTES _REF(_I32));
 
@@ -1174,3 +1174,807 @@ DEFINE_PRIM(_I32, atomic_load32, _REF(_I32))
 DEFINE_PRIM(_DYN, atomic_load_ptr, _REF(_DYN))
 DEFINE_PRIM(_I32, atomic_store32, _REF(_I32) _I32)
 DEFINE_PRIM(_DYN, atomic_store_ptr, _REF(_DYN) _DYN)
+
+// ----------------- LOCK-FREE QUEUE
+
+/*
+	Multi-producer multi-consumer queue that does not lock on push/pop.
+	Bounded queues are a ring of cells tagged with a sequence number.
+	Unbounded queues are a list of fixed-size segments where each slot is
+	claimed with an atomic increment and written only once, so finished
+	segments are simply left to the GC. Threads only lock to park after
+	spinning on an empty (or full) queue.
+*/
+
+#define QUEUE_SEG		256
+#define QUEUE_SPIN		100
+
+typedef struct _hl_qseg hl_qseg;
+struct _hl_qseg {
+	int enq;
+	int deq;
+	hl_qseg *next;
+	vdynamic *items[QUEUE_SEG];
+};
+
+typedef struct {
+	int seq;
+	vdynamic *msg;
+} hl_qcell;
+
+struct _hl_queue;
+typedef struct _hl_queue hl_queue;
+
+struct _hl_queue {
+	void (*free)( hl_queue * );
+	hl_qseg *head;
+	hl_qcell *cells;
+	int mask;
+	int deq_pos;
+	char __pad1[64];
+	hl_qseg *tail;
+	int enq_pos;
+	char __pad2[64];
+	int spin;
+	int pop_waiters;
+	int push_waiters;
+	int signals;
+#ifdef HL_THREADS
+#	ifdef HL_WIN
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE not_empty;
+	CONDITION_VARIABLE not_full;
+#	else
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+#	endif
+#endif
+};
+
+// stored instead of null messages, since null marks a free slot
+static vdynamic queue_null = { 0 };
+// marks a slot given up by a consumer that got there before its producer
+static vdynamic queue_taken = { 0 };
+
+static void hl_queue_free( hl_queue *q ) {
+	hl_remove_root(&q->head);
+	hl_remove_root(&q->tail);
+	hl_remove_root(&q->cells);
+#	if !defined(HL_THREADS)
+#	elif defined(HL_WIN)
+	DeleteCriticalSection(&q->lock);
+#	else
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+#	endif
+}
+
+HL_PRIM hl_queue *hl_queue_alloc( int capacity ) {
+	hl_queue *q = (hl_queue*)hl_gc_alloc_finalizer(sizeof(hl_queue));
+	memset(q,0,sizeof(hl_queue));
+	q->free = hl_queue_free;
+	q->spin = QUEUE_SPIN;
+	hl_add_root(&q->head);
+	hl_add_root(&q->tail);
+	hl_add_root(&q->cells);
+	if( capacity > 0 ) {
+		// the ring needs at least two cells to tell full from empty
+		int size = 2, i;
+		while( size < capacity ) size <<= 1;
+		q->cells = (hl_qcell*)hl_gc_alloc_raw(size * sizeof(hl_qcell));
+		for(i=0;i<size;i++) {
+			q->cells[i].seq = i;
+			q->cells[i].msg = NULL;
+		}
+		q->mask = size - 1;
+	} else {
+		hl_qseg *s = (hl_qseg*)hl_gc_alloc_raw(sizeof(hl_qseg));
+		memset(s,0,sizeof(hl_qseg));
+		q->head = q->tail = s;
+	}
+#	if !defined(HL_THREADS)
+#	elif defined(HL_WIN)
+	InitializeCriticalSection(&q->lock);
+	InitializeConditionVariable(&q->not_empty);
+	InitializeConditionVariable(&q->not_full);
+#	else
+	pthread_mutex_init(&q->lock,NULL);
+	pthread_cond_init(&q->not_empty,NULL);
+	pthread_cond_init(&q->not_full,NULL);
+#	endif
+	return q;
+}
+
+static void hl_queue_push_seg( hl_queue *q, vdynamic *msg ) {
+	while( true ) {
+		hl_qseg *t = (hl_qseg*)hl_atomic_load_ptr((void**)&q->tail);
+		hl_qseg *next;
+		int idx = hl_atomic_add32(&t->enq,1);
+		if( idx < QUEUE_SEG ) {
+			if( hl_atomic_compare_exchange_ptr((void**)&t->items[idx],NULL,msg) == NULL )
+				return;
+			// a consumer gave up on this slot, take another one
+			continue;
+		}
+		if( t != hl_atomic_load_ptr((void**)&q->tail) )
+			continue;
+		next = (hl_qseg*)hl_atomic_load_ptr((void**)&t->next);
+		if( next == NULL ) {
+			hl_qseg *s = (hl_qseg*)hl_gc_alloc_raw(sizeof(hl_qseg));
+			memset(s,0,sizeof(hl_qseg));
+			s->enq = 1;
+			s->items[0] = msg;
+			if( hl_atomic_compare_exchange_ptr((void**)&t->next,NULL,s) == NULL ) {
+				hl_atomic_compare_exchange_ptr((void**)&q->tail,t,s);
+				return;
+			}
+		} else
+			hl_atomic_compare_exchange_ptr((void**)&q->tail,t,next);
+	}
+}
+
+static vdynamic *hl_queue_pop_seg( hl_queue *q ) {
+	while( true ) {
+		hl_qseg *h = (hl_qseg*)hl_atomic_load_ptr((void**)&q->head);
+		hl_qseg *next;
+		vdynamic *msg;
+		int idx;
+		if( hl_atomic_load32(&h->deq) >= hl_atomic_load32(&h->enq) && hl_atomic_load_ptr((void**)&h->next) == NULL )
+			return NULL;
+		idx = hl_atomic_add32(&h->deq,1);
+		if( idx >= QUEUE_SEG ) {
+			next = (hl_qseg*)hl_atomic_load_ptr((void**)&h->next);
+			if( next == NULL ) return NULL;
+			hl_atomic_compare_exchange_ptr((void**)&q->head,h,next);
+			continue;
+		}
+		msg = (vdynamic*)hl_atomic_exchange_ptr((void**)&h->items[idx],&queue_taken);
+		if( msg == NULL ) continue;
+		return msg;
+	}
+}
+
+static int hl_queue_push_ring( hl_queue *q, vdynamic **msgs, int count ) {
+	unsigned int pos = (unsigned int)hl_atomic_load32(&q->enq_pos);
+	while( true ) {
+		int n = 0, dif = 0, i;
+		unsigned int cur;
+		// claim as many consecutive free cells as possible
+		while( n < count ) {
+			dif = hl_atomic_load32(&q->cells[(pos + n) & q->mask].seq) - (int)(pos + n);
+			if( dif != 0 ) break;
+			n++;
+		}
+		if( n == 0 ) {
+			if( dif < 0 ) return 0; // full
+			pos = (unsigned int)hl_atomic_load32(&q->enq_pos);
+			continue;
+		}
+		cur = (unsigned int)hl_atomic_compare_exchange32(&q->enq_pos,(int)pos,(int)(pos + n));
+		if( cur != pos ) {
+			pos = cur;
+			continue;
+		}
+		for(i=0;i<n;i++) {
+			hl_qcell *c = &q->cells[(pos + i) & q->mask];
+			c->msg = msgs[i] ? msgs[i] : &queue_null;
+			hl_atomic_store32(&c->seq,(int)(pos + i + 1));
+		}
+		return n;
+	}
+}
+
+static int hl_queue_pop_ring( hl_queue *q, vdynamic **msgs, int count ) {
+	unsigned int pos = (unsigned int)hl_atomic_load32(&q->deq_pos);
+	while( true ) {
+		int n = 0, dif = 0, i;
+		unsigned int cur;
+		while( n < count ) {
+			dif = hl_atomic_load32(&q->cells[(pos + n) & q->mask].seq) - (int)(pos + n + 1);
+			if( dif != 0 ) break;
+			n++;
+		}
+		if( n == 0 ) {
+			if( dif < 0 ) return 0; // empty
+			pos = (unsigned int)hl_atomic_load32(&q->deq_pos);
+			continue;
+		}
+		cur = (unsigned int)hl_atomic_compare_exchange32(&q->deq_pos,(int)pos,(int)(pos + n));
+		if( cur != pos ) {
+			pos = cur;
+			continue;
+		}
+		for(i=0;i<n;i++) {
+			hl_qcell *c = &q->cells[(pos + i) & q->mask];
+			msgs[i] = c->msg;
+			c->msg = NULL;
+			hl_atomic_store32(&c->seq,(int)(pos + i + q->mask + 1));
+		}
+		return n;
+	}
+}
+
+static int hl_queue_try_push( hl_queue *q, vdynamic **msgs, int count ) {
+	int i;
+	if( q->cells )
+		return hl_queue_push_ring(q,msgs,count);
+	for(i=0;i<count;i++)
+		hl_queue_push_seg(q,msgs[i] ? msgs[i] : &queue_null);
+	return count;
+}
+
+static int hl_queue_try_pop( hl_queue *q, vdynamic **msgs, int count ) {
+	int i, n = 0;
+	if( q->cells )
+		n = hl_queue_pop_ring(q,msgs,count);
+	else {
+		while( n < count ) {
+			vdynamic *msg = hl_queue_pop_seg(q);
+			if( msg == NULL ) break;
+			msgs[n++] = msg;
+		}
+	}
+	for(i=0;i<n;i++)
+		if( msgs[i] == &queue_null ) msgs[i] = NULL;
+	return n;
+}
+
+static void hl_queue_wake( hl_queue *q, int *waiters ) {
+#	ifdef HL_THREADS
+	if( hl_atomic_load32(waiters) == 0 )
+		return;
+#	ifdef HL_WIN
+	EnterCriticalSection(&q->lock);
+	q->signals++;
+	WakeAllConditionVariable(waiters == &q->pop_waiters ? &q->not_empty : &q->not_full);
+	LeaveCriticalSection(&q->lock);
+#	else
+	pthread_mutex_lock(&q->lock);
+	q->signals++;
+	pthread_cond_broadcast(waiters == &q->pop_waiters ? &q->not_empty : &q->not_full);
+	pthread_mutex_unlock(&q->lock);
+#	endif
+#	endif
+}
+
+/*
+	Run an operation, spinning then parking until it makes progress.
+	Waiters are counted before each attempt, so a thread making progress on
+	the other side either sees them and bumps the signal counter, or its
+	change is seen by the attempt. The operation itself never runs while
+	we are in blocking mode since it reads and writes GC memory.
+*/
+static int hl_queue_wait( hl_queue *q, bool push, vdynamic **msgs, int count ) {
+	int (*op)( hl_queue *, vdynamic **, int ) = push ? hl_queue_try_push : hl_queue_try_pop;
+	int *waiters = push ? &q->push_waiters : &q->pop_waiters;
+	int n, i;
+	for(i=0;i<q->spin;i++) {
+		n = op(q,msgs,count);
+		if( n ) return n;
+		if( i > (q->spin >> 1) ) hl_thread_yield();
+	}
+#	ifndef HL_THREADS
+	return op(q,msgs,count);
+#	else
+	hl_atomic_add32(waiters,1);
+	while( true ) {
+		int seen = hl_atomic_load32(&q->signals);
+		n = op(q,msgs,count);
+		if( n ) break;
+		hl_blocking(true);
+#		ifdef HL_WIN
+		EnterCriticalSection(&q->lock);
+		while( q->signals == seen )
+			SleepConditionVariableCS(push ? &q->not_full : &q->not_empty,&q->lock,INFINITE);
+		LeaveCriticalSection(&q->lock);
+#		else
+		pthread_mutex_lock(&q->lock);
+		while( q->signals == seen )
+			pthread_cond_wait(push ? &q->not_full : &q->not_empty,&q->lock);
+		pthread_mutex_unlock(&q->lock);
+#		endif
+		hl_blocking(false);
+	}
+	hl_atomic_sub32(waiters,1);
+	return n;
+#	endif
+}
+
+HL_PRIM bool hl_queue_push( hl_queue *q, vdynamic *msg, bool block ) {
+	int n = hl_queue_try_push(q,&msg,1);
+	if( n == 0 && block ) n = hl_queue_wait(q,true,&msg,1);
+	if( n ) hl_queue_wake(q,&q->pop_waiters);
+	return n != 0;
+}
+
+HL_PRIM vdynamic *hl_queue_pop( hl_queue *q, bool block ) {
+	vdynamic *msg = NULL;
+	int n = hl_queue_try_pop(q,&msg,1);
+	if( n == 0 && block ) n = hl_queue_wait(q,false,&msg,1);
+	if( n && q->cells ) hl_queue_wake(q,&q->push_waiters);
+	return msg;
+}
+
+HL_PRIM int hl_queue_push_batch( hl_queue *q, varray *a, int pos, int len, bool block ) {
+	int n;
+	if( pos < 0 || len < 0 || pos + len > a->size ) hl_error("Invalid array pos or length");
+	if( len == 0 ) return 0;
+	n = hl_queue_try_push(q,hl_aptr(a,vdynamic*) + pos,len);
+	if( n == 0 && block ) n = hl_queue_wait(q,true,hl_aptr(a,vdynamic*) + pos,len);
+	if( n ) hl_queue_wake(q,&q->pop_waiters);
+	return n;
+}
+
+HL_PRIM int hl_queue_pop_batch( hl_queue *q, varray *a, int pos, int len, bool block ) {
+	int n;
+	if( pos < 0 || len < 0 || pos + len > a->size ) hl_error("Invalid array pos or length");
+	if( len == 0 ) return 0;
+	n = hl_queue_try_pop(q,hl_aptr(a,vdynamic*) + pos,len);
+	if( n == 0 && block ) n = hl_queue_wait(q,false,hl_aptr(a,vdynamic*) + pos,len);
+	if( n && q->cells ) hl_queue_wake(q,&q->push_waiters);
+	return n;
+}
+
+HL_PRIM int hl_queue_size( hl_queue *q ) {
+	int size = 0;
+	if( q->cells )
+		size = hl_atomic_load32(&q->enq_pos) - hl_atomic_load32(&q->deq_pos);
+	else {
+		hl_qseg *s = (hl_qseg*)hl_atomic_load_ptr((void**)&q->head);
+		while( s ) {
+			int enq = hl_atomic_load32(&s->enq), deq = hl_atomic_load32(&s->deq);
+			if( enq > QUEUE_SEG ) enq = QUEUE_SEG;
+			if( enq > deq ) size += enq - deq;
+			s = (hl_qseg*)hl_atomic_load_ptr((void**)&s->next);
+		}
+	}
+	return size < 0 ? 0 : size;
+}
+
+HL_PRIM void hl_queue_set_spin( hl_queue *q, int spin ) {
+	q->spin = spin < 0 ? 0 : spin;
+}
+
+#define _QUEUE _ABSTRACT(hl_queue)
+DEFINE_PRIM(_QUEUE, queue_alloc, _I32);
+DEFINE_PRIM(_BOOL, queue_push, _QUEUE _DYN _BOOL);
+DEFINE_PRIM(_DYN, queue_pop, _QUEUE _BOOL);
+DEFINE_PRIM(_I32, queue_push_batch, _QUEUE _ARR _I32 _I32 _BOOL);
+DEFINE_PRIM(_I32, queue_pop_batch, _QUEUE _ARR _I32 _I32 _BOOL);
+DEFINE_PRIM(_I32, queue_size, _QUEUE);
+DEFINE_PRIM(_VOID, queue_set_spin, _QUEUE _I32);
+
+// ----------------- TASK POOL
+
+/*
+	Work-stealing thread pool. Each worker owns a deque of tasks : it pushes
+	and pops at the bottom while idle workers steal from the top. Tasks
+	submitted from outside the pool go through a shared lock-free queue.
+	Threads waiting for a task group help running tasks instead of sleeping,
+	and only park once there is nothing left to run. Old deque buffers are
+	left to the GC so steals never read freed memory.
+*/
+
+#define POOL_SPIN		64
+#define POOL_DEQUE_INIT	64
+#define POOL_MAX_WORKERS	256
+
+struct _hl_pool;
+struct _hl_pool_group;
+typedef struct _hl_pool hl_pool;
+typedef struct _hl_pool_group hl_pool_group;
+
+typedef struct {
+	vclosure *fun;
+	hl_pool_group *group;
+	int start;
+	int end;
+	int grain;
+} hl_pool_task;
+
+typedef struct {
+	int mask;
+	hl_pool_task *items[1];
+} hl_pool_buf;
+
+typedef struct {
+	int top;
+	char __pad1[64];
+	int bottom;
+	hl_pool_buf *buf;
+	hl_pool *pool;
+	unsigned int rnd;
+	char __pad2[64];
+} hl_pool_worker;
+
+struct _hl_pool {
+	hl_pool_worker **workers;
+	hl_queue *inject;
+	hl_condition *park;
+	int nthreads;
+	int max_workers;
+	int reserved;
+	int count;
+	int live;
+	int sleepers;
+	int signals;
+	int stopping;
+};
+
+struct _hl_pool_group {
+	hl_pool *pool;
+	int pending;
+	vdynamic *exc;
+};
+
+HL_THREAD_STATIC_VAR hl_pool_worker *pool_current = NULL;
+
+HL_PRIM int hl_thread_cpu_count() {
+#	if !defined(HL_THREADS)
+	return 0;
+#	elif defined(HL_WIN)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#	else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : (int)n;
+#	endif
+}
+
+static hl_pool_buf *hl_pool_buf_alloc( int size ) {
+	hl_pool_buf *b = (hl_pool_buf*)hl_gc_alloc_raw(sizeof(hl_pool_buf) + (size - 1) * sizeof(hl_pool_task*));
+	b->mask = size - 1;
+	return b;
+}
+
+// owner only
+static void hl_pool_deque_push( hl_pool_worker *w, hl_pool_task *t ) {
+	int b = w->bottom;
+	int top = hl_atomic_load32(&w->top);
+	hl_pool_buf *buf = w->buf;
+	if( (int)((unsigned)b - (unsigned)top) > buf->mask ) {
+		hl_pool_buf *nb = hl_pool_buf_alloc((buf->mask + 1) << 1);
+		int i;
+		for(i=top;i!=b;i++)
+			nb->items[i & nb->mask] = buf->items[i & buf->mask];
+		hl_atomic_store_ptr((void**)&w->buf,nb);
+		buf = nb;
+	}
+	buf->items[b & buf->mask] = t;
+	hl_atomic_store32(&w->bottom,b + 1);
+}
+
+// owner only
+static hl_pool_task *hl_pool_deque_pop( hl_pool_worker *w ) {
+	int b = w->bottom - 1;
+	int top, size;
+	hl_pool_task *t;
+	hl_atomic_store32(&w->bottom,b);
+	top = hl_atomic_load32(&w->top);
+	size = (int)((unsigned)b - (unsigned)top);
+	if( size < 0 ) {
+		hl_atomic_store32(&w->bottom,top);
+		return NULL;
+	}
+	t = w->buf->items[b & w->buf->mask];
+	if( size > 0 )
+		return t;
+	// last task : race against thieves for it
+	if( hl_atomic_compare_exchange32(&w->top,top,top + 1) != top )
+		t = NULL;
+	hl_atomic_store32(&w->bottom,top + 1);
+	return t;
+}
+
+static hl_pool_task *hl_pool_deque_steal( hl_pool_worker *w ) {
+	int top = hl_atomic_load32(&w->top);
+	int b = hl_atomic_load32(&w->bottom);
+	hl_pool_buf *buf;
+	hl_pool_task *t;
+	if( (int)((unsigned)b - (unsigned)top) <= 0 )
+		return NULL;
+	buf = (hl_pool_buf*)hl_atomic_load_ptr((void**)&w->buf);
+	t = buf->items[top & buf->mask];
+	if( hl_atomic_compare_exchange32(&w->top,top,top + 1) != top )
+		return NULL;
+	return t;
+}
+
+static bool hl_pool_has_work( hl_pool *p ) {
+	int i, count = hl_atomic_load32(&p->count);
+	if( hl_queue_size(p->inject) > 0 )
+		return true;
+	for(i=0;i<count;i++) {
+		hl_pool_worker *w = p->workers[i];
+		if( (int)((unsigned)hl_atomic_load32(&w->bottom) - (unsigned)hl_atomic_load32(&w->top)) > 0 )
+			return true;
+	}
+	return false;
+}
+
+static hl_pool_task *hl_pool_find_task( hl_pool *p, hl_pool_worker *w ) {
+	hl_pool_task *t;
+	int i, start, count;
+	if( w && (t = hl_pool_deque_pop(w)) != NULL )
+		return t;
+	t = (hl_pool_task*)hl_queue_pop(p->inject,false);
+	if( t ) return t;
+	count = hl_atomic_load32(&p->count);
+	if( count == 0 ) return NULL;
+	if( w ) {
+		w->rnd ^= w->rnd << 13;
+		w->rnd ^= w->rnd >> 17;
+		w->rnd ^= w->rnd << 5;
+		start = (int)(w->rnd % (unsigned)count);
+	} else
+		start = 0;
+	for(i=0;i<count;i++) {
+		hl_pool_worker *v = p->workers[(start + i) % count];
+		if( v == w ) continue;
+		t = hl_pool_deque_steal(v);
+		if( t ) return t;
+	}
+	return NULL;
+}
+
+static void hl_pool_wake( hl_pool *p, bool all ) {
+	if( hl_atomic_load32(&p->sleepers) == 0 )
+		return;
+	hl_condition_acquire(p->park);
+	p->signals++;
+	if( all )
+		hl_condition_broadcast(p->park);
+	else
+		hl_condition_signal(p->park);
+	hl_condition_release(p->park);
+}
+
+/*
+	Sleep until some work is pushed or *counter reaches zero. Same protocol
+	as hl_queue_wait : sleepers are counted before checking, so a thread
+	pushing work either sees us or its work is seen by the check.
+	hl_condition_* enter blocking mode while waiting for the lock.
+*/
+static void hl_pool_park( hl_pool *p, int *counter ) {
+	int seen;
+	hl_atomic_add32(&p->sleepers,1);
+	seen = hl_atomic_load32(&p->signals);
+	if( !hl_pool_has_work(p) && (counter ? hl_atomic_load32(counter) > 0 : !hl_atomic_load32(&p->stopping)) ) {
+		hl_condition_acquire(p->park);
+		while( p->signals == seen )
+			hl_condition_wait(p->park);
+		hl_condition_release(p->park);
+	}
+	hl_atomic_sub32(&p->sleepers,1);
+}
+
+static void hl_pool_push( hl_pool *p, hl_pool_task *t ) {
+	hl_pool_worker *w = pool_current;
+	if( t->group ) hl_atomic_add32(&t->group->pending,1);
+	if( w && w->pool == p )
+		hl_pool_deque_push(w,t);
+	else
+		hl_queue_push(p->inject,(vdynamic*)t,false);
+	hl_pool_wake(p,false);
+}
+
+static void hl_pool_run( hl_pool *p, hl_pool_task *t ) {
+	hl_pool_group *g = t->group;
+	vdynamic *ret;
+	bool isExc;
+	if( t->grain > 0 ) {
+		vdynamic *args[2];
+		int start = t->start, end = t->end;
+		// keep the upper halves for thieves and run the first chunk ourselves
+		while( end - start > t->grain ) {
+			hl_pool_task *r = (hl_pool_task*)hl_gc_alloc_raw(sizeof(hl_pool_task));
+			int mid = start + ((end - start) >> 1);
+			*r = *t;
+			r->start = mid;
+			r->end = end;
+			hl_pool_push(p,r);
+			end = mid;
+		}
+		args[0] = hl_make_dyn(&start,&hlt_i32);
+		args[1] = hl_make_dyn(&end,&hlt_i32);
+		ret = hl_dyn_call_safe(t->fun,args,2,&isExc);
+	} else
+		ret = hl_dyn_call_safe(t->fun,NULL,0,&isExc);
+	if( !g ) {
+		if( isExc ) hl_print_uncaught_exception(ret);
+		return;
+	}
+	if( isExc ) hl_atomic_compare_exchange_ptr((void**)&g->exc,NULL,ret);
+	if( hl_atomic_sub32(&g->pending,1) == 1 )
+		hl_pool_wake(p,true);
+}
+
+// run tasks until *counter reaches zero
+static void hl_pool_help( hl_pool *p, int *counter ) {
+	hl_pool_worker *w = pool_current;
+	int spin = 0;
+	if( w && w->pool != p ) w = NULL;
+	while( hl_atomic_load32(counter) > 0 ) {
+		hl_pool_task *t = hl_pool_find_task(p,w);
+		if( t ) {
+			hl_pool_run(p,t);
+			spin = 0;
+		} else if( ++spin > POOL_SPIN ) {
+#			ifdef HL_THREADS
+			hl_pool_park(p,counter);
+#			endif
+			spin = 0;
+		} else
+			hl_thread_yield();
+	}
+}
+
+static void hl_pool_worker_main( hl_pool_worker *w ) {
+	hl_pool *p = w->pool;
+	int spin = 0;
+	pool_current = w;
+	while( true ) {
+		hl_pool_task *t = hl_pool_find_task(p,w);
+		if( t ) {
+			hl_pool_run(p,t);
+			spin = 0;
+			continue;
+		}
+		if( hl_atomic_load32(&p->stopping) )
+			break;
+		if( ++spin > POOL_SPIN ) {
+			hl_pool_park(p,NULL);
+			spin = 0;
+		} else
+			hl_thread_yield();
+	}
+	pool_current = NULL;
+	if( hl_atomic_sub32(&p->live,1) == 1 )
+		hl_pool_wake(p,true);
+}
+
+static bool hl_pool_spawn( hl_pool *p ) {
+	hl_pool_worker *w;
+	int index = hl_atomic_load32(&p->count);
+	// reserved is only ahead of count while a worker is being started
+	if( index >= p->max_workers || hl_atomic_compare_exchange32(&p->reserved,index,index + 1) != index )
+		return false;
+	w = (hl_pool_worker*)hl_gc_alloc_raw(sizeof(hl_pool_worker));
+	memset(w,0,sizeof(hl_pool_worker));
+	w->buf = hl_pool_buf_alloc(POOL_DEQUE_INIT);
+	w->pool = p;
+	w->rnd = (unsigned int)index * 0x9E3779B9 + 1;
+	hl_atomic_add32(&p->live,1);
+	if( hl_thread_start(hl_pool_worker_main,w,true) == NULL ) {
+		hl_atomic_sub32(&p->live,1);
+		hl_atomic_store32(&p->reserved,index);
+		return false;
+	}
+	hl_atomic_store_ptr((void**)&p->workers[index],w);
+	hl_atomic_store32(&p->count,index + 1);
+	return true;
+}
+
+HL_PRIM hl_pool *hl_pool_alloc( int nthreads ) {
+	hl_pool *p = (hl_pool*)hl_gc_alloc_raw(sizeof(hl_pool));
+	int i;
+	memset(p,0,sizeof(hl_pool));
+	if( nthreads <= 0 ) nthreads = hl_thread_cpu_count();
+#	ifndef HL_THREADS
+	nthreads = 0;
+#	endif
+	if( nthreads > POOL_MAX_WORKERS ) nthreads = POOL_MAX_WORKERS;
+	p->nthreads = nthreads;
+	// leave room for workers started while others are blocked
+	p->max_workers = nthreads * 2 > POOL_MAX_WORKERS ? POOL_MAX_WORKERS : nthreads * 2;
+	p->workers = (hl_pool_worker**)hl_gc_alloc_raw(sizeof(hl_pool_worker*) * (p->max_workers + 1));
+	memset(p->workers,0,sizeof(hl_pool_worker*) * (p->max_workers + 1));
+	p->inject = hl_queue_alloc(0);
+	p->park = hl_condition_alloc();
+	for(i=0;i<nthreads;i++)
+		if( !hl_pool_spawn(p) )
+			hl_error("Failed to start pool thread");
+	return p;
+}
+
+HL_PRIM void hl_pool_submit( hl_pool *p, vclosure *f ) {
+	hl_pool_task *t;
+	if( hl_atomic_load32(&p->stopping) ) hl_error("Pool is shut down");
+	t = (hl_pool_task*)hl_gc_alloc_raw(sizeof(hl_pool_task));
+	memset(t,0,sizeof(hl_pool_task));
+	t->fun = f;
+	// no thread to run it later
+	if( p->nthreads == 0 ) {
+		hl_pool_run(p,t);
+		return;
+	}
+	hl_pool_push(p,t);
+}
+
+HL_PRIM hl_pool_group *hl_pool_group_alloc( hl_pool *p ) {
+	hl_pool_group *g = (hl_pool_group*)hl_gc_alloc_raw(sizeof(hl_pool_group));
+	g->pool = p;
+	g->pending = 0;
+	g->exc = NULL;
+	return g;
+}
+
+HL_PRIM void hl_pool_group_fork( hl_pool_group *g, vclosure *f ) {
+	hl_pool_task *t = (hl_pool_task*)hl_gc_alloc_raw(sizeof(hl_pool_task));
+	memset(t,0,sizeof(hl_pool_task));
+	t->fun = f;
+	t->group = g;
+	hl_pool_push(g->pool,t);
+}
+
+/*
+	Wait until all tasks forked in the group are done, running pending tasks
+	meanwhile. Rethrows the first exception raised by one of them.
+*/
+HL_PRIM void hl_pool_group_join( hl_pool_group *g ) {
+	vdynamic *exc;
+	hl_pool_help(g->pool,&g->pending);
+	exc = (vdynamic*)hl_atomic_exchange_ptr((void**)&g->exc,NULL);
+	if( exc ) hl_rethrow(exc);
+}
+
+HL_PRIM void hl_pool_parallel_for( hl_pool *p, int start, int end, int grain, vclosure *f ) {
+	hl_pool_group *g;
+	hl_pool_task *t;
+	if( end <= start ) return;
+	if( grain <= 0 ) {
+		grain = (end - start) / ((p->nthreads + 1) * 8);
+		if( grain < 1 ) grain = 1;
+	}
+	g = hl_pool_group_alloc(p);
+	t = (hl_pool_task*)hl_gc_alloc_raw(sizeof(hl_pool_task));
+	t->fun = f;
+	t->group = g;
+	t->start = start;
+	t->end = end;
+	t->grain = grain;
+	hl_pool_push(p,t);
+	hl_pool_group_join(g);
+}
+
+/*
+	To be called around a blocking operation done by a task. A new worker is
+	started if no other is idle, so the pool keeps its parallelism while
+	this one is waiting.
+*/
+HL_PRIM void hl_pool_blocking( bool b ) {
+	hl_pool_worker *w = pool_current;
+	if( b && w ) {
+		hl_pool *p = w->pool;
+		if( hl_atomic_load32(&p->sleepers) == 0 && !hl_atomic_load32(&p->stopping) && hl_pool_has_work(p) )
+			hl_pool_spawn(p);
+	}
+	hl_blocking(b);
+}
+
+HL_PRIM int hl_pool_worker_count( hl_pool *p ) {
+	return hl_atomic_load32(&p->count);
+}
+
+// stop accepting tasks, and wait until all queued ones are done and workers have exited
+HL_PRIM void hl_pool_shutdown( hl_pool *p ) {
+	if( hl_atomic_exchange32(&p->stopping,1) )
+		return;
+	hl_pool_wake(p,true);
+	hl_pool_help(p,&p->live);
+}
+
+#define _POOL _ABSTRACT(hl_pool)
+#define _POOL_GROUP _ABSTRACT(hl_pool_group)
+DEFINE_PRIM(_POOL, pool_alloc, _I32);
+DEFINE_PRIM(_VOID, pool_submit, _POOL _FUN(_VOID,_NO_ARG));
+DEFINE_PRIM(_POOL_GROUP, pool_group_alloc, _POOL);
+DEFINE_PRIM(_VOID, pool_group_fork, _POOL_GROUP _FUN(_VOID,_NO_ARG));
+DEFINE_PRIM(_VOID, pool_group_join, _POOL_GROUP);
+DEFINE_PRIM(_VOID, pool_parallel_for, _POOL _I32 _I32 _I32 _FUN(_VOID,_I32 _I32));
+DEFINE_PRIM(_VOID, pool_blocking, _BOOL);
+DEFINE_PRIM(_I32, pool_worker_count, _POOL);
+DEFINE_PRIM(_VOID, pool_shutdown, _POOL);
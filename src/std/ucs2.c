@@ -272,3 +272,14 @@ sprintf_add:
 }
 
 #endif
+
+// compare with len one-byte chars, as ucmp would do with them widened
+int ucmp_latin1( const uchar *a, const unsigned char *b, int len ) {
+	int i;
+	for(i=0;i<len;i++) {
+		int d = (unsigned)a[i] - (unsigned)b[i];
+		if( d ) return d;
+		if( !a[i] ) return 0;
+	}
+	return (unsigned)a[len];
+}